@@ -340,6 +340,67 @@ void Fl::remove_timeout(Fl_Timeout_Handler cb, void *argp) {
   Fl::screen_driver()->remove_timeout(cb, argp);
 }
 
+/**
+ Adds a one-shot timeout callback and returns an identifier for it.
+
+ This works like Fl::add_timeout(), but the returned identifier can be
+ used to test for or remove exactly this timeout with Fl::has_timeout_id()
+ and Fl::remove_timeout_id(), which is faster than searching for a
+ callback and data pair. Timeouts added by this function can only be
+ removed with Fl::remove_timeout_id(): Fl::has_timeout() and
+ Fl::remove_timeout() ignore them on all platforms. The identifier of a
+ pending timeout is never given to another one, even after the
+ identifiers wrap around.
+
+ The optional \p slack gives how many seconds the callback may be called
+ later than \p t. FLTK uses it to call several timeouts that are due at
+ nearly the same time after a single wakeup, which saves CPU time when a
+ program has many periodic timeouts that don't need to be exact.
+
+ \param[in] t       delay in seconds before the callback is called
+ \param[in] cb      the callback
+ \param[in] data    passed to the callback
+ \param[in] slack   accepted lateness of the callback in seconds
+ \return an identifier of the new timeout, or 0 on error
+
+ \see Fl::repeat_timeout_id()
+ \version 1.4.0
+ */
+Fl_Timeout_Id Fl::add_timeout_id(double t, Fl_Timeout_Handler cb, void *data, double slack) {
+  return Fl::screen_driver()->add_timeout_id(t, cb, data, slack);
+}
+
+/**
+ Repeats a timeout callback from the expiration of the previous timeout
+ and returns an identifier for it.
+ This is the equivalent of Fl::repeat_timeout() for Fl::add_timeout_id().
+ You may only call this method inside a timeout callback.
+ \version 1.4.0
+ */
+Fl_Timeout_Id Fl::repeat_timeout_id(double t, Fl_Timeout_Handler cb, void *data, double slack) {
+  return Fl::screen_driver()->repeat_timeout_id(t, cb, data, slack);
+}
+
+/**
+ Returns true if the timeout identified by \p id exists and has not been
+ called yet.
+ \see Fl::add_timeout_id()
+ \version 1.4.0
+ */
+int Fl::has_timeout_id(Fl_Timeout_Id id) {
+  return id ? Fl::screen_driver()->has_timeout_id(id) : 0;
+}
+
+/**
+ Removes the timeout identified by \p id. It is harmless to remove a
+ timeout that was already called or removed.
+ \see Fl::add_timeout_id()
+ \version 1.4.0
+ */
+void Fl::remove_timeout_id(Fl_Timeout_Id id) {
+  if (id) Fl::screen_driver()->remove_timeout_id(id);
+}
+
 
 
 ////////////////////////////////////////////////////////////////
@@ -60,8 +60,8 @@ class BMPReader
 public:
   // Create the reader.
   BMPReader() :
-  pIsFile(0), pIsData(0),
-  pFile(0L), pData(0L), pStart(0L),
+  pIsFile(0), pIsData(0), pIsEOF(0),
+  pFile(0L), pData(0L), pStart(0L), pEnd(0L),
   pName(0L)
   { }
   // Initialize the reader to access the file system, filename is copied
@@ -76,12 +76,14 @@ public:
     pIsFile = 1;
     return 0;
   }
-  // Initialize the reader for memory access, name is copied and stored
-  int open(const char *imagename, const unsigned char *data) {
+  // Initialize the reader for memory access, name is copied and stored.
+  // If length is not negative, no data is read after data + length.
+  int open(const char *imagename, const unsigned char *data, long length = -1) {
     if (imagename)
       pName = strdup(imagename);
     if (data) {
       pStart = pData = data;
+      if (length >= 0) pEnd = data + length;
       pIsData = 1;
       return 0;
     } else {
@@ -101,6 +103,10 @@ public:
     if (pIsFile) {
       return getc(pFile);
     } else if (pIsData) {
+      if (pEnd && pData >= pEnd) {
+        pIsEOF = 1;
+        return 0;
+      }
       return *pData++;
     } else {
       return 0;
@@ -114,8 +120,8 @@ public:
       b1 = (uchar)getc(pFile);
       return ((b1 << 8) | b0);
     } else if (pIsData) {
-      b0 = *pData++;
-      b1 = *pData++;
+      b0 = read_byte();
+      b1 = read_byte();
       return ((b1 << 8) | b0);
     } else {
       return 0;
@@ -131,10 +137,10 @@ public:
       b3 = (uchar)getc(pFile);
       return ((((((b3 << 8) | b2) << 8) | b1) << 8) | b0);
     } else if (pIsData) {
-      b0 = *pData++;
-      b1 = *pData++;
-      b2 = *pData++;
-      b3 = *pData++;
+      b0 = read_byte();
+      b1 = read_byte();
+      b2 = read_byte();
+      b3 = read_byte();
       return ((((((b3 << 8) | b2) << 8) | b1) << 8) | b0);
     } else {
       return 0;
@@ -154,18 +160,24 @@ public:
     }
   }
   // return the name or filename for this reader
-  const char *name() { return pName; }
+  const char *name() { return pName ? pName : "<unnamed>"; }
+  // return non-zero if we tried to read past the end of the data
+  int eof() { return pIsFile ? feof(pFile) : pIsEOF; }
 private:
   // open() sets this if we read form a file
   char pIsFile;
   // open() sets this if we read form memory
   char pIsData;
+  // read_byte() sets this if it reached pEnd
+  char pIsEOF;
   // a pointer to the opened file
   FILE *pFile;
   // a pointer to the current byte in memory
   const unsigned char *pData;
   // a pointer to the start of the image data
   const unsigned char *pStart;
+  // a pointer to the end of the image data, or NULL if unknown
+  const unsigned char *pEnd;
   // a copy of the name associated with this reader
   char *pName;
 };
@@ -211,16 +223,20 @@ Fl_BMP_Image::Fl_BMP_Image(const char *filename) // I - File to read
  be loaded for another reason.
 
  \param[in] imagename  A name given to this image or NULL
- \param[in] data       Pointer to the start of the BMP image in memory. This code will not check for buffer overruns.
+ \param[in] data       Pointer to the start of the BMP image in memory.
+ \param[in] length     Number of bytes of the BMP image data. If it is negative
+                       (the default), this code will not check for buffer
+                       overruns. Otherwise fail() returns ERR_FORMAT if the
+                       data is cut short (since 1.4.0).
 
  \see Fl_BMP_Image::Fl_BMP_Image(const char *filename)
  \see Fl_Shared_Image
 */
-Fl_BMP_Image::Fl_BMP_Image(const char *imagename, const unsigned char *data)
+Fl_BMP_Image::Fl_BMP_Image(const char *imagename, const unsigned char *data, long length)
 : Fl_RGB_Image(0,0,0)
 {
   BMPReader d;
-  if (d.open(imagename, data)==-1) {
+  if (d.open(imagename, data, length)==-1) {
     ld(ERR_FILE_ACCESS);
   } else {
     load_bmp_(d);
@@ -384,6 +400,9 @@ void Fl_BMP_Image::load_bmp_(class BMPReader &rdr)
   }
 
   for (y = start_y; y != end_y; y += row_order) {
+    // Stop if the data was cut short; RLE data may end before the last row
+    if (rdr.eof() && compression != BI_RLE4 && compression != BI_RLE8) break;
+
     ptr = (uchar *)array + y * w() * d();
 
     switch (depth)
@@ -585,8 +604,10 @@ void Fl_BMP_Image::load_bmp_(class BMPReader &rdr)
     }
   }
   
-  if (havemask) {
+  if (havemask && y == end_y) {
     for (y = h() - 1; y >= 0; y --) {
+      if (rdr.eof()) break;
+
       ptr = (uchar *)array + y * w() * d() + 3;
       for (x = w(), bit = 128; x > 0; x --, ptr+=bDepth) {
         if (bit == 128) byte = rdr.read_byte();
@@ -603,6 +624,15 @@ void Fl_BMP_Image::load_bmp_(class BMPReader &rdr)
       for (temp = (w() + 7) / 8; temp & 3; temp ++)
         rdr.read_byte();
     }
+    if (y < 0) y = end_y;
+  }
+
+  if (y != end_y) {
+    Fl::warning("BMP file \"%s\" is truncated!\n", rdr.name());
+    delete[] (uchar *)array;
+    array = 0;
+    alloc_array = 0;
+    w(0); h(0); d(0); ld(ERR_FORMAT);
   }
   // File is closed when returning...
 }
@@ -93,8 +93,8 @@ class GIFReader
 public:
   // Create the reader.
   GIFReader() :
-  pIsFile(0), pIsData(0),
-  pFile(0L), pData(0L),
+  pIsFile(0), pIsData(0), pIsEOF(0),
+  pFile(0L), pData(0L), pEnd(0L),
   pName(0L)
   { }
   // Initialize the reader to access the file system, filename is copied
@@ -109,12 +109,14 @@ public:
     pIsFile = 1;
     return 0;
   }
-  // Initialize the reader for memory access, name is copied and stored
-  int open(const char *imagename, const unsigned char *data) {
+  // Initialize the reader for memory access, name is copied and stored.
+  // If length is not negative, no data is read after data + length.
+  int open(const char *imagename, const unsigned char *data, long length = -1) {
     if (imagename)
       pName = strdup(imagename);
     if (data) {
       pData = data;
+      if (length >= 0) pEnd = data + length;
       pIsData = 1;
       return 0;
     } else {
@@ -134,6 +136,10 @@ public:
     if (pIsFile) {
       return getc(pFile);
     } else if (pIsData) {
+      if (pEnd && pData >= pEnd) {
+        pIsEOF = 1;
+        return 0;
+      }
       return *pData++;
     } else {
       return 0;
@@ -147,24 +153,30 @@ public:
       b1 = (uchar)getc(pFile);
       return ((b1 << 8) | b0);
     } else if (pIsData) {
-      b0 = *pData++;
-      b1 = *pData++;
+      b0 = read_byte();
+      b1 = read_byte();
       return ((b1 << 8) | b0);
     } else {
       return 0;
     }
   }
   // return the name or filename for this reader
-  const char *name() { return pName; }
+  const char *name() { return pName ? pName : "<unnamed>"; }
+  // return non-zero if we tried to read past the end of the data
+  int eof() { return pIsFile ? feof(pFile) : pIsEOF; }
 private:
   // open() sets this if we read form a file
   char pIsFile;
   // open() sets this if we read form memory
   char pIsData;
+  // read_byte() sets this if it reached pEnd
+  char pIsEOF;
   // a pointer to the opened file
   FILE *pFile;
   // a pointer to the current byte in memory
   const unsigned char *pData;
+  // a pointer to the end of the image data, or NULL if unknown
+  const unsigned char *pEnd;
   // a copy of the name associated with this reader
   char *pName;
 };
@@ -218,16 +230,20 @@ Fl_GIF_Image::Fl_GIF_Image(const char *filename) :
  be loaded for another reason.
 
  \param[in] imagename  A name given to this image or NULL
- \param[in] data       Pointer to the start of the GIF image in memory. This code will not check for buffer overruns.
+ \param[in] data       Pointer to the start of the GIF image in memory.
+ \param[in] length     Number of bytes of the GIF image data. If it is negative
+                       (the default), this code will not check for buffer
+                       overruns. Otherwise fail() returns ERR_FORMAT if the
+                       data is cut short (since 1.4.0).
 
  \see Fl_GIF_Image::Fl_GIF_Image(const char *filename)
  \see Fl_Shared_Image
  */
-Fl_GIF_Image::Fl_GIF_Image(const char *imagename, const unsigned char *data) :
+Fl_GIF_Image::Fl_GIF_Image(const char *imagename, const unsigned char *data, long length) :
   Fl_Pixmap((char *const*)0)
 {
   GIFReader d;
-  if (d.open(imagename, data)==-1) {
+  if (d.open(imagename, data, length)==-1) {
     ld(ERR_FILE_ACCESS);
   } else {
     load_gif_(d);
@@ -289,7 +305,7 @@ void Fl_GIF_Image::load_gif_(GIFReader &rdr)
   for (;;) {
 
     int i = rdr.read_byte();
-    if (i<0) {
+    if (rdr.eof()) {
       Fl::error("Fl_GIF_Image: %s - unexpected EOF", rdr.name());
       w(0); h(0); d(0); ld(ERR_FORMAT);
       return;
@@ -474,6 +490,13 @@ void Fl_GIF_Image::load_gif_(GIFReader &rdr)
     OldCode = CurCode;
   }
 
+  if (rdr.eof()) {
+    Fl::error("Fl_GIF_Image: %s - unexpected EOF", rdr.name());
+    delete[] Image;
+    w(0); h(0); d(0); ld(ERR_FORMAT);
+    return;
+  }
+
   // We are done reading the file, now convert to xpm:
 
   // allocate line pointer arrays:
@@ -2755,9 +2755,13 @@ Fl_Help_View::get_color(const char *n,	// I - Color name
   This should be fixed in FLTK 1.3 !
 
 
-  If initial_load is true, then Fl_Shared_Image::get() is called to
+  If initial_load is true, then Fl_Shared_Image::get_async() is called to
   load the image, and the reference count of the shared image is
-  increased by one.
+  increased by one. The image is loaded in the background, and the
+  widget is redrawn when it is loaded. If it can't be loaded, e.g. if
+  its data is corrupt after a valid header, the document is formatted
+  again, with broken_image in place of the image that was removed from
+  the cache: see image_loaded_cb().
 
   If initial_load is false, then Fl_Shared_Image::find() is called to
   load the image, and the image is released immediately. This avoids
@@ -2771,6 +2775,15 @@ Fl_Help_View::get_color(const char *n,	// I - Color name
   a new document is loaded: see free_data().
 */
 
+// Formats the document again without an image that couldn't be loaded,
+// so that broken_image is shown and the document is laid out for it
+static void image_loaded_cb(Fl_Shared_Image *img, void *data) {
+  if (!img->fail()) return;
+  Fl_Help_View *view = (Fl_Help_View *)data;
+  view->resize(view->x(), view->y(), view->w(), view->h());
+  view->redraw();
+}
+
 Fl_Shared_Image *
 Fl_Help_View::get_image(const char *name, int W, int H) {
   const char	*localname;		// Local filename
@@ -2812,14 +2825,17 @@ Fl_Help_View::get_image(const char *name, int W, int H) {
   if (strncmp(localname, "file:", 5) == 0) localname += 5;
 
   if (initial_load) {
-    if ((ip = Fl_Shared_Image::get(localname, W, H)) == NULL) {
+    if ((ip = Fl_Shared_Image::get_async(localname, W, H, this,
+                                         image_loaded_cb, this)) == NULL) {
       ip = (Fl_Shared_Image *)&broken_image;
     }
   } else { // draw or resize
     if ((ip = Fl_Shared_Image::find(localname, W, H)) == NULL) {
       ip = (Fl_Shared_Image *)&broken_image;
     } else {
+      int failed = ip->fail();
       ip->release();
+      if (failed) ip = (Fl_Shared_Image *)&broken_image;
     }
   }
 
@@ -22,7 +22,11 @@
 #include <FL/Fl_Widget.H>
 #include <FL/Fl_Menu_Item.H>
 #include <FL/Fl_Image.H>
+#include <FL/math.h>
 #include "flstring.h"
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#endif
 
 void fl_restore_clip(); // from fl_rect.cxx
 
@@ -221,6 +225,11 @@ Fl_Image::measure(const Fl_Label *lo,		// I - Label
 
 /** Sets the RGB image scaling method used for copy(int, int).
     Applies to all RGB images, defaults to FL_RGB_SCALING_NEAREST.
+
+    FL_RGB_SCALING_BOX averages all source pixels covered by a destination
+    pixel and is the method of choice for thumbnails.
+    FL_RGB_SCALING_CATMULL_ROM and FL_RGB_SCALING_LANCZOS keep edges
+    sharper when reducing and enlarging images, at a higher cost.
 */
 void Fl_Image::RGB_scaling(Fl_RGB_Scaling method) {
   RGB_scaling_ = method;
@@ -393,6 +402,196 @@ void Fl_RGB_Image::uncache() {
   Fl_Graphics_Driver::default_driver().uncache(this, id_, mask_);
 }
 
+//
+// Separable resampling filters used by Fl_RGB_Image::copy() for
+// FL_RGB_SCALING_BOX, FL_RGB_SCALING_CATMULL_ROM and FL_RGB_SCALING_LANCZOS.
+//
+// The image is first filtered horizontally into a 16-bit intermediate
+// buffer holding 8.6 fixed point values, then vertically into the
+// destination. Filter weights are 2.14 fixed point and each set of
+// weights sums up to exactly 1 << 14, so flat areas stay flat.
+//
+
+// Returns the filter value at distance x from the sample center
+static double resample_filter(Fl_RGB_Scaling m, double x) {
+  if (x < 0) x = -x;
+  if (m == FL_RGB_SCALING_CATMULL_ROM) {
+    if (x < 1) return (1.5 * x - 2.5) * x * x + 1;
+    if (x < 2) return ((-0.5 * x + 2.5) * x - 4) * x + 2;
+    return 0;
+  }
+  // FL_RGB_SCALING_LANCZOS with 3 lobes
+  if (x < 1e-6) return 1;
+  if (x >= 3) return 0;
+  double px = M_PI * x;
+  return 3 * sin(px) * sin(px / 3) / (px * px);
+}
+
+// Computes the first source pixel, the number of source pixels and their
+// weights (n per destination pixel) for each of the dst destination pixels.
+// Returns the weight array, which must be deleted by the caller.
+static short *resample_weights(Fl_RGB_Scaling m, int src, int dst,
+                               int *start, int *count, int &n) {
+  double scale = (double)src / dst;
+  double fscale = scale > 1 ? scale : 1;	// widen the filter when reducing
+  double support = (m == FL_RGB_SCALING_BOX ? 0.5 :
+                    m == FL_RGB_SCALING_CATMULL_ROM ? 2.0 : 3.0) * fscale;
+  n = (int)ceil(2 * support) + 2;
+  short *weights = new short[dst * n];
+  double *w = new double[n];
+
+  for (int i = 0; i < dst; i++) {
+    double center = (i + 0.5) * scale;
+    int left = (int)floor(center - support);
+    int right = (int)ceil(center + support);	// exclusive
+    if (right - left > n) right = left + n;
+    int lo = left < 0 ? 0 : left;
+    int hi = right > src ? src : right;
+    if (hi <= lo) { lo = (int)center; if (lo >= src) lo = src - 1; hi = lo + 1; }
+    int k;
+    for (k = 0; k < hi - lo; k++) w[k] = 0;
+    double total = 0;
+    for (int j = left; j < right; j++) {
+      double v;
+      if (m == FL_RGB_SCALING_BOX) {
+        // coverage of source pixel j by the destination pixel
+        double a = center - support > j ? center - support : j;
+        double b = center + support < j + 1 ? center + support : j + 1;
+        v = b > a ? b - a : 0;
+      } else {
+        v = resample_filter(m, (j + 0.5 - center) / fscale);
+      }
+      // pixels outside the image repeat the edge pixels
+      int jj = j < lo ? lo : j >= hi ? hi - 1 : j;
+      w[jj - lo] += v;
+      total += v;
+    }
+    start[i] = lo;
+    count[i] = hi - lo;
+    short *iw = weights + i * n;
+    if (total == 0) {			// can't happen, but be safe
+      for (k = 0; k < hi - lo; k++) iw[k] = 0;
+      iw[0] = 1 << 14;
+      continue;
+    }
+    int sum = 0, big = 0;
+    for (k = 0; k < hi - lo; k++) {
+      iw[k] = (short)floor(w[k] / total * (1 << 14) + 0.5);
+      sum += iw[k];
+      if (iw[k] > iw[big]) big = k;
+    }
+    iw[big] += (short)((1 << 14) - sum);	// put the rounding error into the largest weight
+  }
+
+  delete[] w;
+  return weights;
+}
+
+// Filters one row of d-channel pixels horizontally to W 8.6 fixed point pixels
+static void resample_row_h(const uchar *src, short *dst, int W, int d,
+                           const int *start, const int *count,
+                           const short *weights, int n) {
+  int ch;
+  for (int x = 0; x < W; x++, weights += n) {
+    const uchar *s = src + start[x] * d;
+    int c = count[x], acc[4] = { 128, 128, 128, 128 };
+    for (int k = 0; k < c; k++, s += d) {
+      int wk = weights[k];
+      for (ch = 0; ch < d; ch++) acc[ch] += wk * s[ch];
+    }
+    for (ch = 0; ch < d; ch++) *dst++ = (short)(acc[ch] >> 8);
+  }
+}
+
+// Filters c intermediate rows vertically to one row of len bytes
+static void resample_row_v(short *const *rows, const short *w, int c,
+                           uchar *dst, int len) {
+  int i = 0;
+#if defined(__SSE2__)
+  // process 8 values per step, two source rows at a time with pmaddwd
+  const __m128i round = _mm_set1_epi32(1 << 19);
+  for (; i + 8 <= len; i += 8) {
+    __m128i lo = round, hi = round, a, b, wp;
+    int k;
+    for (k = 0; k + 1 < c; k += 2) {
+      a  = _mm_loadu_si128((const __m128i *)(rows[k] + i));
+      b  = _mm_loadu_si128((const __m128i *)(rows[k + 1] + i));
+      wp = _mm_set1_epi32((int)((unsigned short)w[k] |
+                                ((unsigned)(unsigned short)w[k + 1] << 16)));
+      lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), wp));
+      hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), wp));
+    }
+    if (k < c) {
+      a  = _mm_loadu_si128((const __m128i *)(rows[k] + i));
+      b  = _mm_setzero_si128();
+      wp = _mm_set1_epi32((unsigned short)w[k]);
+      lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), wp));
+      hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), wp));
+    }
+    lo = _mm_packs_epi32(_mm_srai_epi32(lo, 20), _mm_srai_epi32(hi, 20));
+    _mm_storel_epi64((__m128i *)(dst + i), _mm_packus_epi16(lo, lo));
+  }
+#endif // __SSE2__
+  for (; i < len; i++) {
+    int acc = 1 << 19;
+    for (int k = 0; k < c; k++) acc += w[k] * rows[k][i];
+    acc >>= 20;
+    dst[i] = (uchar)(acc < 0 ? 0 : acc > 255 ? 255 : acc);
+  }
+}
+
+// Resamples a (sw x sh x d) image with line stride ld to (W x H x d)
+static void resample_image(Fl_RGB_Scaling m, const uchar *src, int sw, int sh,
+                           int d, int ld, uchar *dst, int W, int H) {
+  int *xstart = new int[W], *xcount = new int[W], xn;
+  int *ystart = new int[H], *ycount = new int[H], yn;
+  short *xweights = resample_weights(m, sw, W, xstart, xcount, xn);
+  short *yweights = resample_weights(m, sh, H, ystart, ycount, yn);
+  int alpha = (d == 2 || d == 4) ? d - 1 : -1;	// index of the alpha channel
+  int len = W * d;
+  short *tmp = new short[sh * len];
+  short **rows = new short*[yn];
+  uchar *pre = alpha < 0 ? 0 : new uchar[sw * d];
+  int x, y, k;
+
+  // Horizontal pass, with premultiplied alpha if needed
+  for (y = 0; y < sh; y++) {
+    const uchar *s = src + y * ld;
+    if (pre) {
+      for (x = 0; x < sw * d; x += d) {
+        unsigned a = s[x + alpha];
+        for (k = 0; k < alpha; k++) pre[x + k] = (uchar)((s[x + k] * a + 127) / 255);
+        pre[x + alpha] = (uchar)a;
+      }
+      s = pre;
+    }
+    resample_row_h(s, tmp + y * len, W, d, xstart, xcount, xweights, xn);
+  }
+
+  // Vertical pass
+  for (y = 0; y < H; y++) {
+    for (k = 0; k < ycount[y]; k++) rows[k] = tmp + (ystart[y] + k) * len;
+    uchar *p = dst + y * len;
+    resample_row_v(rows, yweights + y * yn, ycount[y], p, len);
+    if (pre) {
+      for (x = 0; x < len; x += d) {
+        unsigned a = p[x + alpha];
+        for (k = 0; k < alpha; k++) {
+          unsigned v = a ? (p[x + k] * 255 + a / 2) / a : 0;
+          p[x + k] = (uchar)(v > 255 ? 255 : v);
+        }
+      }
+    }
+  }
+
+  delete[] pre;
+  delete[] rows;
+  delete[] tmp;
+  delete[] xweights; delete[] yweights;
+  delete[] xstart; delete[] xcount;
+  delete[] ystart; delete[] ycount;
+}
+
 Fl_Image *Fl_RGB_Image::copy(int W, int H) {
   Fl_RGB_Image	*new_image;	// New RGB image
   uchar		*new_array;	// New array for image data
@@ -474,7 +673,7 @@ Fl_Image *Fl_RGB_Image::copy(int W, int H) {
         sy ++;
       }
     }
-  } else {
+  } else if (Fl_Image::RGB_scaling() == FL_RGB_SCALING_BILINEAR) {
     // Bilinear scaling (FL_RGB_SCALING_BILINEAR)
     const float xscale = (data_w() - 1) / (float) W;
     const float yscale = (data_h() - 1) / (float) H;
@@ -536,6 +735,10 @@ Fl_Image *Fl_RGB_Image::copy(int W, int H) {
         }
       }
     }
+  } else {
+    // Box, Catmull-Rom or Lanczos filtering
+    resample_image(Fl_Image::RGB_scaling(), array, data_w(), data_h(), d(),
+                   line_d, new_array, W, H);
   }
 
   return new_image;
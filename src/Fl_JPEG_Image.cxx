@@ -104,6 +104,32 @@ Fl_JPEG_Image::Fl_JPEG_Image(const char *filename)
   load_jpg_(filename, 0L, 0L);
 }
 
+/**
+ \brief The constructor loads the JPEG image from the given jpeg filename
+ at a reduced size.
+
+ The image is decoded at 1/2, 1/4 or 1/8 of its size, whichever is the
+ smallest that is still at least \p W x \p H pixels, or at full size if
+ the image is not larger than twice the requested size. This skips most of
+ the decoding work and memory needed for large photos when only a
+ thumbnail is needed. Use copy(W, H) to get an image of exactly the
+ requested size.
+
+ Use Fl_Image::fail() to check if Fl_JPEG_Image failed to load, like
+ with Fl_JPEG_Image::Fl_JPEG_Image(const char *filename).
+
+ \param[in] filename a full path and name pointing to a valid jpeg file.
+ \param[in] W, H the minimum size of the decoded image
+
+ \see Fl_Shared_Image::get(const char *name, int W, int H)
+ \since FLTK 1.4.0
+ */
+Fl_JPEG_Image::Fl_JPEG_Image(const char *filename, int W, int H)
+: Fl_RGB_Image(0,0,0)
+{
+  load_jpg_(filename, 0L, 0L, W, H);
+}
+
 /**
  \brief The constructor loads the JPEG image from memory.
 
@@ -209,9 +235,11 @@ static void jpeg_mem_src(j_decompress_ptr cinfo, const unsigned char *data)
  This method reads JPEG image data and creates an RGB or grayscale image.
  To avoid code duplication, we set filename if we want to read form a file or
  data to read from memory instead. Sharename can be set if the image is
- supposed to be added to teh Fl_Shared_Image list.
+ supposed to be added to teh Fl_Shared_Image list. If W and H are set, the
+ image is decoded at the smallest scale that still gives W x H pixels.
  */
-void Fl_JPEG_Image::load_jpg_(const char *filename, const char *sharename, const unsigned char *data)
+void Fl_JPEG_Image::load_jpg_(const char *filename, const char *sharename, const unsigned char *data,
+                              int W, int H)
 {
 #ifdef HAVE_LIBJPEG
   FILE                   *fp = 0L;  // File pointer
@@ -299,6 +327,18 @@ void Fl_JPEG_Image::load_jpg_(const char *filename, const char *sharename, const
   dinfo.out_color_components = 3;
   dinfo.output_components    = 3;
 
+  if (W > 0 && H > 0) {
+    // Let the IDCT drop the coefficients not needed for a reduced image
+    unsigned denom = 1;
+    while (denom < 8 &&
+           (dinfo.image_width + 2 * denom - 1) / (2 * denom) >= (unsigned)W &&
+           (dinfo.image_height + 2 * denom - 1) / (2 * denom) >= (unsigned)H)
+      denom *= 2;
+    dinfo.scale_num   = 1;
+    dinfo.scale_denom = denom;
+    if (denom > 1) dinfo.do_fancy_upsampling = (boolean)FALSE;
+  }
+
   jpeg_calc_output_dimensions(&dinfo);
 
   w(dinfo.output_width);
@@ -0,0 +1,799 @@
+//
+// "$Id$"
+//
+// Fl_Progressive_Image routines.
+//
+// Copyright 1998-2018 by Bill Spitzak and others.
+//
+// This library is free software. Distribution and use rights are outlined in
+// the file "COPYING" which should have been included with this file.  If this
+// file is missing or damaged, see the license at:
+//
+//     http://www.fltk.org/COPYING.php
+//
+// Please report all bugs and problems on the following page:
+//
+//     http://www.fltk.org/str.php
+//
+// Contents:
+//
+//   Fl_Progressive_Image::Fl_Progressive_Image() - Create an empty image.
+//   Fl_Progressive_Image::feed()                 - Decode more data.
+//   Fl_Progressive_Image::finish()               - Decode the end of the data.
+//
+
+//
+// Include necessary header files...
+//
+
+#include <config.h>
+#include <FL/Fl.H>
+#include "Fl_System_Driver.H"
+#include <FL/Fl_Progressive_Image.H>
+#include <FL/Fl_BMP_Image.H>
+#include <FL/Fl_GIF_Image.H>
+#include <FL/Fl_JPEG_Image.H>
+#include <FL/Fl_PNG_Image.H>
+#include "flstring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <setjmp.h>
+
+#if defined(__CYGWIN__)
+#  define XMD_H
+#endif // __CYGWIN__
+
+extern "C"
+{
+#if defined(HAVE_LIBPNG) && defined(HAVE_LIBZ)
+#  include <zlib.h>
+#  ifdef HAVE_PNG_H
+#    include <png.h>
+#  else
+#    include <libpng/png.h>
+#  endif // HAVE_PNG_H
+#endif // HAVE_LIBPNG && HAVE_LIBZ
+#ifdef HAVE_LIBJPEG
+#  include <jpeglib.h>
+#endif // HAVE_LIBJPEG
+}
+
+#if defined(HAVE_LIBPNG) && defined(HAVE_LIBZ) && defined(PNG_PROGRESSIVE_READ_SUPPORTED)
+#  define FL_PROGRESSIVE_PNG
+#endif
+
+
+//
+// Base class of the decoders, the only one that may change the image...
+//
+
+class Fl_Progressive_Decoder {
+protected:
+  Fl_Progressive_Image *img_;
+
+  // Allocates the image data, returns -1 if the image is too large
+  int size(int W, int H, int D) { return img_->size_(W, H, D); }
+  uchar *array() { return (uchar *)img_->array; }
+  // Marks rows y0 to y1-1 as decoded
+  void rows(int y0, int y1) { img_->rows_(y0, y1); }
+
+  // Copies a whole image decoded by one of the image classes
+  int copy_image(Fl_RGB_Image *src) {
+    if (src->fail() || src->w() <= 0 || src->h() <= 0 ||
+        size(src->w(), src->h(), src->d()) < 0) return -1;
+
+    int wd = src->w() * src->d();
+    int ld = src->ld() ? src->ld() : wd;
+    for (int y = 0; y < src->h(); y ++)
+      memcpy(array() + y * wd, src->array + y * ld, wd);
+    rows(0, src->h());
+    return 0;
+  }
+
+public:
+  Fl_Progressive_Decoder(Fl_Progressive_Image *img) : img_(img) {}
+  virtual ~Fl_Progressive_Decoder() {}
+
+  // Decodes the next len bytes, returns -1 on error
+  virtual int feed(const uchar *buf, size_t len) = 0;
+  // Decodes what is left after the last byte, returns -1 on error
+  virtual int finish() = 0;
+};
+
+
+//
+// Decoder that keeps all data and decodes it in finish(), for formats
+// that are only supported by the image classes...
+//
+
+class Fl_Buffered_Decoder : public Fl_Progressive_Decoder {
+  uchar *data_;
+  size_t len_, alloc_;
+
+public:
+  Fl_Buffered_Decoder(Fl_Progressive_Image *img) : Fl_Progressive_Decoder(img) {
+    data_  = 0;
+    len_   = 0;
+    alloc_ = 0;
+  }
+  ~Fl_Buffered_Decoder() { free(data_); }
+
+  int feed(const uchar *buf, size_t len) {
+    if (len_ + len > alloc_) {
+      size_t size = alloc_ ? alloc_ : 4096;
+      while (size < len_ + len) size *= 2;
+      uchar *temp = (uchar *)realloc(data_, size);
+      if (!temp) return -1;
+      data_  = temp;
+      alloc_ = size;
+    }
+    memcpy(data_ + len_, buf, len);
+    len_ += len;
+    return 0;
+  }
+
+  int finish() {
+    if (len_ < 8) return -1;
+
+    if (memcmp(data_, "GIF87a", 6) == 0 ||
+        memcmp(data_, "GIF89a", 6) == 0) {
+      Fl_GIF_Image gif(0, data_, (long)len_);
+      if (gif.fail() || gif.w() <= 0 || gif.h() <= 0) return -1;
+      Fl_RGB_Image rgb(&gif);
+      return copy_image(&rgb);
+    }
+
+    if (memcmp(data_, "BM", 2) == 0) {
+      Fl_BMP_Image bmp(0, data_, (long)len_);
+      return copy_image(&bmp);
+    }
+
+#if defined(HAVE_LIBPNG) && defined(HAVE_LIBZ)
+    if (memcmp(data_, "\211PNG", 4) == 0) {
+      Fl_PNG_Image png(0, data_, (int)len_);
+      return copy_image(&png);
+    }
+#endif // HAVE_LIBPNG && HAVE_LIBZ
+
+    return -1;
+  }
+};
+
+
+//
+// Decoder of uncompressed BMP images that reports the rows as they arrive;
+// other BMP images are passed to a buffered decoder...
+//
+
+class Fl_BMP_Decoder : public Fl_Progressive_Decoder {
+  enum { HEADER, INFO, PALETTE, SKIP, ROWS, DONE };
+
+  Fl_Buffered_Decoder *buffered_;	// Decoder of the other BMP images, or NULL
+  uchar *data_;		// Headers, then the current row
+  size_t len_, alloc_;	// Bytes in data_ and its allocated size
+  size_t need_;		// Bytes needed for the next step
+  int state_;		// Next step of decoding
+  int info_size_;	// Size of the info header
+  int depth_;		// Bits per pixel
+  int colors_;		// Entries in the colormap
+  int y_, dy_;		// Next row and direction
+  int count_;		// Rows decoded
+  uchar colormap_[256][3];
+
+  static unsigned word(const uchar *p) { return p[0] | (p[1] << 8); }
+  static unsigned dword(const uchar *p) { return word(p) | (word(p + 2) << 16); }
+
+  // Passes all data to a buffered decoder from now on
+  int fallback() {
+    buffered_ = new Fl_Buffered_Decoder(img_);
+    state_ = DONE;
+    return buffered_->feed(data_, len_);
+  }
+
+  // Decodes the row in data_
+  void row() {
+    int w = img_->w(), d = img_->d();
+    uchar *dst = array() + y_ * w * d;
+    const uchar *src = data_;
+    for (int x = 0; x < w; x ++, dst += d) {
+      if (depth_ >= 24) {
+        dst[0] = src[2];
+        dst[1] = src[1];
+        dst[2] = src[0];
+        if (d == 4) dst[3] = src[3];
+        src += depth_ / 8;
+      } else {
+        int shift = 8 - depth_ - (x * depth_) % 8;
+        int i = (src[x * depth_ / 8] >> shift) & ((1 << depth_) - 1);
+        if (i >= colors_) i = 0;
+        dst[0] = colormap_[i][2];
+        dst[1] = colormap_[i][1];
+        dst[2] = colormap_[i][0];
+      }
+    }
+    rows(y_, y_ + 1);
+  }
+
+  // Processes the need_ bytes in data_, returns -1 on error
+  int step() {
+    switch (state_) {
+      case HEADER :
+        info_size_ = (int)dword(data_ + 14);
+        if (info_size_ < 40 || info_size_ > 1024) return fallback(); // OS/2 header
+        need_  = 14 + info_size_;
+        state_ = INFO;
+        return 0;
+
+      case INFO : {
+        int w = (int)dword(data_ + 18), h = (int)dword(data_ + 22);
+        int compression = (int)dword(data_ + 30);
+        depth_  = (int)word(data_ + 28);
+        colors_ = (int)dword(data_ + 46);
+        if (compression || (depth_ != 1 && depth_ != 4 && depth_ != 8 &&
+                            depth_ != 24 && depth_ != 32))
+          return fallback(); // RLE, bit fields and 16-bit images
+        if (depth_ >= 8 && w > 32 / depth_) {
+          // Icons have a 1-bit mask after the image, see Fl_BMP_Image
+          size_t bpp = depth_ / 8, rows = (size_t)(h < 0 ? -h : h);
+          size_t mask = ((w * bpp + 3) & ~3) * rows + ((((w + 7) / 8) + 3) & ~3) * rows;
+          if (mask == 2 * (size_t)dword(data_ + 34)) return fallback();
+        }
+        if (colors_ == 0 && depth_ <= 8) colors_ = 1 << depth_;
+        if (colors_ < 0 || colors_ > 256) return -1;
+        if (size(w, h < 0 ? -h : h, depth_ == 32 ? 4 : 3) < 0) return -1;
+        y_     = h < 0 ? 0 : h - 1;	// Rows are bottom-up unless h < 0
+        dy_    = h < 0 ? 1 : -1;
+        need_  = 14 + info_size_ + 4 * colors_;
+        state_ = PALETTE;
+        return 0;
+      }
+
+      case PALETTE : {
+        const uchar *p = data_ + 14 + info_size_;
+        for (int i = 0; i < colors_; i ++, p += 4) {
+          colormap_[i][0] = p[0];
+          colormap_[i][1] = p[1];
+          colormap_[i][2] = p[2];
+        }
+        size_t offbits = dword(data_ + 10);
+        if (offbits && offbits < need_) return -1;
+        need_  = offbits ? offbits - need_ : 0;
+        len_   = 0;
+        state_ = SKIP;
+        return 0;
+      }
+
+      case SKIP : {
+        size_t stride = (((size_t)img_->w() * depth_ + 31) / 32) * 4;
+        if (stride > alloc_) {
+          uchar *temp = (uchar *)realloc(data_, stride);
+          if (!temp) return -1;
+          data_  = temp;
+          alloc_ = stride;
+        }
+        need_  = stride;
+        len_   = 0;
+        state_ = ROWS;
+        return 0;
+      }
+
+      case ROWS :
+        row();
+        y_  += dy_;
+        len_ = 0;
+        if (++ count_ == img_->h()) state_ = DONE;
+        return 0;
+    }
+    return 0;
+  }
+
+public:
+  Fl_BMP_Decoder(Fl_Progressive_Image *img) : Fl_Progressive_Decoder(img) {
+    buffered_ = 0;
+    data_     = 0;
+    len_      = 0;
+    alloc_    = 0;
+    need_     = 18;
+    state_    = HEADER;
+    count_    = 0;
+  }
+  ~Fl_BMP_Decoder() {
+    delete buffered_;
+    free(data_);
+  }
+
+  int feed(const uchar *buf, size_t len) {
+    for (;;) {
+      if (buffered_) return len ? buffered_->feed(buf, len) : 0;
+      if (state_ == DONE) return 0;	// Ignore data after the last row
+
+      size_t n = need_ - len_;
+      if (n > len) n = len;
+      if (state_ != SKIP) {
+        if (need_ > alloc_) {
+          uchar *temp = (uchar *)realloc(data_, need_);
+          if (!temp) return -1;
+          data_  = temp;
+          alloc_ = need_;
+        }
+        memcpy(data_ + len_, buf, n);
+      }
+      len_ += n;
+      buf  += n;
+      len  -= n;
+
+      if (len_ < need_) return 0;
+      if (step() < 0) return -1;
+    }
+  }
+
+  int finish() {
+    if (buffered_) return buffered_->finish();
+    return state_ == DONE ? 0 : -1;
+  }
+};
+
+
+//
+// PNG decoder using the progressive reader of libpng...
+//
+
+#ifdef FL_PROGRESSIVE_PNG
+class Fl_PNG_Decoder : public Fl_Progressive_Decoder {
+  png_structp pp_;
+  png_infop info_;
+  int w_, d_;		// Size of the image
+  int complete_;	// All rows decoded
+
+  static void info_cb(png_structp pp, png_infop info) {
+    Fl_PNG_Decoder *dec = (Fl_PNG_Decoder *)png_get_progressive_ptr(pp);
+    int channels;
+
+    if (png_get_color_type(pp, info) == PNG_COLOR_TYPE_PALETTE)
+      png_set_expand(pp);
+
+    if (png_get_color_type(pp, info) & PNG_COLOR_MASK_COLOR)
+      channels = 3;
+    else
+      channels = 1;
+
+    int num_trans = 0;
+    png_get_tRNS(pp, info, 0, &num_trans, 0);
+    if ((png_get_color_type(pp, info) & PNG_COLOR_MASK_ALPHA) || (num_trans != 0))
+      channels ++;
+
+    if (png_get_bit_depth(pp, info) < 8)
+    {
+      png_set_packing(pp);
+      png_set_expand(pp);
+    }
+    else if (png_get_bit_depth(pp, info) == 16)
+      png_set_strip_16(pp);
+
+#  if defined(HAVE_PNG_GET_VALID) && defined(HAVE_PNG_SET_TRNS_TO_ALPHA)
+    // Handle transparency...
+    if (png_get_valid(pp, info, PNG_INFO_tRNS))
+      png_set_tRNS_to_alpha(pp);
+#  endif // HAVE_PNG_GET_VALID && HAVE_PNG_SET_TRNS_TO_ALPHA
+
+    png_set_interlace_handling(pp);
+    png_read_update_info(pp, info);
+
+    dec->w_ = (int)png_get_image_width(pp, info);
+    dec->d_ = channels;
+    if (dec->size(dec->w_, (int)png_get_image_height(pp, info), channels) < 0)
+      png_error(pp, "image too large");
+  }
+
+  static void row_cb(png_structp pp, png_bytep row, png_uint_32 y, int) {
+    Fl_PNG_Decoder *dec = (Fl_PNG_Decoder *)png_get_progressive_ptr(pp);
+
+    if (!row) return;	// Row not changed by this pass of an interlaced image
+
+    uchar *dst = dec->array() + y * dec->w_ * dec->d_;
+    png_progressive_combine_row(pp, dst, row);
+    if (dec->d_ == 4) Fl::system_driver()->png_extra_rgba_processing(dst, dec->w_, 1);
+    dec->rows((int)y, (int)y + 1);
+  }
+
+  static void end_cb(png_structp pp, png_infop) {
+    Fl_PNG_Decoder *dec = (Fl_PNG_Decoder *)png_get_progressive_ptr(pp);
+    dec->complete_ = 1;
+  }
+
+public:
+  Fl_PNG_Decoder(Fl_Progressive_Image *img) : Fl_Progressive_Decoder(img) {
+    w_        = 0;
+    d_        = 0;
+    complete_ = 0;
+    info_     = 0;
+    pp_       = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    if (pp_) info_ = png_create_info_struct(pp_);
+    if (info_) png_set_progressive_read_fn(pp_, this, info_cb, row_cb, end_cb);
+  }
+  ~Fl_PNG_Decoder() {
+    if (pp_) png_destroy_read_struct(&pp_, info_ ? &info_ : NULL, NULL);
+  }
+
+  int feed(const uchar *buf, size_t len) {
+    if (!info_) return -1;
+    if (setjmp(png_jmpbuf(pp_))) return -1;
+    png_process_data(pp_, info_, (png_bytep)buf, len);
+    return 0;
+  }
+
+  int finish() { return complete_ ? 0 : -1; }
+};
+#endif // FL_PROGRESSIVE_PNG
+
+
+//
+// JPEG decoder using a suspending data source...
+//
+
+#ifdef HAVE_LIBJPEG
+struct fl_progressive_jpeg_error_mgr {
+  jpeg_error_mgr	pub_;		// Destination manager...
+  jmp_buf		errhand_;	// Error handler
+};
+
+extern "C" {
+  static void fl_progressive_jpeg_error_handler(j_common_ptr dinfo) {
+    longjmp(((fl_progressive_jpeg_error_mgr *)(dinfo->err))->errhand_, 1);
+  }
+
+  static void fl_progressive_jpeg_output_handler(j_common_ptr) {
+  }
+}
+
+class Fl_JPEG_Decoder : public Fl_Progressive_Decoder {
+  enum { HEADER, START, SCAN, FINISH, DONE };
+
+  jpeg_decompress_struct dinfo_;
+  fl_progressive_jpeg_error_mgr jerr_;
+  jpeg_source_mgr src_;
+  uchar *data_;		// Data not read by libjpeg yet
+  size_t alloc_;	// Allocated size of data_
+  size_t skip_;		// Bytes to skip before the next data
+  int eof_;		// finish() was called
+  int state_;		// Next step of decoding
+
+  static void init_source(j_decompress_ptr) {}
+  static void term_source(j_decompress_ptr) {}
+
+  static boolean fill_input_buffer(j_decompress_ptr cinfo) {
+    static const JOCTET eoi[2] = { 0xff, JPEG_EOI };
+    Fl_JPEG_Decoder *dec = (Fl_JPEG_Decoder *)cinfo->client_data;
+
+    if (!dec->eof_) return FALSE;	// Suspend until more data is fed
+
+    // No more data, end the image where it was cut...
+    cinfo->src->next_input_byte = eoi;
+    cinfo->src->bytes_in_buffer = 2;
+    return TRUE;
+  }
+
+  static void skip_input_data(j_decompress_ptr cinfo, long num_bytes) {
+    Fl_JPEG_Decoder *dec = (Fl_JPEG_Decoder *)cinfo->client_data;
+    jpeg_source_mgr *src = cinfo->src;
+
+    if (num_bytes <= 0) return;
+    if ((size_t)num_bytes <= src->bytes_in_buffer) {
+      src->next_input_byte += num_bytes;
+      src->bytes_in_buffer -= num_bytes;
+    } else {
+      dec->skip_ += num_bytes - src->bytes_in_buffer;
+      src->next_input_byte += src->bytes_in_buffer;
+      src->bytes_in_buffer = 0;
+    }
+  }
+
+  // Runs the decoder until it needs more data, returns -1 on error
+  int decode() {
+    if (setjmp(jerr_.errhand_)) return -1;
+
+    if (state_ == HEADER) {
+      if (jpeg_read_header(&dinfo_, TRUE) == JPEG_SUSPENDED) return 0;
+
+      dinfo_.quantize_colors      = (boolean)FALSE;
+      dinfo_.out_color_space      = JCS_RGB;
+      dinfo_.out_color_components = 3;
+      dinfo_.output_components    = 3;
+
+      jpeg_calc_output_dimensions(&dinfo_);
+      if (size(dinfo_.output_width, dinfo_.output_height,
+               dinfo_.output_components) < 0) return -1;
+      state_ = START;
+    }
+
+    if (state_ == START) {
+      if (!jpeg_start_decompress(&dinfo_)) return 0;
+      state_ = SCAN;
+    }
+
+    if (state_ == SCAN) {
+      int stride = dinfo_.output_width * dinfo_.output_components;
+      while (dinfo_.output_scanline < dinfo_.output_height) {
+        int y = dinfo_.output_scanline;
+        JSAMPROW row = (JSAMPROW)(array() + y * stride);
+        if (jpeg_read_scanlines(&dinfo_, &row, (JDIMENSION)1) != 1) return 0;
+        rows(y, y + 1);
+      }
+      state_ = FINISH;
+    }
+
+    if (state_ == FINISH) {
+      if (!jpeg_finish_decompress(&dinfo_)) return 0;
+      state_ = DONE;
+    }
+
+    return 0;
+  }
+
+public:
+  Fl_JPEG_Decoder(Fl_Progressive_Image *img) : Fl_Progressive_Decoder(img) {
+    data_  = 0;
+    alloc_ = 0;
+    skip_  = 0;
+    eof_   = 0;
+    state_ = HEADER;
+
+    dinfo_.err                = jpeg_std_error((jpeg_error_mgr *)&jerr_);
+    jerr_.pub_.error_exit     = fl_progressive_jpeg_error_handler;
+    jerr_.pub_.output_message = fl_progressive_jpeg_output_handler;
+    jpeg_create_decompress(&dinfo_);
+    dinfo_.client_data = this;
+
+    src_.init_source       = init_source;
+    src_.fill_input_buffer = fill_input_buffer;
+    src_.skip_input_data   = skip_input_data;
+    src_.resync_to_restart = jpeg_resync_to_restart;
+    src_.term_source       = term_source;
+    src_.bytes_in_buffer   = 0;
+    src_.next_input_byte   = NULL;
+    dinfo_.src = &src_;
+  }
+  ~Fl_JPEG_Decoder() {
+    jpeg_destroy_decompress(&dinfo_);
+    free(data_);
+  }
+
+  int feed(const uchar *buf, size_t len) {
+    if (skip_ >= len) {
+      skip_ -= len;
+      return 0;
+    }
+    buf += skip_;
+    len -= skip_;
+    skip_ = 0;
+
+    // Move the data not read yet to the start of the buffer and append
+    // the new data...
+    size_t left = src_.bytes_in_buffer;
+    if (left + len > alloc_) {
+      size_t size = alloc_ ? alloc_ : 4096;
+      while (size < left + len) size *= 2;
+      uchar *temp = (uchar *)malloc(size);
+      if (!temp) return -1;
+      if (left) memcpy(temp, src_.next_input_byte, left);
+      free(data_);
+      data_  = temp;
+      alloc_ = size;
+    } else if (left) {
+      memmove(data_, src_.next_input_byte, left);
+    }
+    memcpy(data_ + left, buf, len);
+    src_.next_input_byte = data_;
+    src_.bytes_in_buffer = left + len;
+
+    return decode();
+  }
+
+  int finish() {
+    eof_ = 1;
+    if (decode() < 0) return -1;
+    return state_ == DONE ? 0 : -1;
+  }
+};
+#endif // HAVE_LIBJPEG
+
+
+/**
+ \brief The constructor creates an empty image that is decoded with feed()
+ and finish().
+
+ \param[in] cb function called when rows have been decoded, or NULL
+ \param[in] data argument of \p cb
+
+ \see Fl_Progressive_Image::callback()
+ */
+Fl_Progressive_Image::Fl_Progressive_Image(Fl_Progressive_Image_Cb cb, void *data)
+: Fl_RGB_Image(0,0,0)
+{
+  decoder_   = 0;
+  head_len_  = 0;
+  done_      = 0;
+  y0_        = -1;
+  y1_        = 0;
+  callback_  = cb;
+  user_data_ = data;
+}
+
+
+/**
+ The destructor frees all memory and server resources that are used by
+ the image, also if it was not completely decoded.
+ */
+Fl_Progressive_Image::~Fl_Progressive_Image() {
+  delete decoder_;
+}
+
+
+//
+// Chooses the decoder from the first bytes of the data...
+//
+
+int Fl_Progressive_Image::start_() {
+  const uchar *header = head_;
+
+  if (head_len_ < 4) return -1;
+
+#ifdef FL_PROGRESSIVE_PNG
+  if (head_len_ >= 8 && memcmp(header, "\211PNG", 4) == 0)
+    decoder_ = new Fl_PNG_Decoder(this);
+  else
+#endif // FL_PROGRESSIVE_PNG
+#ifdef HAVE_LIBJPEG
+  if (memcmp(header, "\377\330\377", 3) == 0)
+    decoder_ = new Fl_JPEG_Decoder(this);
+  else
+#endif // HAVE_LIBJPEG
+  if (memcmp(header, "BM", 2) == 0)
+    decoder_ = new Fl_BMP_Decoder(this);
+  else
+  if (memcmp(header, "GIF8", 4) == 0 ||
+      memcmp(header, "\211PNG", 4) == 0)
+    decoder_ = new Fl_Buffered_Decoder(this);
+  else
+    return -1;
+
+  return decoder_->feed(head_, head_len_);
+}
+
+
+//
+// Allocates the image data when the size is known...
+//
+
+int Fl_Progressive_Image::size_(int W, int H, int D) {
+  if (W <= 0 || H <= 0 || array || ((size_t)W) * H * D > max_size()) return -1;
+
+  w(W);
+  h(H);
+  d(D);
+  array = new uchar[W * H * D];
+  alloc_array = 1;
+  memset((uchar *)array, 0, W * H * D);
+  return 0;
+}
+
+
+//
+// Adds rows to the range of rows decoded in this call...
+//
+
+void Fl_Progressive_Image::rows_(int y0, int y1) {
+  if (y0_ < 0 || y0 < y0_) y0_ = y0;
+  if (y1 > y1_) y1_ = y1;
+}
+
+
+//
+// Reports the rows decoded in this call...
+//
+
+void Fl_Progressive_Image::report_() {
+  if (y0_ < 0) return;
+
+  int y0 = y0_, y1 = y1_;
+  y0_ = -1;
+  y1_ = 0;
+
+  uncache();
+  if (callback_) callback_(this, y0, y1, user_data_);
+}
+
+
+//
+// Frees the image after an error...
+//
+
+void Fl_Progressive_Image::fail_() {
+  delete decoder_;
+  decoder_ = 0;
+  done_    = 1;
+  y0_      = -1;
+  y1_      = 0;
+
+  uncache();
+  if (alloc_array) delete[] (uchar *)array;
+  array       = 0;
+  alloc_array = 0;
+
+  w(0);
+  h(0);
+  d(0);
+  ld(ERR_FORMAT);
+
+  if (callback_) callback_(this, 0, 0, user_data_);
+}
+
+
+/**
+ Decodes the next \p len bytes of the image data.
+
+ Calls the callback with the range of rows decoded, if any.
+
+ \param[in] buf the data
+ \param[in] len number of bytes in \p buf
+ \return 0 on success, -1 if the data can't be decoded or finish() was called
+ */
+int Fl_Progressive_Image::feed(const unsigned char *buf, size_t len) {
+  if (done_) return -1;
+
+  if (!decoder_) {
+    // Collect the first bytes to detect the format...
+    size_t n = sizeof(head_) - head_len_;
+    if (n > len) n = len;
+    memcpy(head_ + head_len_, buf, n);
+    head_len_ += (int)n;
+    buf       += n;
+    len       -= n;
+
+    if (head_len_ < (int)sizeof(head_)) return 0;
+
+    if (start_() < 0) {
+      fail_();
+      return -1;
+    }
+  }
+
+  if (len && decoder_->feed(buf, len) < 0) {
+    fail_();
+    return -1;
+  }
+
+  report_();
+  return 0;
+}
+
+
+/**
+ Decodes the end of the image data when no more data will be fed.
+
+ Calls the callback with the range of rows decoded, if any. A JPEG image
+ cut short is completed with gray rows, other formats must be complete.
+
+ \return 0 if the image was decoded, -1 otherwise
+ */
+int Fl_Progressive_Image::finish() {
+  if (done_) return fail() ? -1 : 0;
+
+  if ((!decoder_ && start_() < 0) || decoder_->finish() < 0) {
+    fail_();
+    return -1;
+  }
+
+  delete decoder_;
+  decoder_ = 0;
+  done_    = 1;
+
+  report_();
+  return 0;
+}
+
+
+//
+// End of "$Id$".
+//
@@ -32,6 +32,7 @@
 #include <FL/Fl_Image_Surface.H>
 #include <FL/Fl_Box.H>
 #include <FL/Fl_Tooltip.H>
+#include <stdlib.h>
 
 char Fl_Screen_Driver::bg_set = 0;
 char Fl_Screen_Driver::bg2_set = 0;
@@ -506,6 +507,99 @@ int Fl_Screen_Driver::parse_color(const char* p, uchar& r, uchar& g, uchar& b)
 
 void Fl_Screen_Driver::default_icons(const Fl_RGB_Image *icons[], int count) {}
 
+// Timeouts with an identifier, for drivers that only implement add_timeout()
+// and friends: each one is registered with its own record as data, so it can
+// be found again by its identifier and removed with remove_timeout(). The
+// records are kept in a hash table indexed by identifier.
+
+struct Id_Timeout {
+  Fl_Timeout_Id id;
+  Fl_Timeout_Handler cb;
+  void *data;
+  Id_Timeout *next;             // next record in the same bucket
+};
+static Id_Timeout **id_timeouts;
+static int id_timeout_buckets;  // always a power of two, or 0
+static int id_timeout_count;
+static Fl_Timeout_Id last_timeout_id;
+
+static Id_Timeout **find_id_timeout(Fl_Timeout_Id id) {
+  static Id_Timeout *none;
+  if (!id_timeout_buckets) return &none;
+  Id_Timeout **p = id_timeouts + (id & (id_timeout_buckets - 1));
+  while (*p && (*p)->id != id) p = &((*p)->next);
+  return p;
+}
+
+static void grow_id_timeouts() {
+  int n = id_timeout_buckets ? 2 * id_timeout_buckets : 32;
+  Id_Timeout **buckets = (Id_Timeout**)calloc(n, sizeof(Id_Timeout*));
+  for (int i = 0; i < id_timeout_buckets; i++) {
+    while (id_timeouts[i]) {
+      Id_Timeout *t = id_timeouts[i];
+      id_timeouts[i] = t->next;
+      t->next = buckets[t->id & (n - 1)];
+      buckets[t->id & (n - 1)] = t;
+    }
+  }
+  free(id_timeouts);
+  id_timeouts = buckets;
+  id_timeout_buckets = n;
+}
+
+static void id_timeout_cb(void *v) {
+  Id_Timeout *t = (Id_Timeout*)v;
+  *find_id_timeout(t->id) = t->next;
+  id_timeout_count--;
+  Fl_Timeout_Handler cb = t->cb;
+  void *data = t->data;
+  delete t;
+  cb(data);
+}
+
+static Id_Timeout *new_id_timeout(Fl_Timeout_Handler cb, void *data) {
+  if (id_timeout_count >= id_timeout_buckets) grow_id_timeouts();
+  Id_Timeout *t = new Id_Timeout;
+  // after the identifiers wrap around, skip those of pending timeouts
+  do {
+    if (!++last_timeout_id) ++last_timeout_id;
+  } while (*find_id_timeout(last_timeout_id));
+  t->id = last_timeout_id;
+  t->cb = cb;
+  t->data = data;
+  Id_Timeout **bucket = id_timeouts + (t->id & (id_timeout_buckets - 1));
+  t->next = *bucket;
+  *bucket = t;
+  id_timeout_count++;
+  return t;
+}
+
+Fl_Timeout_Id Fl_Screen_Driver::add_timeout_id(double time, Fl_Timeout_Handler cb, void *argp, double slack) {
+  Id_Timeout *t = new_id_timeout(cb, argp);
+  add_timeout(time, id_timeout_cb, t);
+  return t->id;
+}
+
+Fl_Timeout_Id Fl_Screen_Driver::repeat_timeout_id(double time, Fl_Timeout_Handler cb, void *argp, double slack) {
+  Id_Timeout *t = new_id_timeout(cb, argp);
+  repeat_timeout(time, id_timeout_cb, t);
+  return t->id;
+}
+
+int Fl_Screen_Driver::has_timeout_id(Fl_Timeout_Id id) {
+  return *find_id_timeout(id) != NULL;
+}
+
+void Fl_Screen_Driver::remove_timeout_id(Fl_Timeout_Id id) {
+  Id_Timeout **p = find_id_timeout(id);
+  Id_Timeout *t = *p;
+  if (!t) return;
+  *p = t->next;
+  id_timeout_count--;
+  remove_timeout(id_timeout_cb, t);
+  delete t;
+}
+
 /**
  \}
  \endcond
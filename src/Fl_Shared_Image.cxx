@@ -39,18 +39,38 @@ int	Fl_Shared_Image::alloc_images_ = 0;	// Allocated shared images
 Fl_Shared_Handler *Fl_Shared_Image::handlers_ = 0;// Additional format handlers
 int	Fl_Shared_Image::num_handlers_ = 0;	// Number of format handlers
 int	Fl_Shared_Image::alloc_handlers_ = 0;	// Allocated format handlers
+Fl_Shared_Scaled_Handler *Fl_Shared_Image::scaled_handlers_ = 0;// Reduced size handlers
+int	Fl_Shared_Image::num_scaled_handlers_ = 0;// Number of reduced size handlers
+int	Fl_Shared_Image::alloc_scaled_handlers_ = 0;// Allocated reduced size handlers
+
+Fl_Shared_Image **Fl_Shared_Image::hash_ = 0;	// Hash index of images_ by name
+int	Fl_Shared_Image::hash_size_ = 0;	// Number of hash chains
+Fl_Shared_Image *Fl_Shared_Image::lru_first_ = 0;// Least recently released image
+Fl_Shared_Image *Fl_Shared_Image::lru_last_ = 0;// Most recently released image
+size_t	Fl_Shared_Image::budget_ = 0;		// Bytes kept for released images
+size_t	Fl_Shared_Image::bytes_ = 0;		// Bytes of all shared images
+unsigned long Fl_Shared_Image::hits_ = 0;	// Images found by find()
+unsigned long Fl_Shared_Image::misses_ = 0;	// Images not found by find()
 
 
 //
-// Typedef the C API sort function type the only way I know how...
+// Returns the number of bytes of the data of an image...
 //
 
-extern "C" {
-  typedef int (*compare_func_t)(const void *, const void *);
+static size_t image_size(Fl_Image *img) {
+  if (!img) return 0;
+
+  size_t W = img->data_w(), H = img->data_h();
+
+  if (img->d()) return W * H * img->d();		// RGB image
+  else if (img->count() == 1) return (W + 7) / 8 * H;	// Bitmap
+  else return W * H * 4;				// Pixmap, drawn as RGBA
 }
 
 
-/** Returns the Fl_Shared_Image* array */
+/** Returns the Fl_Shared_Image* array.
+  The images are not sorted.
+*/
 Fl_Shared_Image **Fl_Shared_Image::images() {
   return images_;
 }
@@ -78,9 +98,8 @@ int Fl_Shared_Image::num_images() {
   An image is marked \p original if it was directly loaded from a file or
   from memory as opposed to copied and resized images.
 
-  This comparison is used in Fl_Shared_Image::find() to find an image that
-  matches the requested one or to find the position where a new image
-  should be entered into the sorted list of shared images.
+  Fl_Shared_Image::find() finds an image that matches the requested one
+  the same way, in the hash chain of its name.
 
   It is usually used in two steps:
 
@@ -110,6 +129,76 @@ Fl_Shared_Image::compare(Fl_Shared_Image **i0,		// I - First image
 }
 
 
+//
+// 'Fl_Shared_Image::hash()' - Hash an image name...
+//
+
+unsigned
+Fl_Shared_Image::hash(const char *name) {
+  unsigned h = 2166136261U;		// FNV-1a
+
+  while (*name) h = (h ^ (uchar)*name++) * 16777619U;
+
+  return h;
+}
+
+
+//
+// 'Fl_Shared_Image::rehash()' - Rebuild the hash index with new size...
+//
+
+void
+Fl_Shared_Image::rehash(int size) {
+  delete[] hash_;
+
+  hash_      = new Fl_Shared_Image *[size];
+  hash_size_ = size;
+  memset(hash_, 0, size * sizeof(Fl_Shared_Image *));
+
+  for (int i = 0; i < num_images_; i ++) {
+    Fl_Shared_Image **chain = hash_ + (hash(images_[i]->name_) & (size - 1));
+
+    images_[i]->hash_next_ = *chain;
+    *chain                 = images_[i];
+  }
+}
+
+
+//
+// 'Fl_Shared_Image::trim()' - Delete released images over the budget...
+//
+
+void
+Fl_Shared_Image::trim() {
+  while (bytes_ > budget_ && lru_first_) {
+    Fl_Shared_Image *img = lru_first_;
+
+    img->remove();
+    delete img;
+  }
+}
+
+
+/**
+  Sets the number of bytes that images may use after their last release().
+
+  By default, an image is deleted when it is released as many times as
+  it was found, so that loading it again with get() reads its file again.
+  With a budget, the images are only deleted when the data of all shared
+  images, as returned by cache_bytes(), exceeds \p bytes, from the least
+  recently released one. Images that are still used are never deleted.
+
+  \param[in] bytes	the budget, 0 to delete images when they are released
+
+  \see cache_bytes(), cache_hits(), cache_misses()
+  \since FLTK 1.4.0
+*/
+void Fl_Shared_Image::cache_budget(size_t bytes) {
+  budget_ = bytes;
+  trim();
+}
+
+
 /**
   Creates an empty shared image.
   The constructors create a new shared image record in the image cache.
@@ -123,6 +212,12 @@ Fl_Shared_Image::Fl_Shared_Image() : Fl_Image(0,0,0) {
   original_    = 0;
   image_       = 0;
   alloc_image_ = 0;
+  index_       = -1;
+  hash_next_   = 0;
+  lru_prev_    = 0;
+  lru_next_    = 0;
+  size_        = 0;
+  loading_     = 0;
 }
 
 
@@ -143,6 +238,12 @@ Fl_Shared_Image::Fl_Shared_Image(const char *n,		// I - Filename
   image_       = img;
   alloc_image_ = !img;
   original_    = 1;
+  index_       = -1;
+  hash_next_   = 0;
+  lru_prev_    = 0;
+  lru_next_    = 0;
+  size_        = 0;
+  loading_     = 0;
 
   if (!img) reload();
   else update();
@@ -152,9 +253,9 @@ Fl_Shared_Image::Fl_Shared_Image(const char *n,		// I - Filename
 /**
   Adds a shared image to the image cache.
 
-  This \b protected method adds an image to the cache, an ordered list
-  of shared images. The cache is searched for a matching image whenever
-  one is requested, for instance with Fl_Shared_Image::get() or
+  This \b protected method adds an image to the cache, a list of shared
+  images indexed by name. The cache is searched for a matching image
+  whenever one is requested, for instance with Fl_Shared_Image::get() or
   Fl_Shared_Image::find().
 */
 void
@@ -163,7 +264,9 @@ Fl_Shared_Image::add() {
 
   if (num_images_ >= alloc_images_) {
     // Allocate more memory...
-    temp = new Fl_Shared_Image *[alloc_images_ + 32];
+    int alloc = alloc_images_ ? 2 * alloc_images_ : 32;
+
+    temp = new Fl_Shared_Image *[alloc];
 
     if (alloc_images_) {
       memcpy(temp, images_, alloc_images_ * sizeof(Fl_Shared_Image *));
@@ -172,15 +275,68 @@ Fl_Shared_Image::add() {
     }
 
     images_       = temp;
-    alloc_images_ += 32;
+    alloc_images_ = alloc;
   }
 
+  index_               = num_images_;
   images_[num_images_] = this;
   num_images_ ++;
 
-  if (num_images_ > 1) {
-    qsort(images_, num_images_, sizeof(Fl_Shared_Image *),
-          (compare_func_t)compare);
+  if (num_images_ > hash_size_) {
+    rehash(2 * alloc_images_);
+  } else {
+    Fl_Shared_Image **chain = hash_ + (hash(name_) & (hash_size_ - 1));
+
+    hash_next_ = *chain;
+    *chain     = this;
+  }
+
+  size_  = image_size(image_);
+  bytes_ += size_;
+  trim();
+}
+
+
+//
+// 'Fl_Shared_Image::remove()' - Remove a shared image from the cache...
+//
+
+void
+Fl_Shared_Image::remove() {
+  if (index_ < 0) return;
+
+  // Unlink it from the released images...
+  if (lru_prev_) lru_prev_->lru_next_ = lru_next_;
+  else if (lru_first_ == this) lru_first_ = lru_next_;
+  if (lru_next_) lru_next_->lru_prev_ = lru_prev_;
+  else if (lru_last_ == this) lru_last_ = lru_prev_;
+  lru_prev_ = lru_next_ = 0;
+
+  // ... from its hash chain...
+  Fl_Shared_Image **chain = hash_ + (hash(name_) & (hash_size_ - 1));
+
+  while (*chain != this) chain = &(*chain)->hash_next_;
+  *chain = hash_next_;
+
+  // ... and move the last image into its place in the array
+  num_images_ --;
+  if (index_ < num_images_) {
+    images_[index_]         = images_[num_images_];
+    images_[index_]->index_ = index_;
+  }
+
+  index_ = -1;
+  bytes_ -= size_;
+  size_  = 0;
+
+  if (num_images_ == 0 && images_) {
+    delete[] images_;
+    delete[] hash_;
+
+    images_       = 0;
+    alloc_images_ = 0;
+    hash_         = 0;
+    hash_size_    = 0;
   }
 }
 
@@ -197,6 +353,12 @@ Fl_Shared_Image::update() {
     d(image_->d());
     data(image_->data(), image_->count());
   }
+
+  if (index_ >= 0) {
+    bytes_ -= size_;
+    size_  = image_size(image_);
+    bytes_ += size_;
+  }
 }
 
 /**
@@ -216,34 +378,28 @@ Fl_Shared_Image::~Fl_Shared_Image() {
   Releases and possibly destroys (if refcount <= 0) a shared image.
 
   In the latter case, it will reorganize the shared image array
-  so that no hole will occur.
+  so that no hole will occur. If cache_budget(size_t) allows it, the
+  image is kept in the cache instead, until find() or get() use it again
+  or the budget is exceeded.
 */
 void Fl_Shared_Image::release() {
-  int	i;	// Looping var...
-
   refcount_ --;
   if (refcount_ > 0) return;
 
-  for (i = 0; i < num_images_; i ++)
-    if (images_[i] == this) {
-      num_images_ --;
+  if (index_ >= 0 && budget_) {
+    // Keep it as the most recently released image...
+    lru_prev_ = lru_last_;
+    lru_next_ = 0;
+    if (lru_last_) lru_last_->lru_next_ = this;
+    else lru_first_ = this;
+    lru_last_ = this;
 
-      if (i < num_images_) {
-        memmove(images_ + i, images_ + i + 1,
-               (num_images_ - i) * sizeof(Fl_Shared_Image *));
-      }
-
-      break;
-    }
+    trim();
+    return;
+  }
 
+  remove();
   delete this;
-
-  if (num_images_ == 0 && images_) {
-    delete[] images_;
-
-    images_       = 0;
-    alloc_images_ = 0;
-  }
 }
 
 
@@ -265,7 +421,13 @@ void Fl_Shared_Image::reload() {
   }
 
   // Load the image as appropriate...
-  if (memcmp(header, "#define", 7) == 0) // XBM file
+  img = 0;
+  if (!original_ && w() && h()) // Resized copy, decode no more than needed
+    img = scaled_image(name_, w(), h());
+
+  if (img) {
+    // Loaded at a reduced size...
+  } else if (memcmp(header, "#define", 7) == 0) // XBM file
     img = new Fl_XBM_Image(name_);
   else if (memcmp(header, "/* XPM */", 9) == 0) // XPM file
     img = new Fl_XPM_Image(name_);
@@ -297,6 +459,44 @@ void Fl_Shared_Image::reload() {
 }
 
 
+//
+// 'Fl_Shared_Image::scaled_image()' - Load an image at a reduced size.
+//
+// Asks the reduced size handlers to decode the image with at least W x H
+// pixels, but no more than needed. Returns 0 if no handler supports the
+// file. The image returned may be larger than W x H.
+//
+
+Fl_Image *Fl_Shared_Image::scaled_image(const char *name, int W, int H) {
+  int		i;		// Looping var
+  FILE		*fp;		// File pointer
+  uchar		header[64];	// Buffer for auto-detecting files
+  Fl_Image	*img;		// New image
+
+  if (!num_scaled_handlers_) return 0;
+
+  if ((fp = fl_fopen(name, "rb")) != NULL) {
+    if (fread(header, 1, sizeof(header), fp)==0) { /* ignore */ }
+    fclose(fp);
+  } else {
+    return 0;
+  }
+
+  for (i = 0, img = 0; i < num_scaled_handlers_; i ++) {
+    img = (scaled_handlers_[i])(name, header, sizeof(header), W, H);
+
+    if (img) break;
+  }
+
+  if (img && !img->w()) {
+    delete img;
+    img = 0;
+  }
+
+  return img;
+}
+
+
 //
 // 'Fl_Shared_Image::copy()' - Copy and resize a shared image...
 //
@@ -385,7 +585,7 @@ void Fl_Shared_Image::uncache()
 
 /** Finds a shared image from its name and size specifications.
 
-  This uses a binary search in the image cache.
+  This uses a hash index of the image cache by name.
 
   If the image \p name exists with the exact width \p W and height \p H,
   then it is returned.
@@ -398,28 +598,32 @@ void Fl_Shared_Image::uncache()
   when no longer needed.
 */
 Fl_Shared_Image* Fl_Shared_Image::find(const char *name, int W, int H) {
-  Fl_Shared_Image	*key,		// Image key
-			**match;	// Matching image
+  Fl_Shared_Image	*match;		// Matching image
 
   if (num_images_) {
-    key = new Fl_Shared_Image();
-    key->name_ = new char[strlen(name) + 1];
-    strcpy((char *)key->name_, name);
-    key->w(W);
-    key->h(H);
-
-    match = (Fl_Shared_Image **)bsearch(&key, images_, num_images_,
-                                        sizeof(Fl_Shared_Image *),
-                                        (compare_func_t)compare);
-
-    delete key;
+    for (match = hash_[hash(name) & (hash_size_ - 1)]; match;
+         match = match->hash_next_) {
+      if (strcmp(match->name_, name)) continue;
+      if ((W == 0 && match->original_) ||
+          (match->w() == W && match->h() == H)) break;
+    }
 
     if (match) {
-      (*match)->refcount_ ++;
-      return *match;
+      if (match->refcount_ ++ == 0) {
+        // Use a released image again...
+        if (match->lru_prev_) match->lru_prev_->lru_next_ = match->lru_next_;
+        else lru_first_ = match->lru_next_;
+        if (match->lru_next_) match->lru_next_->lru_prev_ = match->lru_prev_;
+        else lru_last_ = match->lru_prev_;
+        match->lru_prev_ = match->lru_next_ = 0;
+      }
+
+      hits_ ++;
+      return match;
     }
   }
 
+  misses_ ++;
   return 0;
 }
 
@@ -445,6 +649,10 @@ Fl_Shared_Image* Fl_Shared_Image::find(const char *name, int W, int H) {
 	This is intentional so the original image is cached and preserved.
 	If you request the same image with another size later, then the
 	\b original image will be found, copied, resized, and returned.
+	Images that can be decoded at a reduced size, such as JPEG images
+	when fl_register_images() was called, are an exception: if the
+	original image is not in the cache, only the resized image is
+	decoded and cached.
 
   Shared JPEG and PNG images can also be created from memory by using their
   named memory access constructor.
@@ -455,6 +663,7 @@ Fl_Shared_Image* Fl_Shared_Image::find(const char *name, int W, int H) {
   \param W, H desired size
 
   \see Fl_Shared_Image::find(const char *name, int W, int H)
+  \see Fl_Shared_Image::get_async()
   \see Fl_Shared_Image::release()
   \see Fl_JPEG_Image::Fl_JPEG_Image(const char *name, const unsigned char *data)
   \see Fl_PNG_Image::Fl_PNG_Image (const char *name_png, const unsigned char *buffer, int maxsize)
@@ -465,6 +674,27 @@ Fl_Shared_Image* Fl_Shared_Image::get(const char *name, int W, int H) {
   if ((temp = find(name, W, H)) != NULL) return temp;
 
   if ((temp = find(name)) == NULL) {
+    Fl_Image *img;
+
+    if (W && H && (img = scaled_image(name, W, H)) != NULL) {
+      // Decoded at a reduced size, don't keep the original...
+      temp = new Fl_Shared_Image();
+      temp->name_ = new char[strlen(name) + 1];
+      strcpy((char *)temp->name_, name);
+      temp->alloc_image_ = 1;
+
+      if (img->w() != W || img->h() != H) {
+        temp->image_ = img->copy(W, H);
+        delete img;
+      } else {
+        temp->image_ = img;
+      }
+
+      temp->update();
+      temp->add();
+      return temp;
+    }
+
     temp = new Fl_Shared_Image(name);
 
     if (!temp->image_) {
@@ -476,6 +706,12 @@ Fl_Shared_Image* Fl_Shared_Image::get(const char *name, int W, int H) {
   }
 
   if ((temp->w() != W || temp->h() != H) && W && H) {
+    if (temp->loading_) {
+      // Can't copy the image yet, load the copy too...
+      temp->release();
+      return get_async(name, W, H);
+    }
+
     temp = (Fl_Shared_Image *)temp->copy(W, H);
     temp->add();
   }
@@ -531,6 +767,45 @@ void Fl_Shared_Image::add_handler(Fl_Shared_Handler f) {
 }
 
 
+/** Adds a shared image handler for formats that can be decoded at a
+    reduced size, such as JPEG.
+
+    get() and reload() call it with the size of the resized image
+    requested, so that large images need not be decoded at full size
+    just to be reduced with copy(). The handler returns 0 if it doesn't
+    support the file, or an image at least as large as the given size
+    if the format allows.
+    \since FLTK 1.4.0
+*/
+void Fl_Shared_Image::add_handler(Fl_Shared_Scaled_Handler f) {
+  int			i;		// Looping var...
+  Fl_Shared_Scaled_Handler *temp;	// New image handler array...
+
+  // First see if we have already added the handler...
+  for (i = 0; i < num_scaled_handlers_; i ++) {
+    if (scaled_handlers_[i] == f) return;
+  }
+
+  if (num_scaled_handlers_ >= alloc_scaled_handlers_) {
+    // Allocate more memory...
+    temp = new Fl_Shared_Scaled_Handler [alloc_scaled_handlers_ + 8];
+
+    if (alloc_scaled_handlers_) {
+      memcpy(temp, scaled_handlers_,
+             alloc_scaled_handlers_ * sizeof(Fl_Shared_Scaled_Handler));
+
+      delete[] scaled_handlers_;
+    }
+
+    scaled_handlers_       = temp;
+    alloc_scaled_handlers_ += 8;
+  }
+
+  scaled_handlers_[num_scaled_handlers_] = f;
+  num_scaled_handlers_ ++;
+}
+
+
 /** Removes a shared image handler. */
 void Fl_Shared_Image::remove_handler(Fl_Shared_Handler f) {
   int	i;				// Looping var...
@@ -553,6 +828,31 @@ void Fl_Shared_Image::remove_handler(Fl_Shared_Handler f) {
 }
 
 
+/** Removes a shared image handler for formats that can be decoded at a
+    reduced size.
+    \since FLTK 1.4.0
+*/
+void Fl_Shared_Image::remove_handler(Fl_Shared_Scaled_Handler f) {
+  int	i;				// Looping var...
+
+  // First see if the handler has been added...
+  for (i = 0; i < num_scaled_handlers_; i ++) {
+    if (scaled_handlers_[i] == f) break;
+  }
+
+  if (i >= num_scaled_handlers_) return;
+
+  // OK, remove the handler from the array...
+  num_scaled_handlers_ --;
+
+  if (i < num_scaled_handlers_) {
+    // Shift later handlers down 1...
+    memmove(scaled_handlers_ + i, scaled_handlers_ + i + 1,
+           (num_scaled_handlers_ - i) * sizeof(Fl_Shared_Scaled_Handler));
+  }
+}
+
+
 //
 // End of "$Id$".
 //
@@ -0,0 +1,471 @@
+//
+// "$Id$"
+//
+// Asynchronous loading of shared images for the Fast Light Tool Kit (FLTK).
+//
+// Copyright 1998-2018 by Bill Spitzak and others.
+//
+// This library is free software. Distribution and use rights are outlined in
+// the file "COPYING" which should have been included with this file.  If this
+// file is missing or damaged, see the license at:
+//
+//     http://www.fltk.org/COPYING.php
+//
+// Please report all bugs and problems on the following page:
+//
+//     http://www.fltk.org/str.php
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <FL/fl_utf8.h>
+#include "flstring.h"
+
+#include <FL/Fl.H>
+#include <FL/Fl_Shared_Image.H>
+#include <FL/Fl_Widget.H>
+#include "Fl_System_Driver.H"
+
+//
+// get_async() adds a placeholder to the image cache and queues a job that
+// loads its image. At most MAX_LOADERS jobs run at once, each in its own
+// thread, which hands the image to the main thread with Fl::awake(). If
+// threads can't be started, the jobs run one at a time from a timeout in
+// the main thread. Everything but the loading runs in the main thread.
+//
+
+#define MAX_LOADERS 4
+
+struct Fl_Shared_Image_Request {
+  Fl_Shared_Image_Request *next;
+  Fl_Widget		*widget;	// Widget to redraw, watched
+  int			has_widget;	// Was there a widget?
+  Fl_Shared_Image_Cb	cb;		// Function to call
+  void			*data;		// Its argument
+};
+
+struct Fl_Shared_Image_Job {
+  Fl_Shared_Image_Job	*next;		// Next waiting or running job
+  Fl_Shared_Image	*image;		// Placeholder, referenced by the job
+  Fl_Shared_Image_Request *requests;	// Who to tell when it is loaded
+  Fl_Image		*result;	// Image loaded by the job
+};
+
+class Fl_Shared_Image_Loader {
+  static Fl_Shared_Image_Job *waiting_;	// Jobs to start, oldest first
+  static Fl_Shared_Image_Job *running_;	// Jobs started
+  static int	num_running_;		// Number of jobs started
+  static int	timeout_;		// Is timeout_cb() pending?
+
+  static int	cancelled(Fl_Shared_Image_Job *job);
+  static void	drop(Fl_Shared_Image_Job *job);
+  static Fl_Shared_Image_Job *next();
+  static void	load(Fl_Shared_Image_Job *job);
+  static void	*thread_main(void *job);
+  static void	loaded(void *job);
+  static void	timeout_cb(void *);
+
+public:
+  static Fl_Shared_Image_Job *job(Fl_Shared_Image *img);
+  static Fl_Shared_Image_Job *add(Fl_Shared_Image *img);
+  static void	start();
+};
+
+Fl_Shared_Image_Job *Fl_Shared_Image_Loader::waiting_ = 0;
+Fl_Shared_Image_Job *Fl_Shared_Image_Loader::running_ = 0;
+int	Fl_Shared_Image_Loader::num_running_ = 0;
+int	Fl_Shared_Image_Loader::timeout_ = 0;
+
+
+//
+// Finds the job that loads a placeholder...
+//
+
+Fl_Shared_Image_Job *
+Fl_Shared_Image_Loader::job(Fl_Shared_Image *img) {
+  Fl_Shared_Image_Job *j;
+
+  for (j = waiting_; j; j = j->next)
+    if (j->image == img) return j;
+  for (j = running_; j; j = j->next)
+    if (j->image == img) return j;
+
+  return 0;
+}
+
+
+//
+// Queues a job to load a placeholder...
+//
+
+Fl_Shared_Image_Job *
+Fl_Shared_Image_Loader::add(Fl_Shared_Image *img) {
+  Fl_Shared_Image_Job *j = new Fl_Shared_Image_Job, **last;
+
+  j->next     = 0;
+  j->image    = img;
+  j->requests = 0;
+  j->result   = 0;
+
+  img->refcount_ ++;
+
+  for (last = &waiting_; *last; last = &(*last)->next) { }
+  *last = j;
+
+  return j;
+}
+
+
+//
+// A job is cancelled when all the widgets that requested the image were
+// deleted, and only the job uses it...
+//
+
+int
+Fl_Shared_Image_Loader::cancelled(Fl_Shared_Image_Job *job) {
+  if (!job->requests || job->image->refcount_ > 1) return 0;
+
+  for (Fl_Shared_Image_Request *r = job->requests; r; r = r->next)
+    if (!r->has_widget || r->widget) return 0;
+
+  return 1;
+}
+
+
+//
+// Frees a job that was not started, and its placeholder...
+//
+
+void
+Fl_Shared_Image_Loader::drop(Fl_Shared_Image_Job *job) {
+  Fl_Shared_Image_Request *r;
+
+  while ((r = job->requests) != NULL) {
+    job->requests = r->next;
+    Fl::release_widget_pointer(r->widget);
+    delete r;
+  }
+
+  job->image->loading_ = 0;
+  job->image->remove();
+  job->image->release();
+
+  delete job;
+}
+
+
+//
+// Takes the next job to start, dropping cancelled jobs...
+//
+
+Fl_Shared_Image_Job *
+Fl_Shared_Image_Loader::next() {
+  Fl_Shared_Image_Job *j;
+
+  while ((j = waiting_) != NULL) {
+    waiting_ = j->next;
+
+    if (!cancelled(j)) {
+      j->next     = running_;
+      running_    = j;
+      num_running_ ++;
+      return j;
+    }
+
+    drop(j);
+  }
+
+  return 0;
+}
+
+
+//
+// Starts as many waiting jobs as allowed...
+//
+
+void
+Fl_Shared_Image_Loader::start() {
+  Fl_Shared_Image_Job *j;
+
+  while (!timeout_ && num_running_ < MAX_LOADERS && (j = next()) != NULL) {
+    if (Fl::system_driver()->create_thread(thread_main, j)) {
+      // No threads, load the images in the main thread...
+      running_ = j->next;
+      num_running_ --;
+      j->next  = waiting_;
+      waiting_ = j;
+
+      Fl::add_timeout(0.0, timeout_cb);
+      timeout_ = 1;
+    }
+  }
+}
+
+
+//
+// Loads the image of a job, in any thread...
+//
+
+void
+Fl_Shared_Image_Loader::load(Fl_Shared_Image_Job *job) {
+  Fl_Shared_Image *img = job->image;
+  Fl_Shared_Image *temp = 0;
+  Fl_Image *result = 0;
+
+  // Decode a resized image at a reduced size if possible...
+  if (!img->original_)
+    result = Fl_Shared_Image::scaled_image(img->name_, img->w(), img->h());
+
+  if (!result) {
+    temp = new Fl_Shared_Image(img->name_);
+    result = temp->image_;
+    temp->alloc_image_ = 0;
+  }
+
+  if (result) {
+    if (!img->original_ &&
+        (result->w() != img->w() || result->h() != img->h())) {
+      Fl_Image *copy = result->copy(img->w(), img->h());
+      delete result;
+      result = copy;
+    }
+  }
+
+  delete temp;
+
+  job->result = result;
+}
+
+
+void *
+Fl_Shared_Image_Loader::thread_main(void *job) {
+  load((Fl_Shared_Image_Job *)job);
+  Fl::awake(loaded, job);
+  return 0;
+}
+
+
+void
+Fl_Shared_Image_Loader::timeout_cb(void *) {
+  Fl_Shared_Image_Job *j;
+
+  timeout_ = 0;
+
+  if ((j = next()) != NULL) {
+    load(j);
+    loaded(j);
+  }
+}
+
+
+//
+// Gives the loaded image to the placeholder and tells the widgets...
+//
+
+void
+Fl_Shared_Image_Loader::loaded(void *data) {
+  Fl_Shared_Image_Job *job = (Fl_Shared_Image_Job *)data, **j;
+  Fl_Shared_Image *img = job->image;
+  Fl_Shared_Image_Request *r;
+
+  for (j = &running_; *j != job; j = &(*j)->next) { }
+  *j = job->next;
+  num_running_ --;
+
+  img->loading_ = 0;
+
+  if (job->result) {
+    if (img->alloc_image_) delete img->image_;
+
+    img->image_       = job->result;
+    img->alloc_image_ = 1;
+    img->update();
+  } else {
+    // Not an image, get() would not find it...
+    img->ld(Fl_Image::ERR_FORMAT);
+    img->remove();
+  }
+
+  while ((r = job->requests) != NULL) {
+    job->requests = r->next;
+
+    if (r->widget) r->widget->redraw();
+    if (r->cb && (r->widget || !r->has_widget)) (r->cb)(img, r->data);
+
+    Fl::release_widget_pointer(r->widget);
+    delete r;
+  }
+
+  img->release();
+  delete job;
+
+  start();
+}
+
+
+//
+// Reads the size of a GIF, PNG, BMP or JPEG image from its header...
+//
+
+static int image_file_size(const char *name, int *W, int *H) {
+  FILE	*fp;			// File pointer
+  uchar	h[32];			// Header
+  int	n;			// Header length
+
+  *W = *H = 0;
+
+  if ((fp = fl_fopen(name, "rb")) == NULL) return 0;
+
+  n = (int)fread(h, 1, sizeof(h), fp);
+
+  if (n >= 10 && (!memcmp(h, "GIF87a", 6) || !memcmp(h, "GIF89a", 6))) {
+    *W = h[6] | (h[7] << 8);
+    *H = h[8] | (h[9] << 8);
+  } else if (n >= 24 && !memcmp(h, "\211PNG\r\n\032\n", 8) &&
+             !memcmp(h + 12, "IHDR", 4)) {
+    *W = (h[16] << 24) | (h[17] << 16) | (h[18] << 8) | h[19];
+    *H = (h[20] << 24) | (h[21] << 16) | (h[22] << 8) | h[23];
+  } else if (n >= 26 && h[0] == 'B' && h[1] == 'M') {
+    if (h[14] == 12) {		// OS/2 header
+      *W = h[18] | (h[19] << 8);
+      *H = h[20] | (h[21] << 8);
+    } else {
+      *W = h[18] | (h[19] << 8) | (h[20] << 16) | (h[21] << 24);
+      *H = h[22] | (h[23] << 8) | (h[24] << 16) | (h[25] << 24);
+      if (*H < 0) *H = -*H;	// top-down image
+    }
+  } else if (n >= 4 && h[0] == 0xff && h[1] == 0xd8) {
+    // Look for the "start of frame" marker of a JPEG image...
+    int c, len;
+
+    fseek(fp, 2, SEEK_SET);
+
+    for (;;) {
+      while ((c = getc(fp)) == 0xff) { }
+      if (c == EOF || c == 0xd9 || c == 0xda) break;	// EOI or SOS
+      if (c == 0x01 || (c >= 0xd0 && c <= 0xd7)) continue;
+
+      len = getc(fp) << 8;
+      len |= getc(fp);
+      if (len < 2 || feof(fp)) break;
+
+      if (c >= 0xc0 && c <= 0xcf && c != 0xc4 && c != 0xc8 && c != 0xcc) {
+        if (fread(h, 1, 5, fp) != 5) break;
+        *H = (h[1] << 8) | h[2];
+        *W = (h[3] << 8) | h[4];
+        break;
+      }
+
+      if (fseek(fp, len - 2, SEEK_CUR)) break;
+    }
+  }
+
+  fclose(fp);
+
+  if (*W <= 0 || *H <= 0) *W = *H = 0;
+
+  return *W > 0;
+}
+
+
+/**
+  Finds or starts loading an image without waiting for it.
+
+  This is like get(), except that an image that is not in the cache yet
+  is loaded in another thread. get_async() returns a placeholder of the
+  size of the image at once, or of size \p W x \p H if both are given,
+  whose loading() method returns 1, so that the application can lay out
+  its widgets. The placeholder draws like an empty image until its data is
+  loaded. Then \p widget is redrawn and \p cb is called with the image
+  and \p data in the main thread.
+
+  If the image is already in the cache, or if its size can't be found
+  without loading it, it is returned like get() does, and \p cb is not
+  called. The callback is called if and only if loading() returns 1.
+
+  If the image can't be loaded, the callback is called anyway, and the
+  fail() method of the image returns Fl_Image::ERR_FORMAT.
+
+  If \p widget is deleted and no one else uses the image when its loading
+  should start, the image is not loaded and \p cb is not called.
+
+  The images are loaded in threads only if the application enabled them
+  by calling Fl::lock(), see \ref advanced_multithreading. Otherwise they
+  are loaded one at a time from a timeout in the main thread.
+
+  You should release() the image when you're done with it, like for get().
+  While it is loading, find() and get() also return the placeholder.
+
+  \param name name of the image
+  \param W, H desired size, or 0 for the size of the image
+  \param widget widget to redraw when the image is loaded, or NULL
+  \param cb function to call when the image is loaded, or NULL
+  \param data argument of \p cb
+
+  \see Fl_Shared_Image::get(const char *name, int W, int H)
+  \since FLTK 1.4.0
+*/
+Fl_Shared_Image* Fl_Shared_Image::get_async(const char *name, int W, int H,
+                                            Fl_Widget *widget,
+                                            Fl_Shared_Image_Cb cb, void *data) {
+  Fl_Shared_Image	*temp;		// Image
+  Fl_Shared_Image_Job	*job;		// Job loading it
+  int			iw, ih;		// Size of the image
+
+  if ((temp = find(name, W, H)) != NULL) {
+    if (!temp->loading_) return temp;
+
+    job = Fl_Shared_Image_Loader::job(temp);
+  } else {
+    if ((temp = find(name)) != NULL && !temp->loading_) {
+      // Only a resized copy is needed...
+      temp->release();
+      return get(name, W, H);
+    }
+
+    if (temp) temp->release();
+
+    if (!image_file_size(name, &iw, &ih) && !(W && H))
+      return get(name, W, H);
+
+    temp = new Fl_Shared_Image();
+    temp->name_ = new char[strlen(name) + 1];
+    strcpy((char *)temp->name_, name);
+
+    if (!W || !H || (W == iw && H == ih)) {
+      temp->w(iw);
+      temp->h(ih);
+      temp->original_ = 1;
+    } else {
+      temp->w(W);
+      temp->h(H);
+    }
+
+    temp->loading_ = 1;
+    temp->add();
+
+    job = Fl_Shared_Image_Loader::add(temp);
+  }
+
+  if (widget || cb) {
+    Fl_Shared_Image_Request *r = new Fl_Shared_Image_Request;
+
+    r->widget     = widget;
+    r->has_widget = widget != 0;
+    r->cb         = cb;
+    r->data       = data;
+    r->next       = job->requests;
+    job->requests = r;
+
+    if (widget) Fl::watch_widget_pointer(r->widget);
+  }
+
+  Fl_Shared_Image_Loader::start();
+
+  return temp;
+}
+
+
+//
+// End of "$Id$".
+//
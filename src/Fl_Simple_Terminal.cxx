@@ -59,10 +59,11 @@ static const Fl_Text_Display::Style_Table_Entry builtin_stable[] = {
 static const int  builtin_stable_size = sizeof(builtin_stable);
 static const char builtin_normal_index = 17;        // the reset style index used by \033[0m
 
-// Count how many times character 'c' appears in string 's'
-static int strcnt(const char *s, char c) {
+// Count how many times character 'c' appears in the first 'len' bytes of 's'
+static int strcnt(const char *s, int len, char c) {
   int count = 0;
-  while ( *s ) { if ( *s++ == c ) ++count; }
+  const char *e = s + len;
+  while ( (s = (const char*)memchr(s, c, e - s)) != 0 ) { ++s; ++count; }
   return count;
 }
 
@@ -97,9 +98,15 @@ Fl_Simple_Terminal::Fl_Simple_Terminal(int X,int Y,int W,int H,const char *l) :
   cursor_color(FL_GREEN);
   cursor_style(Fl_Text_Display::BLOCK_CURSOR);
   // Setup text buffer
+  //    The history is stored in small blocks, so that trimming the oldest
+  //    lines doesn't move the whole history, and can't be undone.
   buf = new Fl_Text_Buffer();
+  buf->storage(Fl_Text_Buffer::ROPE);
+  buf->canUndo(0);
   buffer(buf);
   sbuf = new Fl_Text_Buffer();  // allocate whether we use it or not
+  sbuf->storage(Fl_Text_Buffer::ROPE);
+  sbuf->canUndo(0);
   // XXX: We use WRAP_AT_BOUNDS to prevent the hscrollbar from /always/
   //      being present, an annoying UI bug in Fl_Text_Display.
   wrap_mode(Fl_Text_Display::WRAP_AT_BOUNDS, 0);
@@ -176,6 +183,11 @@ int Fl_Simple_Terminal::history_lines() const {
 
  When a limit is set, the buffer is trimmed as new text is appended,
  ensuring the buffer never displays more than the specified number of lines.
+ The text is stored in small blocks, so that trimming the oldest lines
+ does not move the rest of the history. This is not a ring of lines
+ trimmed in constant time: the list of blocks is still rebuilt, which
+ takes time proportional to the number of blocks. The displayed text is
+ not redrawn when the trimmed lines are scrolled out of view.
 
  The default maximum is 500 lines.
 
@@ -511,37 +523,40 @@ void Fl_Simple_Terminal::enforce_history_lines() {
  \see printf(), vprintf(), text(), clear()
 */
 void Fl_Simple_Terminal::append(const char *s, int len) {
+  int whole = (len < 0);          // append up to the terminating NUL
+  if ( whole ) len = strlen(s);
   // Remove ansi codes and adjust style buffer accordingly.
   if ( ansi() ) {
     int nstyles = stable_size_ / STE_SIZE;
-    if ( len < 0 ) len = strlen(s);
-    // New text buffer (after ansi codes parsed+removed)
-    char *ntm = (char*)malloc(len+1);       // new text memory
+    // New text and style (after ansi codes parsed+removed), in one block
+    char *ntm = (char*)malloc(2*len+2);     // new text memory
     char *ntp = ntm;
-    char *nsm = (char*)malloc(len+1);       // new style memory
+    char *nsm = ntm+len+1;                  // new style memory
     char *nsp = nsm;
     // ANSI values
     char astyle = 'A'+current_style_index_; // the running style index
     const char *esc = 0;
     const char *sp = s;
+    const char *ep = s + len;
     // Walk user's string looking for codes, modify new text/style text as needed
-    while ( *sp ) {
+    while ( sp < ep && *sp ) {
       if ( *sp == 033 ) {        // "\033.."
         esc = sp++;
+        if ( sp == ep ) break;   // "\033" at end of string? stop
         switch (*sp) {
           case 0:                // "\033<NUL>"? stop
             continue;
           case '[': {            // "\033[.."
             ++sp;
             int vals[4], tv=0, seqdone=0;
-            while ( *sp && !seqdone && isdigit(*sp) ) { // "\033[#;#.."
-              char *newsp;
-              long a = strtol(sp, &newsp, 10);
-              sp = newsp;
-              vals[tv++] = (a<0) ? 0 : a;       // prevent negative values
+            while ( sp < ep && !seqdone && isdigit(*sp) ) { // "\033[#;#.."
+              long a = 0;
+              while ( sp < ep && isdigit(*sp) )
+                a = (a < 100000) ? a * 10 + (*sp++ - '0') : a;
+              vals[tv++] = a;
               if ( tv >= 4 )      // too many #'s specified? abort sequence
                 { seqdone = 1; sp = esc+1; continue; }
-              switch(*sp) {
+              switch(sp < ep ? *sp : 0) {
                 case ';':         // numeric separator
                   ++sp;
                   continue;
@@ -573,8 +588,7 @@ void Fl_Simple_Terminal::append(const char *s, int len) {
                   seqdone = 1;
                   continue;
                 case '\0':        // EOS in middle of sequence?
-                  *ntp = 0;       // end of text
-                  *nsp = 0;       // end of style
+                  sp = ep;        // end of text and style
                   seqdone = 1;
                   continue;
                 default:          // un-supported cmd?
@@ -587,24 +601,37 @@ void Fl_Simple_Terminal::append(const char *s, int len) {
         }         // switch
       }           // \033
       else {
-        // Non-ANSI character?
-        if ( *sp == '\n' ) ++lines; // keep track of #lines
-        *ntp++ = *sp++;             // pass char thru
-        *nsp++ = astyle;            // use current style
+        // Non-ANSI characters? pass them thru up to the next escape
+        const char *cp = sp;
+        while ( cp < ep && *cp && *cp != 033 ) ++cp;
+        int n = (int)(cp - sp);
+        lines += ::strcnt(sp, n, '\n');   // keep track of #lines
+        memcpy(ntp, sp, n);
+        memset(nsp, astyle, n);           // use current style
+        ntp += n;
+        nsp += n;
+        sp = cp;
       }
     } // while
     *ntp = 0;
     *nsp = 0;
-    //::printf("  RESULT: ntm='%s'\n", ntm);
-    //::printf("  RESULT: nsm='%s'\n", nsm);
-    buf->append(ntm);           // new text memory
+    // Append the styles first, so that they are there when the display
+    // is told about the new text
     sbuf->append(nsm);          // new style memory
+    buf->append(ntm);           // new text memory
     free(ntm);
-    free(nsm);
   } else {
     // non-ansi buffer
-    buf->append(s);
-    lines += ::strcnt(s, '\n');  // count total line feeds in string added
+    if ( whole ) {
+      buf->append(s);
+    } else {                    // append the first 'len' bytes only
+      char *t = (char*)malloc(len+1);
+      memcpy(t, s, len);
+      t[len] = 0;
+      buf->append(t);
+      free(t);
+    }
+    lines += ::strcnt(s, len, '\n');  // count total line feeds in string added
   }
   enforce_history_lines();
   enforce_stay_at_bottom();
@@ -689,15 +716,14 @@ void Fl_Simple_Terminal::vprintf(const char *fmt, va_list ap) {
   ::vsnprintf(buffer, 1024, fmt, ap);
   buffer[1024-1] = 0;   // XXX: MICROSOFT
   append(buffer);
-  enforce_history_lines();
 }
 
 /**
  Clears the terminal's screen and history. Cursor moves to top of window.
 */
 void Fl_Simple_Terminal::clear() {
-  buf->text("");
   sbuf->text("");
+  buf->text("");
   lines = 0;
 }
 
@@ -707,15 +733,21 @@ void Fl_Simple_Terminal::clear() {
 
  This method is used to enforce the history limit.
 
+ The lines are the lines of the text buffer, ended by newlines, like
+ those counted for history_lines(). Before FLTK 1.4.0 they were the lines
+ displayed, so that a long line wrapped on several lines of the display
+ counted as several lines.
+
  \param start -- starting line to remove
  \param count -- number of lines to remove
 */
 void Fl_Simple_Terminal::remove_lines(int start, int count) {
-  int spos = skip_lines(0, start, true);
-  int epos = skip_lines(spos, count, true);
+  // Count lines of the buffer, not wrapped lines, like 'lines' does
+  int spos = buf->skip_lines(0, start);
+  int epos = buf->skip_lines(spos, count);
   if ( ansi() ) {
+    sbuf->remove(spos, epos);   // styles first, like append()
     buf->remove(spos, epos);
-    sbuf->remove(spos, epos);
   } else {
     buf->remove(spos, epos);
   }
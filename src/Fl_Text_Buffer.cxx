@@ -24,6 +24,15 @@
 #include <FL/Fl.H>
 #include <FL/Fl_Text_Buffer.H>
 #include <FL/fl_ask.H>
+#include <FL/filename.H>
+#include "Fl_System_Driver.H"
+#include <limits.h>
+#include <sys/stat.h>
+#if defined(__SSE2__)
+#  include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#  include <arm_neon.h>
+#endif
 
 
 /*
@@ -68,30 +77,325 @@ static int min(int i1, int i2)
 #endif
 
 
-static char *undobuffer;
-static int undobufferlength;
-static Fl_Text_Buffer *undowidget;
-static int undoat;		// points after insertion
-static int undocut;		// number of characters deleted there
-static int undoinsert;		// number of characters inserted
-static int undoyankcut;		// length of valid contents of buffer, even if undocut=0
+/*
+ The undo history of a buffer is a stack of edit records. A record replaces
+ the ins_len bytes at pos by the del_len bytes that were removed there, or
+ the other way around when it is redone. The removed and the inserted text
+ of each record follow each other in a text arena, in the order of the
+ records, so the history costs little more than the edited text itself.
+ Records [0, cur) can be undone, records [cur, n) can be redone.
+
+ Consecutive typing is appended to the last record, and text typed where
+ text was just removed turns that record into a replacement. Removing more
+ text at the same place appends it to the record (Delete key) or adds a
+ record that is undone together with the previous one (BackSpace key), so
+ that the text of a record never needs to be moved in the arena.
+
+ All the records added between begin_batch() and end_batch() are joined
+ to the first one, so that they are undone and redone together.
+ */
+struct Fl_Text_Undo_Record {
+  int pos;                        // position of the edit
+  int del_len;                    // number of bytes removed at pos
+  int ins_len;                    // number of bytes inserted at pos
+  int offset;                     // of the removed, then inserted text
+  int join;                       // undo and redo with the previous record
+};
+
+struct Fl_Text_Undo {
+  Fl_Text_Undo_Record *rec;
+  int n, cur, alloc;
+  char *text;                     // text arena
+  int text_used, text_alloc;
+  int open;                       // the last record can be extended
+  int applying;                   // undo() or redo() is editing the buffer
+  int batch;                      // 1 in a batch, 2 once it added a record
+};
+
+/*
+ Between begin_batch() and end_batch(), the modifications are coalesced in
+ a single range of text, that replaced the text of the buffer between
+ start and old_end before the batch by the text between start and end.
+ The text that was replaced is kept, for the deletedText argument of the
+ modify callbacks. Restyled text is handled as if it was replaced by
+ itself.
+ */
+struct Fl_Text_Batch {
+  int depth;                      // number of nested begin_batch() calls
+  int start, end, old_end;        // start == -1 if nothing changed yet
+  char *text;                     // the text between start and old_end
+  int alloc;
+};
+
+static void undo_clear(Fl_Text_Undo *u)
+{
+  int batch = u->batch;
+  free(u->rec);
+  free(u->text);
+  memset(u, 0, sizeof(Fl_Text_Undo));
+  if (batch)
+    u->batch = 1;
+}
 
 /*
- Resize the undo buffer to match at least the requested size.
+ Drop the records that can be redone, the text was edited since they were
+ undone.
  */
-static void undobuffersize(int n)
+static void undo_drop_redo(Fl_Text_Undo *u)
 {
-  if (n > undobufferlength) {
-    if (undobuffer) {
-      do {
-	undobufferlength *= 2;
-      } while (undobufferlength < n);
-      undobuffer = (char *) realloc(undobuffer, undobufferlength);
-    } else {
-      undobufferlength = n + 9;
-      undobuffer = (char *) malloc(undobufferlength);
+  if (u->cur == u->n)
+    return;
+  u->n = u->cur;
+  if (u->n) {
+    Fl_Text_Undo_Record *r = u->rec + u->n - 1;
+    u->text_used = r->offset + r->del_len + r->ins_len;
+  } else {
+    u->text_used = 0;
+  }
+  u->open = 0;
+}
+
+static Fl_Text_Undo_Record *undo_add_record(Fl_Text_Undo *u, int pos, int join)
+{
+  if (u->n == u->alloc) {
+    u->alloc = u->alloc ? 2 * u->alloc : 64;
+    u->rec = (Fl_Text_Undo_Record *) realloc(u->rec, u->alloc * sizeof(Fl_Text_Undo_Record));
+  }
+  Fl_Text_Undo_Record *r = u->rec + u->n++;
+  r->pos = pos;
+  r->del_len = r->ins_len = 0;
+  r->offset = u->text_used;
+  r->join = join || u->batch == 2;
+  if (u->batch)
+    u->batch = 2;
+  u->cur = u->n;
+  return r;
+}
+
+/*
+ Return room for len more bytes at the end of the text arena.
+ */
+static char *undo_reserve(Fl_Text_Undo *u, int len)
+{
+  if (u->text_used + len > u->text_alloc) {
+    int n = u->text_alloc ? u->text_alloc : 1024;
+    while (n < u->text_used + len)
+      n *= 2;
+    u->text = (char *) realloc(u->text, n);
+    u->text_alloc = n;
+  }
+  return u->text + u->text_used;
+}
+
+/*
+ With ROPE storage, the text is kept in a sequence of nodes of up to
+ ROPE_NODE_MAX bytes, in separately allocated blocks, and a Fenwick tree
+ of the node lengths finds the node of a position in O(log n). Node
+ boundaries always are at character boundaries, so that address() can
+ return a complete UTF-8 character. Modifications only move the text of
+ the nodes they touch; large insertions are cut into new nodes of about
+ ROPE_NODE_SPLIT bytes, and nodes that shrink below ROPE_NODE_MIN bytes are
+ merged with a neighbour.
+
+ A file loaded by mapfile() is mapped in memory and cut into borrowed nodes
+ of about ROPE_MAP_NODE bytes, that point into the mapping and are never
+ written. Edits in a borrowed node cut it around new owned nodes, or only
+ move its start or end, so the file is not read before it is displayed and
+ only the edited text takes memory.
+ */
+#define ROPE_NODE_MAX   8192
+#define ROPE_NODE_SPLIT 4096
+#define ROPE_NODE_MIN   1024
+#define ROPE_MAP_NODE   (1024 * 1024)
+
+struct Fl_Text_Rope_Node {
+  char *text;
+  int len;
+  int alloc;                      // 0 if the text is borrowed from the mapping
+};
+
+/*
+ The node found by the last rope_address_() call is remembered in a single
+ word, with the start of the node in the high 32 bits and its index in the
+ low 32 bits. Threads holding Fl::lock_shared() may read the same buffer
+ at the same time: they load and store the whole word atomically, so that
+ each of them gets a node and its start as found by one of them. Where
+ this can't be done, the node is not remembered.
+ */
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 7) || defined(__clang__))
+#  define ROPE_LAST 1
+#  define rope_last_load(p)     __atomic_load_n(p, __ATOMIC_RELAXED)
+#  define rope_last_store(p, v) __atomic_store_n(p, v, __ATOMIC_RELAXED)
+#elif defined(_MSC_VER) && defined(_M_X64)
+#  define ROPE_LAST 1
+#  define rope_last_load(p)     (*(volatile unsigned long long *)(p))
+#  define rope_last_store(p, v) (*(volatile unsigned long long *)(p) = (v))
+#else
+#  define ROPE_LAST 0
+#endif
+
+struct Fl_Text_Rope {
+  Fl_Text_Rope_Node *nodes;
+  int count, alloc;
+  int *tree;                      // Fenwick tree of the node lengths, 1-based
+  unsigned long long last;        // node found by the last address() call
+  void *map;                      // file mapped by mapfile(), or NULL
+  size_t map_size;
+  struct stat map_stat;           // to recognize the mapped file
+  char *map_path;                 // its absolute path, where st_ino is 0
+};
+
+/*
+ Copy the borrowed nodes and unmap the file.
+ */
+static void rope_unmap(Fl_Text_Rope *r)
+{
+  if (!r->map)
+    return;
+  for (int i = 0; i < r->count; i++) {
+    Fl_Text_Rope_Node *node = r->nodes + i;
+    if (!node->alloc && node->len) {
+      char *t = (char *) malloc(node->len);
+      memcpy(t, node->text, node->len);
+      node->text = t;
+      node->alloc = node->len;
     }
   }
+  Fl::system_driver()->unmap_file(r->map, r->map_size);
+  r->map = NULL;
+  free(r->map_path);
+  r->map_path = NULL;
+}
+
+/*
+ Return non-zero if the file is the mapped file. Windows has no inode
+ numbers (st_ino is 0), the absolute paths are compared instead.
+ */
+static int rope_is_mapped(Fl_Text_Rope *r, const char *file)
+{
+  if (!r->map)
+    return 0;
+  if (!r->map_path) {
+    struct stat st;
+    return fl_stat(file, &st) == 0 && st.st_dev == r->map_stat.st_dev
+      && st.st_ino == r->map_stat.st_ino;
+  }
+  char path[FL_PATH_MAX];
+  fl_filename_absolute(path, sizeof(path), file);
+#ifdef _WIN32
+  return fl_utf_strcasecmp(path, r->map_path) == 0;
+#else
+  return strcmp(path, r->map_path) == 0;
+#endif
+}
+
+static void rope_clear(Fl_Text_Rope *r)
+{
+  for (int i = 0; i < r->count; i++)
+    if (r->nodes[i].alloc)
+      free(r->nodes[i].text);
+  if (r->map)
+    Fl::system_driver()->unmap_file(r->map, r->map_size);
+  free(r->map_path);
+  free(r->nodes);
+  free(r->tree);
+  memset(r, 0, sizeof(Fl_Text_Rope));
+}
+
+static void rope_reserve(Fl_Text_Rope *r, int count)
+{
+  if (count <= r->alloc)
+    return;
+  int n = r->alloc ? 2 * r->alloc : 16;
+  while (n < count)
+    n *= 2;
+  r->nodes = (Fl_Text_Rope_Node *) realloc(r->nodes, n * sizeof(Fl_Text_Rope_Node));
+  r->tree = (int *) realloc(r->tree, (n + 1) * sizeof(int));
+  r->alloc = n;
+}
+
+/*
+ Drop the empty nodes and rebuild the tree in O(n).
+ */
+static void rope_rebuild(Fl_Text_Rope *r)
+{
+  int n = 0;
+  for (int i = 0; i < r->count; i++) {
+    if (r->nodes[i].len)
+      r->nodes[n++] = r->nodes[i];
+    else if (r->nodes[i].alloc)
+      free(r->nodes[i].text);
+  }
+  r->count = n;
+  r->last = 0;
+  for (int i = 1; i <= n; i++)
+    r->tree[i] = r->nodes[i - 1].len;
+  for (int i = 1; i <= n; i++) {
+    int j = i + (i & -i);
+    if (j <= n)
+      r->tree[j] += r->tree[i];
+  }
+}
+
+/*
+ Return the length of the next node to cut from len bytes of text.
+ */
+static int rope_cut(const char *text, int len)
+{
+  if (len <= ROPE_NODE_MAX)
+    return len;
+  int cut = ROPE_NODE_SPLIT;
+  while (cut > 0 && (text[cut] & 0xC0) == 0x80)
+    cut--;
+  return cut ? cut : ROPE_NODE_SPLIT;
+}
+
+/*
+ Insert new nodes with len bytes of text before node i and return their
+ number. The tree must be rebuilt afterwards.
+ */
+static int rope_put(Fl_Text_Rope *r, int i, const char *text, int len)
+{
+  int n = 0;
+  for (int done = 0; done < len; n++)
+    done += rope_cut(text + done, len - done);
+  if (!n)
+    return 0;
+  rope_reserve(r, r->count + n);
+  memmove(r->nodes + i + n, r->nodes + i, (r->count - i) * sizeof(Fl_Text_Rope_Node));
+  r->count += n;
+  for (int done = 0; done < len; i++) {
+    Fl_Text_Rope_Node *node = r->nodes + i;
+    node->len = node->alloc = rope_cut(text + done, len - done);
+    node->text = (char *) malloc(node->alloc);
+    memcpy(node->text, text + done, node->len);
+    done += node->len;
+  }
+  return n;
+}
+
+/*
+ Append borrowed nodes with the len bytes of mapped text.
+ */
+static void rope_borrow(Fl_Text_Rope *r, char *text, int len)
+{
+  while (len > 0) {
+    int cut = len;
+    if (len > ROPE_MAP_NODE + ROPE_MAP_NODE / 2) {
+      cut = ROPE_MAP_NODE;
+      while (cut > 0 && (text[cut] & 0xC0) == 0x80)
+        cut--;
+      if (!cut)
+        cut = ROPE_MAP_NODE;
+    }
+    rope_reserve(r, r->count + 1);
+    Fl_Text_Rope_Node *node = r->nodes + r->count++;
+    node->text = text;
+    node->len = cut;
+    node->alloc = 0;
+    text += cut;
+    len -= cut;
+  }
 }
 
 static void def_transcoding_warning_action(Fl_Text_Buffer *text)
@@ -99,6 +403,115 @@ static void def_transcoding_warning_action(Fl_Text_Buffer *text)
   fl_alert("%s", text->file_encoding_warning_message);
 }
 
+/*
+ Text appended with append_async() is queued in a lock-free stack of
+ chunks, like the awake handlers in Fl_lock.cxx. The thread that sets the
+ scheduled flag registers flush_async_cb() with Fl::awake(); this clears
+ the flag and appends all chunks queued until then in the main thread.
+ If Fl::awake() fails, the flag is cleared again so that the next
+ append_async() retries. The queue outlives its buffer while a flush is
+ pending.
+ */
+struct Fl_Text_Buffer_Chunk {
+  Fl_Text_Buffer_Chunk *next;
+  int len;
+  char text[1];                         // nul terminated
+};
+
+struct Fl_Text_Buffer_Async {
+  Fl_Text_Buffer *buffer;               // NULL once the buffer is deleted
+  Fl_Text_Buffer_Chunk *volatile head;  // newest first
+  void *volatile scheduled;             // non-NULL while a flush is pending
+};
+
+static void free_chunks(Fl_Text_Buffer_Chunk *head)
+{
+  while (head) {
+    Fl_Text_Buffer_Chunk *chunk = head;
+    head = chunk->next;
+    free(chunk);
+  }
+}
+
+static void flush_async_cb(void *data)
+{
+  Fl_Text_Buffer_Async *async = (Fl_Text_Buffer_Async *)data;
+  if (!async->buffer) {
+    free_chunks(async->head);
+    free(async);
+    return;
+  }
+  // clear the flag first, so that text queued from now on is flushed again
+  async->scheduled = NULL;
+  Fl_Text_Buffer_Chunk *head, *chunk;
+  do {
+    head = async->head;
+  } while (fl_cas_ptr((void *volatile *)&async->head, head, NULL) != head);
+  int len = 0;
+  for (chunk = head; chunk; chunk = chunk->next)
+    len += chunk->len;
+  if (!len)
+    return;
+  char *text = (char *) malloc(len + 1);
+  if (text) {
+    text[len] = '\0';
+    for (chunk = head; chunk; chunk = chunk->next) {
+      len -= chunk->len;
+      memcpy(text + len, chunk->text, chunk->len);
+    }
+    async->buffer->append(text);
+    free(text);
+  } else {
+    // append the chunks one by one, oldest first
+    Fl_Text_Buffer_Chunk *oldest = NULL;
+    while (head) {
+      chunk = head;
+      head = chunk->next;
+      chunk->next = oldest;
+      oldest = chunk;
+    }
+    for (chunk = oldest; chunk; chunk = chunk->next)
+      async->buffer->append(chunk->text);
+    head = oldest;
+  }
+  free_chunks(head);
+}
+
+void Fl_Text_Buffer::append_async(const char *t)
+{
+  if (!t || !*t)
+    return;
+  Fl_Text_Buffer_Async *async = mAsync;
+  if (!async) {
+    async = (Fl_Text_Buffer_Async *) malloc(sizeof(Fl_Text_Buffer_Async));
+    if (!async)
+      return;
+    async->buffer = this;
+    async->head = NULL;
+    async->scheduled = NULL;
+    if (fl_cas_ptr((void *volatile *)&mAsync, NULL, async) != NULL) {
+      free(async); // another thread was faster
+      async = mAsync;
+    }
+  }
+  int len = (int) strlen(t);
+  Fl_Text_Buffer_Chunk *chunk =
+    (Fl_Text_Buffer_Chunk *) malloc(sizeof(Fl_Text_Buffer_Chunk) + len);
+  if (!chunk)
+    return;
+  chunk->len = len;
+  memcpy(chunk->text, t, len + 1);
+  Fl_Text_Buffer_Chunk *head;
+  do {
+    head = async->head;
+    chunk->next = head;
+  } while (fl_cas_ptr((void *volatile *)&async->head, head, chunk) != head);
+  if (fl_cas_ptr(&async->scheduled, NULL, async) == NULL &&
+      Fl::awake(flush_async_cb, async) < 0)
+    async->scheduled = NULL;
+}
+
+
 /*
  Initialize all variables.
  */
@@ -126,6 +539,12 @@ Fl_Text_Buffer::Fl_Text_Buffer(int requestedSize, int preferredGapSize)
   mCanUndo = 1;
   input_file_was_transcoded = 0;
   transcoding_warning_action = def_transcoding_warning_action;
+  mAsync = NULL;
+  mLineIndex = NULL;
+  mUndo = NULL;
+  mUndoBudget = 0;
+  mRope = NULL;
+  mBatch = NULL;
 }
 
 
@@ -143,6 +562,28 @@ Fl_Text_Buffer::~Fl_Text_Buffer()
     delete[] mPredeleteProcs;
     delete[] mPredeleteCbArgs;
   }
+  if (mAsync) {
+    // a pending flush_async_cb() frees the queue
+    if (mAsync->scheduled) {
+      mAsync->buffer = NULL;
+    } else {
+      free_chunks(mAsync->head);
+      free(mAsync);
+    }
+  }
+  line_index(0);
+  if (mUndo) {
+    undo_clear(mUndo);
+    free(mUndo);
+  }
+  if (mRope) {
+    rope_clear(mRope);
+    free(mRope);
+  }
+  if (mBatch) {
+    free(mBatch->text);
+    free(mBatch);
+  }
 }
 
 
@@ -152,8 +593,7 @@ Fl_Text_Buffer::~Fl_Text_Buffer()
  */
 char *Fl_Text_Buffer::text() const {
   char *t = (char *) malloc(mLength + 1);
-  memcpy(t, mBuf, mGapStart);
-  memcpy(t+mGapStart, mBuf+mGapEnd, mLength - mGapStart);
+  copy_out_(t, 0, mLength);
   t[mLength] = '\0';
   return t;
 } 
@@ -175,15 +615,25 @@ void Fl_Text_Buffer::text(const char *t)
   /* Save information for redisplay, and get rid of the old buffer */
   const char *deletedText = text();
   int deletedLength = mLength;
-  free((void *) mBuf);
-  
-  /* Start a new buffer with a gap of mPreferredGapSize at the end */
   int insertedLength = (int) strlen(t);
-  mBuf = (char *) malloc(insertedLength + mPreferredGapSize);
+  if (mRope) {
+    rope_clear(mRope);
+    rope_put(mRope, 0, t, insertedLength);
+    rope_rebuild(mRope);
+  } else {
+    free((void *) mBuf);
+    
+    /* Start a new buffer with a gap of mPreferredGapSize at the end */
+    mBuf = (char *) malloc(insertedLength + mPreferredGapSize);
+    mGapStart = insertedLength;
+    mGapEnd = mGapStart + mPreferredGapSize;
+    memcpy(mBuf, t, insertedLength);
+  }
   mLength = insertedLength;
-  mGapStart = insertedLength;
-  mGapEnd = mGapStart + mPreferredGapSize;
-  memcpy(mBuf, t, insertedLength);
+  if (mLineIndex)
+    build_line_index_();
+  if (mUndo)
+    undo_clear(mUndo);
   
   /* Zero all of the existing selections */
   update_selections(0, deletedLength, 0);
@@ -222,15 +672,7 @@ char *Fl_Text_Buffer::text_range(int start, int end) const {
   s = (char *) malloc(copiedLength + 1);
   
   /* Copy the text from the buffer to the returned string */
-  if (end <= mGapStart) {
-    memcpy(s, mBuf + start, copiedLength);
-  } else if (start >= mGapStart) {
-    memcpy(s, mBuf + start + (mGapEnd - mGapStart), copiedLength);
-  } else {
-    int part1Length = mGapStart - start;
-    memcpy(s, mBuf + start, part1Length);
-    memcpy(s + part1Length, mBuf + mGapEnd, copiedLength - part1Length);
-  }
+  copy_out_(s, start, end);
   s[copiedLength] = '\0';
   return s;
 }
@@ -414,6 +856,15 @@ void Fl_Text_Buffer::copy(Fl_Text_Buffer * fromBuf, int fromStart,
   
   int copiedLength = fromEnd - fromStart;
   
+  if (mRope) {
+    char *t = (char *) malloc(copiedLength + 1);
+    fromBuf->copy_out_(t, fromStart, fromEnd);
+    t[copiedLength] = '\0';
+    insert_(toPos, t);
+    free(t);
+    return;
+  }
+  
   /* Prepare the buffer to receive the new text.  If the new text fits in
    the current buffer, just move the gap (if necessary) to where
    the text should be inserted.  If the new text is too large, reallocate
@@ -425,24 +876,36 @@ void Fl_Text_Buffer::copy(Fl_Text_Buffer * fromBuf, int fromStart,
     move_gap(toPos);
   
   /* Insert the new text (toPos now corresponds to the start of the gap) */
-  if (fromEnd <= fromBuf->mGapStart) {
-    memcpy(&mBuf[toPos], &fromBuf->mBuf[fromStart], copiedLength);
-  } else if (fromStart >= fromBuf->mGapStart) {
-    memcpy(&mBuf[toPos],
-	   &fromBuf->mBuf[fromStart + (fromBuf->mGapEnd - fromBuf->mGapStart)],
-	   copiedLength);
-  } else {
-    int part1Length = fromBuf->mGapStart - fromStart;
-    memcpy(&mBuf[toPos], &fromBuf->mBuf[fromStart], part1Length);
-    memcpy(&mBuf[toPos + part1Length],
-	   &fromBuf->mBuf[fromBuf->mGapEnd], copiedLength - part1Length);
-  }
+  fromBuf->copy_out_(&mBuf[toPos], fromStart, fromEnd);
   mGapStart += copiedLength;
   mLength += copiedLength;
+  if (mLineIndex)
+    line_index_inserted_(toPos, copiedLength);
+  if (mCanUndo)
+    undo_inserted_(toPos, copiedLength);
   update_selections(toPos, 0, copiedLength);
 }
 
 
+/*
+ Replace len bytes at pos by text_len bytes of text.
+ */
+static void undo_apply(Fl_Text_Buffer *buf, int pos, int len,
+                       const char *text, int text_len)
+{
+  char *tmp = (char *) malloc(text_len + 1);
+  memcpy(tmp, text, text_len);
+  tmp[text_len] = 0;
+  if (len && text_len)
+    buf->replace(pos, pos + len, tmp);
+  else if (len)
+    buf->remove(pos, pos + len);
+  else if (text_len)
+    buf->insert(pos, tmp);
+  free(tmp);
+}
+
+
 /*
  Take the previous changes and undo them. Return the previous
  cursor position in cursorPos. Returns 1 if the undo was applied.
@@ -450,38 +913,52 @@ void Fl_Text_Buffer::copy(Fl_Text_Buffer * fromBuf, int fromStart,
  */ 
 int Fl_Text_Buffer::undo(int *cursorPos)
 {
-  if (undowidget != this || (!undocut && !undoinsert && !mCanUndo))
+  Fl_Text_Undo *u = mUndo;
+  if (!u || !u->cur)
     return 0;
   
-  int ilen = undocut;
-  int xlen = undoinsert;
-  int b = undoat - xlen;
-  
-  if (xlen && undoyankcut && !ilen) {
-    ilen = undoyankcut;
-  }
-  
-  if (xlen && ilen) {
-    undobuffersize(ilen + 1);
-    undobuffer[ilen] = 0;
-    char *tmp = strdup(undobuffer);
-    replace(b, undoat, tmp);
-    if (cursorPos)
-      *cursorPos = mCursorPosHint;
-    free(tmp);
-  } else if (xlen) {
-    remove(b, undoat);
-    if (cursorPos)
-      *cursorPos = mCursorPosHint;
-  } else if (ilen) {
-    undobuffersize(ilen + 1);
-    undobuffer[ilen] = 0;
-    insert(undoat, undobuffer);
-    if (cursorPos)
-      *cursorPos = mCursorPosHint;
-    undoyankcut = 0;
-  }
+  u->applying = 1;
+  begin_batch();
+  Fl_Text_Undo_Record *r;
+  do {
+    r = u->rec + --u->cur;
+    undo_apply(this, r->pos, r->ins_len, u->text + r->offset, r->del_len);
+  } while (r->join && u->cur > 0);
+  end_batch();
+  u->applying = 0;
+  u->open = 0;
+  
+  if (cursorPos)
+    *cursorPos = mCursorPosHint;
+  return 1;
+}
+
+
+/**
+ Redo the last text modification that was undone.
+ All modifications that were undone with undo() can be redone in turn,
+ until the text is edited by other means.
+ \param[out] cursorPos if not NULL, the cursor position after the redone text
+ \return 1 if a modification was redone, 0 if there is nothing to redo
+ */
+int Fl_Text_Buffer::redo(int *cursorPos)
+{
+  Fl_Text_Undo *u = mUndo;
+  if (!u || u->cur >= u->n)
+    return 0;
   
+  u->applying = 1;
+  begin_batch();
+  do {
+    Fl_Text_Undo_Record *r = u->rec + u->cur++;
+    undo_apply(this, r->pos, r->del_len, u->text + r->offset + r->del_len, r->ins_len);
+  } while (u->cur < u->n && u->rec[u->cur].join);
+  end_batch();
+  u->applying = 0;
+  u->open = 0;
+  
+  if (cursorPos)
+    *cursorPos = mCursorPosHint;
   return 1;
 }
 
@@ -492,9 +969,117 @@ int Fl_Text_Buffer::undo(int *cursorPos)
 void Fl_Text_Buffer::canUndo(char flag)
 {
   mCanUndo = flag;
-  // disabling undo also clears the last undo operation!
-  if (!mCanUndo && undowidget==this) 
-    undowidget = 0;
+  // disabling undo also clears the undo history!
+  if (!mCanUndo && mUndo)
+    undo_clear(mUndo);
+}
+
+
+/*
+ Set the maximum memory used by the undo history, 0 for the last
+ modification only.
+ */
+void Fl_Text_Buffer::undo_budget(int bytes)
+{
+  mUndoBudget = bytes;
+  undo_trim_();
+}
+
+
+void Fl_Text_Buffer::undo_inserted_(int pos, int len)
+{
+  if (!mUndo)
+    mUndo = (Fl_Text_Undo *) calloc(1, sizeof(Fl_Text_Undo));
+  Fl_Text_Undo *u = mUndo;
+  if (u->applying || len <= 0)
+    return;
+  if (mUndoBudget > 0 && len > mUndoBudget) {
+    undo_clear(u);
+    return;
+  }
+  
+  undo_drop_redo(u);
+  Fl_Text_Undo_Record *r = u->n ? u->rec + u->n - 1 : NULL;
+  if (!u->open || !r || pos != r->pos + r->ins_len)
+    r = undo_add_record(u, pos, 0);
+  copy_out_(undo_reserve(u, len), pos, pos + len);
+  u->text_used += len;
+  r->ins_len += len;
+  u->open = 1;
+  undo_trim_();
+}
+
+
+void Fl_Text_Buffer::undo_removing_(int start, int end)
+{
+  if (!mUndo)
+    mUndo = (Fl_Text_Undo *) calloc(1, sizeof(Fl_Text_Undo));
+  Fl_Text_Undo *u = mUndo;
+  int len = end - start;
+  if (u->applying || len <= 0)
+    return;
+  if (mUndoBudget > 0 && len > mUndoBudget) {
+    undo_clear(u);
+    return;
+  }
+  
+  undo_drop_redo(u);
+  Fl_Text_Undo_Record *r = u->n ? u->rec + u->n - 1 : NULL;
+  int deleting = u->open && r && !r->ins_len;
+  if (!deleting || start != r->pos)
+    r = undo_add_record(u, start, deleting && end == r->pos);
+  copy_out_(undo_reserve(u, len), start, end);
+  u->text_used += len;
+  r->del_len += len;
+  u->open = 1;
+  undo_trim_();
+}
+
+
+void Fl_Text_Buffer::undo_trim_()
+{
+  Fl_Text_Undo *u = mUndo;
+  if (!u || !u->n)
+    return;
+  
+  int drop = 0;
+  if (mUndoBudget <= 0) {
+    // keep the last modification only, with the records undone with it
+    drop = u->n - 1;
+    while (drop > 0 && u->rec[drop].join)
+      drop--;
+  } else {
+    int used = u->text_used - u->rec[0].offset
+      + u->n * (int) sizeof(Fl_Text_Undo_Record);
+    while (drop < u->n && (used > mUndoBudget || u->rec[drop].join)) {
+      Fl_Text_Undo_Record *r = u->rec + drop++;
+      used -= r->del_len + r->ins_len + (int) sizeof(Fl_Text_Undo_Record);
+    }
+  }
+  if (!drop)
+    return;
+  if (drop >= u->n || drop > u->cur) {
+    // records that can be redone must be kept in sequence
+    undo_clear(u);
+    return;
+  }
+  
+  u->n -= drop;
+  u->cur -= drop;
+  memmove(u->rec, u->rec + drop, u->n * sizeof(Fl_Text_Undo_Record));
+  
+  // compact the text arena once half of it is unused
+  int base = u->rec[0].offset;
+  if (base > u->text_used / 2) {
+    u->text_used -= base;
+    memmove(u->text, u->text + base, u->text_used);
+    for (int i = 0; i < u->n; i++)
+      u->rec[i].offset -= base;
+    if (u->text_alloc > 4 * u->text_used + 1024) {
+      u->text_alloc = 2 * u->text_used + 1024;
+      u->text = (char *) realloc(u->text, u->text_alloc);
+    }
+  }
 }
 
 
@@ -949,6 +1534,587 @@ int Fl_Text_Buffer::skip_displayed_characters(int lineStartPos, int nChars)
 }
 
 
+/*
+ Count the bytes c in the n bytes at p. The loops of byte comparisons are
+ vectorized with SSE2 or NEON if available, the compiler usually does a
+ poor job with these.
+ */
+static int count_byte(const char *p, int n, char c)
+{
+  int count = 0;
+#if defined(__SSE2__)
+  const __m128i needle = _mm_set1_epi8(c);
+  while (n >= 16) {
+    // each byte of acc counts up to 255 matches
+    int chunks = n / 16 < 255 ? n / 16 : 255;
+    __m128i acc = _mm_setzero_si128();
+    for (int i = 0; i < chunks; i++, p += 16)
+      acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) p), needle));
+    acc = _mm_sad_epu8(acc, _mm_setzero_si128());
+    count += _mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8));
+    n -= chunks * 16;
+  }
+#elif defined(__ARM_NEON)
+  const uint8x16_t needle = vdupq_n_u8((uint8_t) c);
+  while (n >= 16) {
+    int chunks = n / 16 < 255 ? n / 16 : 255;
+    uint8x16_t acc = vdupq_n_u8(0);
+    for (int i = 0; i < chunks; i++, p += 16)
+      acc = vsubq_u8(acc, vceqq_u8(vld1q_u8((const uint8_t *) p), needle));
+    uint64x2_t sum = vpaddlq_u32(vpaddlq_u16(vpaddlq_u8(acc)));
+    count += (int) (vgetq_lane_u64(sum, 0) + vgetq_lane_u64(sum, 1));
+    n -= chunks * 16;
+  }
+#endif
+  for (; n > 0; n--)
+    if (*p++ == c)
+      count++;
+  return count;
+}
+
+/*
+ Find the last byte c in the n bytes at p, or return NULL. This is
+ memrchr(), which is not available everywhere.
+ */
+static const char *find_byte_backward(const char *p, int n, char c)
+{
+#if defined(__SSE2__)
+  const __m128i needle = _mm_set1_epi8(c);
+  for (; n >= 16; n -= 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *) (p + n - 16));
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, needle));
+    if (mask)
+      return p + n - 16 + (31 - __builtin_clz(mask));
+  }
+#endif
+  while (n > 0)
+    if (p[--n] == c)
+      return p + n;
+  return NULL;
+}
+
+
+/*
+ The line index divides the text into blocks of about LINE_INDEX_BLOCK
+ bytes and keeps the size and the number of newlines of each block in
+ Fenwick trees (binary indexed trees). The number of newlines before a
+ position and the position of the n-th newline are then found in
+ O(log n), plus a scan of a part of one block. Insertions enlarge a block
+ until it is split, removals shrink blocks, and empty blocks are dropped
+ when the trees are rebuilt.
+ */
+#define LINE_INDEX_BLOCK 16384
+
+// skip_lines() and rewind_lines() only use the index for this many lines
+// or more, below scanning the lines is faster than scanning in the blocks
+#define LINE_INDEX_MIN_LINES 256
+
+struct Fl_Text_Line_Index {
+  int count;            // number of blocks
+  int alloc;            // allocated blocks
+  int *size;            // bytes in each block
+  int *lines;           // newlines in each block
+  int *size_tree;       // Fenwick trees of size[] and lines[], 1-based
+  int *lines_tree;
+};
+
+// Adds delta to the value of block i.
+static void fenwick_add(int *tree, int count, int i, int delta)
+{
+  for (i++; i <= count; i += i & -i)
+    tree[i] += delta;
+}
+
+// Returns the sum of the values of the first n blocks.
+static int fenwick_sum(const int *tree, int n)
+{
+  int sum = 0;
+  for (; n > 0; n -= n & -n)
+    sum += tree[n];
+  return sum;
+}
+
+// Returns the largest number of first blocks whose values add up to at
+// most value, and their sum in sum.
+static int fenwick_find(const int *tree, int count, int value, int &sum)
+{
+  int n = 0, bit = 1;
+  sum = 0;
+  while (bit * 2 <= count)
+    bit *= 2;
+  for (; bit; bit /= 2) {
+    if (n + bit <= count && sum + tree[n + bit] <= value) {
+      n += bit;
+      sum += tree[n];
+    }
+  }
+  return n;
+}
+
+static void line_index_reserve(Fl_Text_Line_Index *index, int count)
+{
+  if (count <= index->alloc)
+    return;
+  int n = index->alloc ? 2 * index->alloc : 64;
+  while (n < count)
+    n *= 2;
+  index->size = (int *) realloc(index->size, n * sizeof(int));
+  index->lines = (int *) realloc(index->lines, n * sizeof(int));
+  index->size_tree = (int *) realloc(index->size_tree, (n + 1) * sizeof(int));
+  index->lines_tree = (int *) realloc(index->lines_tree, (n + 1) * sizeof(int));
+  index->alloc = n;
+}
+
+// Drops the empty blocks and rebuilds the trees in O(n).
+static void line_index_rebuild(Fl_Text_Line_Index *index)
+{
+  int n = 0;
+  for (int i = 0; i < index->count; i++) {
+    if (index->size[i]) {
+      index->size[n] = index->size[i];
+      index->lines[n] = index->lines[i];
+      n++;
+    }
+  }
+  index->count = n;
+  for (int i = 1; i <= n; i++) {
+    index->size_tree[i] = index->size[i - 1];
+    index->lines_tree[i] = index->lines[i - 1];
+  }
+  for (int i = 1; i <= n; i++) {
+    int j = i + (i & -i);
+    if (j <= n) {
+      index->size_tree[j] += index->size_tree[i];
+      index->lines_tree[j] += index->lines_tree[i];
+    }
+  }
+}
+
+void Fl_Text_Buffer::line_index(int enable)
+{
+  if (enable) {
+    if (!mLineIndex) {
+      mLineIndex = (Fl_Text_Line_Index *) calloc(1, sizeof(Fl_Text_Line_Index));
+      build_line_index_();
+    }
+  } else if (mLineIndex) {
+    free(mLineIndex->size);
+    free(mLineIndex->lines);
+    free(mLineIndex->size_tree);
+    free(mLineIndex->lines_tree);
+    free(mLineIndex);
+    mLineIndex = NULL;
+  }
+}
+
+void Fl_Text_Buffer::build_line_index_()
+{
+  Fl_Text_Line_Index *index = mLineIndex;
+  int n = (mLength + LINE_INDEX_BLOCK - 1) / LINE_INDEX_BLOCK;
+  line_index_reserve(index, n);
+  index->count = n;
+  for (int i = 0; i < n; i++) {
+    int start = i * LINE_INDEX_BLOCK;
+    int end = start + LINE_INDEX_BLOCK < mLength ? start + LINE_INDEX_BLOCK : mLength;
+    index->size[i] = end - start;
+    index->lines[i] = count_newlines_(start, end);
+  }
+  line_index_rebuild(index);
+}
+
+void Fl_Text_Buffer::line_index_inserted_(int pos, int len)
+{
+  Fl_Text_Line_Index *index = mLineIndex;
+  if (!index->count) {
+    build_line_index_();
+    return;
+  }
+  // the trees don't know about the new text yet
+  int start;
+  int i = fenwick_find(index->size_tree, index->count, pos, start);
+  if (i == index->count) { // append to the last block
+    i--;
+    start -= index->size[i];
+  }
+  int nl = count_newlines_(pos, pos + len);
+  index->size[i] += len;
+  index->lines[i] += nl;
+  if (index->size[i] <= 2 * LINE_INDEX_BLOCK) {
+    fenwick_add(index->size_tree, index->count, i, len);
+    fenwick_add(index->lines_tree, index->count, i, nl);
+    return;
+  }
+  // split the block
+  int size = index->size[i];
+  int n = (size + LINE_INDEX_BLOCK - 1) / LINE_INDEX_BLOCK;
+  line_index_reserve(index, index->count + n - 1);
+  memmove(index->size + i + n, index->size + i + 1, (index->count - i - 1) * sizeof(int));
+  memmove(index->lines + i + n, index->lines + i + 1, (index->count - i - 1) * sizeof(int));
+  index->count += n - 1;
+  for (int j = 0; j < n; j++) {
+    int begin = start + j * LINE_INDEX_BLOCK;
+    int end = (j == n - 1) ? start + size : begin + LINE_INDEX_BLOCK;
+    index->size[i + j] = end - begin;
+    index->lines[i + j] = count_newlines_(begin, end);
+  }
+  line_index_rebuild(index);
+}
+
+void Fl_Text_Buffer::line_index_removing_(int start, int end)
+{
+  Fl_Text_Line_Index *index = mLineIndex;
+  int begin;
+  int i = fenwick_find(index->size_tree, index->count, start, begin);
+  int first = i;
+  for (; i < index->count && begin < end; i++) {
+    int block_end = begin + index->size[i];
+    int from = start > begin ? start : begin;
+    int to = end < block_end ? end : block_end;
+    int nl = (from == begin && to == block_end) ? index->lines[i] : count_newlines_(from, to);
+    index->size[i] -= to - from;
+    index->lines[i] -= nl;
+    fenwick_add(index->size_tree, index->count, i, from - to);
+    fenwick_add(index->lines_tree, index->count, i, -nl);
+    begin = block_end;
+  }
+  // drop the blocks emptied by large removals
+  if (i - first > 4)
+    line_index_rebuild(index);
+}
+
+int Fl_Text_Buffer::line_index_count_(int pos) const
+{
+  Fl_Text_Line_Index *index = mLineIndex;
+  int start;
+  int i = fenwick_find(index->size_tree, index->count, pos, start);
+  if (i == index->count)
+    return fenwick_sum(index->lines_tree, i);
+  // scan the shorter part of the block
+  int end = start + index->size[i];
+  if (pos - start <= end - pos)
+    return fenwick_sum(index->lines_tree, i) + count_newlines_(start, pos);
+  return fenwick_sum(index->lines_tree, i + 1) - count_newlines_(pos, end);
+}
+
+int Fl_Text_Buffer::line_index_find_(int n) const
+{
+  Fl_Text_Line_Index *index = mLineIndex;
+  int before;
+  int i = fenwick_find(index->lines_tree, index->count, n - 1, before);
+  if (i == index->count)
+    return -1;
+  return find_newline_(fenwick_sum(index->size_tree, i), n - before);
+}
+
+/*
+ Join node i + 1 to node i if one of them is shorter than ROPE_NODE_MIN and
+ they fit in a single node. Return 1 if they were joined, the tree must then
+ be rebuilt.
+ */
+static int rope_join(Fl_Text_Rope *r, int i)
+{
+  if (i < 0 || i + 1 >= r->count)
+    return 0;
+  Fl_Text_Rope_Node *a = r->nodes + i, *b = a + 1;
+  if ((a->len >= ROPE_NODE_MIN && b->len >= ROPE_NODE_MIN)
+      || a->len + b->len > ROPE_NODE_MAX)
+    return 0;
+  if (!a->alloc) { // copy the borrowed text
+    char *t = (char *) malloc(a->len + b->len);
+    memcpy(t, a->text, a->len);
+    a->text = t;
+    a->alloc = a->len + b->len;
+  } else if (a->len + b->len > a->alloc) {
+    a->alloc = a->len + b->len;
+    a->text = (char *) realloc(a->text, a->alloc);
+  }
+  memcpy(a->text + a->len, b->text, b->len);
+  a->len += b->len;
+  b->len = 0;
+  return 1;
+}
+
+static void rope_insert(Fl_Text_Rope *r, int pos, const char *text, int len)
+{
+  r->last = 0;
+  int start;
+  int i = fenwick_find(r->tree, r->count, pos, start);
+  if (i == r->count) { // append to the last node
+    if (!i) {
+      rope_put(r, 0, text, len);
+      rope_rebuild(r);
+      return;
+    }
+    i--;
+    start -= r->nodes[i].len;
+  } else if (pos == start && i > 0 && r->nodes[i - 1].alloc
+             && r->nodes[i - 1].len + len <= ROPE_NODE_MAX) {
+    // text typed at the end of a node doesn't need to move it
+    i--;
+    start -= r->nodes[i].len;
+  }
+  Fl_Text_Rope_Node *node = r->nodes + i;
+  int off = pos - start;
+  if (!node->alloc) {
+    // cut the borrowed node around the new nodes
+    Fl_Text_Rope_Node tail = *node;
+    tail.text += off;
+    tail.len -= off;
+    node->len = off;
+    int n = rope_put(r, i + 1, text, len);
+    rope_reserve(r, r->count + 1);
+    memmove(r->nodes + i + n + 2, r->nodes + i + n + 1,
+            (r->count - i - n - 1) * sizeof(Fl_Text_Rope_Node));
+    r->nodes[i + n + 1] = tail;
+    r->count++;
+    rope_rebuild(r);
+    return;
+  }
+  if (node->len + len <= ROPE_NODE_MAX) {
+    if (node->len + len > node->alloc) {
+      node->alloc = min(max(2 * node->alloc, node->len + len), ROPE_NODE_MAX);
+      node->text = (char *) realloc(node->text, node->alloc);
+    }
+    memmove(node->text + off + len, node->text + off, node->len - off);
+    memcpy(node->text + off, text, len);
+    node->len += len;
+    fenwick_add(r->tree, r->count, i, len);
+    return;
+  }
+  // replace the node by new nodes with its text and the inserted text
+  int total = node->len + len;
+  char *t = (char *) malloc(total);
+  memcpy(t, node->text, off);
+  memcpy(t + off, text, len);
+  memcpy(t + off + len, node->text + off, node->len - off);
+  free(node->text);
+  memmove(node, node + 1, (r->count - i - 1) * sizeof(Fl_Text_Rope_Node));
+  r->count--;
+  rope_put(r, i, t, total);
+  free(t);
+  rope_rebuild(r);
+}
+
+static void rope_remove(Fl_Text_Rope *r, int start, int end)
+{
+  if (start >= end)
+    return;
+  r->last = 0;
+  int first;
+  int i = fenwick_find(r->tree, r->count, start, first);
+  Fl_Text_Rope_Node *node = r->nodes + i;
+  int off = start - first;
+  if (end - first <= node->len) { // inside a single node
+    if (node->alloc) {
+      memmove(node->text + off, node->text + end - first, node->len - (end - first));
+    } else if (off && end - first < node->len) {
+      // cut the borrowed node in two
+      rope_reserve(r, r->count + 1);
+      node = r->nodes + i;
+      memmove(node + 2, node + 1, (r->count - i - 1) * sizeof(Fl_Text_Rope_Node));
+      r->count++;
+      node[1].text = node->text + (end - first);
+      node[1].len = node->len - (end - first);
+      node[1].alloc = 0;
+      node->len = off;
+      rope_rebuild(r);
+      return;
+    } else if (!off) {
+      node->text += end - start;
+    }
+    node->len -= end - start;
+    if (node->len >= ROPE_NODE_MIN
+        || (!rope_join(r, i) && !rope_join(r, i - 1) && node->len)) {
+      fenwick_add(r->tree, r->count, i, start - end);
+      return;
+    }
+    rope_rebuild(r);
+    return;
+  }
+  // cut the end of the first node and the start of the following ones
+  int pos = first + node->len;
+  node->len = off;
+  for (int j = i + 1; pos < end; j++) {
+    node = r->nodes + j;
+    int n = min(node->len, end - pos);
+    if (node->alloc)
+      memmove(node->text, node->text + n, node->len - n);
+    else
+      node->text += n;
+    node->len -= n;
+    pos += n;
+  }
+  rope_rebuild(r);
+  i = fenwick_find(r->tree, r->count, start, first);
+  if (rope_join(r, i - 1) || rope_join(r, i))
+    rope_rebuild(r);
+}
+
+void Fl_Text_Buffer::storage(int engine)
+{
+  if (engine == storage())
+    return;
+  if (engine == ROPE) {
+    Fl_Text_Rope *r = (Fl_Text_Rope *) calloc(1, sizeof(Fl_Text_Rope));
+    rope_put(r, 0, mBuf, mGapStart);
+    int n = r->count;
+    rope_put(r, n, mBuf + mGapEnd, mLength - mGapStart);
+    rope_join(r, n - 1);
+    rope_rebuild(r);
+    free(mBuf);
+    mBuf = (char *) malloc(mPreferredGapSize);
+    mGapStart = 0;
+    mGapEnd = mPreferredGapSize;
+    mRope = r;
+  } else {
+    char *t = (char *) malloc(mLength + mPreferredGapSize);
+    copy_out_(t, 0, mLength);
+    free(mBuf);
+    mBuf = t;
+    mGapStart = mLength;
+    mGapEnd = mLength + mPreferredGapSize;
+    rope_clear(mRope);
+    free(mRope);
+    mRope = NULL;
+  }
+}
+
+const char *Fl_Text_Buffer::rope_address_(int pos) const
+{
+  Fl_Text_Rope *r = mRope;
+#if ROPE_LAST
+  // text is mostly read in sequence, try the node of the previous call first
+  unsigned long long last = rope_last_load(&r->last);
+  int k = (int) (last & 0xffffffffU);
+  if (k < r->count) {
+    unsigned off = (unsigned) (pos - (int) (last >> 32));
+    if (off < (unsigned) r->nodes[k].len)
+      return r->nodes[k].text + off;
+  }
+#endif
+  int start;
+  int i = fenwick_find(r->tree, r->count, pos, start);
+  if (i == r->count) { // the end of the text
+    if (!i)
+      return "";
+    i--;
+    start -= r->nodes[i].len;
+  }
+#if ROPE_LAST
+  rope_last_store(&r->last, ((unsigned long long) start << 32) | (unsigned) i);
+#endif
+  return r->nodes[i].text + (pos - start);
+}
+
+int Fl_Text_Buffer::segment_(int pos, const char **p) const
+{
+  if (!mRope) {
+    if (pos < mGapStart) {
+      *p = mBuf + pos;
+      return mGapStart - pos;
+    }
+    *p = mBuf + (mGapEnd - mGapStart) + pos;
+    return mLength - pos;
+  }
+  int start;
+  int i = fenwick_find(mRope->tree, mRope->count, pos, start);
+  if (i == mRope->count) {
+    *p = rope_address_(pos);
+    return 0;
+  }
+  *p = mRope->nodes[i].text + (pos - start);
+  return mRope->nodes[i].len - (pos - start);
+}
+
+int Fl_Text_Buffer::segment_before_(int pos, const char **p) const
+{
+  if (!mRope) {
+    if (pos > mGapStart) {
+      *p = mBuf + mGapEnd;
+      return pos - mGapStart;
+    }
+    *p = mBuf;
+    return pos;
+  }
+  if (pos <= 0) {
+    *p = rope_address_(0);
+    return 0;
+  }
+  int start;
+  int i = fenwick_find(mRope->tree, mRope->count, pos - 1, start);
+  *p = mRope->nodes[i].text;
+  return pos - start;
+}
+
+void Fl_Text_Buffer::copy_out_(char *dst, int start, int end) const
+{
+  while (start < end) {
+    const char *p;
+    int len = min(segment_(start, &p), end - start);
+    memcpy(dst, p, len);
+    dst += len;
+    start += len;
+  }
+}
+
+/*
+ Count the newlines between start and end, one contiguous segment at a time.
+ */
+int Fl_Text_Buffer::count_newlines_(int start, int end) const
+{
+  int count = 0;
+  while (start < end) {
+    const char *p;
+    int len = min(segment_(start, &p), end - start);
+    count += count_byte(p, len, '\n');
+    start += len;
+  }
+  return count;
+}
+
+/*
+ Find the n-th newline at or after start.
+ */
+int Fl_Text_Buffer::find_newline_(int start, int n) const
+{
+  int pos = start;
+  while (pos < mLength) {
+    const char *p;
+    int len = segment_(pos, &p);
+    const char *nl = (const char *) memchr(p, '\n', len);
+    if (!nl) {
+      pos += len;
+      continue;
+    }
+    pos += (int) (nl - p);
+    if (--n == 0)
+      return pos;
+    pos++;
+  }
+  return -1;
+}
+
+/*
+ Find the n-th newline before end, searching backwards.
+ */
+int Fl_Text_Buffer::rfind_newline_(int end, int n) const
+{
+  int pos = end;
+  while (pos > 0) {
+    const char *p;
+    int len = segment_before_(pos, &p);
+    const char *nl = find_byte_backward(p, len, '\n');
+    pos -= len;
+    if (!nl)
+      continue;
+    pos += (int) (nl - p);
+    if (--n == 0)
+      return pos;
+  }
+  return -1;
+}
+
+
 /*
  Count the number of newline characters between start and end.
  startPos and endPos must be at a character boundary.
@@ -958,24 +2124,15 @@ int Fl_Text_Buffer::count_lines(int startPos, int endPos) const {
   IS_UTF8_ALIGNED2(this, (startPos))
   IS_UTF8_ALIGNED2(this, (endPos))
   
-  int gapLen = mGapEnd - mGapStart;
-  int lineCount = 0;
-  
-  int pos = startPos;
-  while (pos < mGapStart)
-  {
-    if (pos == endPos)
-      return lineCount;
-    if (mBuf[pos++] == '\n')
-      lineCount++;
-  } 
-  while (pos < mLength) {
-    if (pos == endPos)
-      return lineCount;
-    if (mBuf[pos++ + gapLen] == '\n')
-      lineCount++;
-  }
-  return lineCount;
+  if (endPos < startPos || endPos > mLength)
+    endPos = mLength;
+  if (startPos < 0)
+    startPos = 0;
+  if (startPos >= endPos)
+    return 0;
+  if (mLineIndex && endPos - startPos > 2 * LINE_INDEX_BLOCK)
+    return line_index_count_(endPos) - line_index_count_(startPos);
+  return count_newlines_(startPos, endPos);
 }
 
 
@@ -988,32 +2145,18 @@ int Fl_Text_Buffer::skip_lines(int startPos, int nLines)
 {
   IS_UTF8_ALIGNED2(this, (startPos))
   
-  if (nLines == 0)
+  if (nLines <= 0)
     return startPos;
+  if (startPos < 0)
+    startPos = 0;
   
-  int gapLen = mGapEnd - mGapStart;
-  int pos = startPos;
-  int lineCount = 0;
-  while (pos < mGapStart) {
-    if (mBuf[pos++] == '\n') {
-      lineCount++;
-      if (lineCount == nLines) {
-        IS_UTF8_ALIGNED2(this, (pos))
-	return pos;
-      }
-    }
-  }
-  while (pos < mLength) {
-    if (mBuf[pos++ + gapLen] == '\n') {
-      lineCount++;
-      if (lineCount >= nLines) {
-        IS_UTF8_ALIGNED2(this, (pos))
-	return pos;
-      }
-    }
-  }
-  IS_UTF8_ALIGNED2(this, (pos))
-  return pos;
+  int pos;
+  if (mLineIndex && nLines >= LINE_INDEX_MIN_LINES)
+    pos = line_index_find_(line_index_count_(startPos) + nLines);
+  else
+    pos = find_newline_(startPos, nLines);
+  IS_UTF8_ALIGNED2(this, (pos < 0 ? mLength : pos + 1))
+  return pos < 0 ? mLength : pos + 1;
 }
 
 
@@ -1026,36 +2169,27 @@ int Fl_Text_Buffer::rewind_lines(int startPos, int nLines)
 {
   IS_UTF8_ALIGNED2(this, (startPos))
   
-  int pos = startPos - 1;
-  if (pos <= 0)
+  if (startPos - 1 <= 0)
     return 0;
+  if (startPos > mLength)
+    startPos = mLength;
+  if (nLines < 0)
+    nLines = 0;
   
-  int gapLen = mGapEnd - mGapStart;
-  int lineCount = -1;
-  while (pos >= mGapStart) {
-    if (mBuf[pos + gapLen] == '\n') {
-      if (++lineCount >= nLines) {
-        IS_UTF8_ALIGNED2(this, (pos+1))
-	return pos + 1;
-      }
-    }
-    pos--;
-  }
-  while (pos >= 0) {
-    if (mBuf[pos] == '\n') {
-      if (++lineCount >= nLines) {
-        IS_UTF8_ALIGNED2(this, (pos+1))
-	return pos + 1;
-      }
-    }
-    pos--;
+  int pos;
+  if (mLineIndex && nLines >= LINE_INDEX_MIN_LINES) {
+    int n = line_index_count_(startPos) - nLines;
+    pos = n < 1 ? -1 : line_index_find_(n);
+  } else {
+    pos = rfind_newline_(startPos, nLines + 1);
   }
-  return 0;
+  IS_UTF8_ALIGNED2(this, (pos + 1))
+  return pos + 1;
 }
 
 
 /*
- Find a matching string in the buffer.
+ Find a matching string in the buffer, see search().
  */
 int Fl_Text_Buffer::search_forward(int startPos, const char *searchString,
 				   int *foundPos, int matchCase) const 
@@ -1063,50 +2197,9 @@ int Fl_Text_Buffer::search_forward(int startPos, const char *searchString,
   IS_UTF8_ALIGNED2(this, (startPos))
   IS_UTF8_ALIGNED(searchString)
   
-  if (!searchString)
+  if (startPos >= length())
     return 0;
-  int bp;
-  const char *sp;
-  if (matchCase) {
-    while (startPos < length()) {
-      bp = startPos;
-      sp = searchString;
-      for (;;) {
-        char c = *sp;
-        // we reached the end of the "needle", so we found the string!
-        if (!c) {
-          *foundPos = startPos;
-          return 1;
-        }
-        int l = fl_utf8len1(c);
-        if (memcmp(sp, address(bp), l))
-          break;
-        sp += l; bp += l;
-      }
-      startPos = next_char(startPos);
-    }
-  } else {
-    while (startPos < length()) {
-      bp = startPos;
-      sp = searchString;
-      for (;;) {
-        // we reached the end of the "needle", so we found the string!
-        if (!*sp) {
-          *foundPos = startPos;
-          return 1;
-        }
-        int l;
-        unsigned int b = char_at(bp);
-        unsigned int s = fl_utf8decode(sp, 0, &l);
-        if (fl_tolower(b)!=fl_tolower(s))
-          break;
-        sp += l; 
-        bp = next_char(bp);
-      }
-      startPos = next_char(startPos);
-    }
-  }  
-  return 0;
+  return search(startPos, searchString, matchCase ? SEARCH_MATCH_CASE : 0, foundPos);
 }
 
 int Fl_Text_Buffer::search_backward(int startPos, const char *searchString,
@@ -1115,50 +2208,10 @@ int Fl_Text_Buffer::search_backward(int startPos, const char *searchString,
   IS_UTF8_ALIGNED2(this, (startPos))
   IS_UTF8_ALIGNED(searchString)
   
-  if (!searchString)
+  if (startPos < 0)
     return 0;
-  int bp;
-  const char *sp;
-  if (matchCase) {
-    while (startPos >= 0) {
-      bp = startPos;
-      sp = searchString;
-      for (;;) {
-        char c = *sp;
-        // we reached the end of the "needle", so we found the string!
-        if (!c) {
-          *foundPos = startPos;
-          return 1;
-        }
-        int l = fl_utf8len1(c);
-        if (memcmp(sp, address(bp), l))
-          break;
-        sp += l; bp += l;
-      }
-      startPos = prev_char(startPos);
-    }
-  } else {
-    while (startPos >= 0) {
-      bp = startPos;
-      sp = searchString;
-      for (;;) {
-        // we reached the end of the "needle", so we found the string!
-        if (!*sp) {
-          *foundPos = startPos;
-          return 1;
-        }
-        int l;
-        unsigned int b = char_at(bp);
-        unsigned int s = fl_utf8decode(sp, 0, &l);
-        if (fl_tolower(b)!=fl_tolower(s))
-          break;
-        sp += l; 
-        bp = next_char(bp);
-      }
-      startPos = prev_char(startPos);
-    }
-  }  
-  return 0;
+  return search(startPos, searchString,
+                SEARCH_BACKWARD | (matchCase ? SEARCH_MATCH_CASE : 0), foundPos);
 }
 
 
@@ -1174,33 +2227,30 @@ int Fl_Text_Buffer::insert_(int pos, const char *text)
   
   int insertedLength = (int) strlen(text);
   
-  /* Prepare the buffer to receive the new text.  If the new text fits in
-   the current buffer, just move the gap (if necessary) to where
-   the text should be inserted.  If the new text is too large, reallocate
-   the buffer with a gap large enough to accomodate the new text and a
-   gap of mPreferredGapSize */
-  if (insertedLength > mGapEnd - mGapStart)
-    reallocate_with_gap(pos, insertedLength + mPreferredGapSize);
-  else if (pos != mGapStart)
-    move_gap(pos);
-  
-  /* Insert the new text (pos now corresponds to the start of the gap) */
-  memcpy(&mBuf[pos], text, insertedLength);
-  mGapStart += insertedLength;
+  if (mRope) {
+    rope_insert(mRope, pos, text, insertedLength);
+  } else {
+    /* Prepare the buffer to receive the new text.  If the new text fits in
+     the current buffer, just move the gap (if necessary) to where
+     the text should be inserted.  If the new text is too large, reallocate
+     the buffer with a gap large enough to accomodate the new text and a
+     gap of mPreferredGapSize */
+    if (insertedLength > mGapEnd - mGapStart)
+      reallocate_with_gap(pos, insertedLength + mPreferredGapSize);
+    else if (pos != mGapStart)
+      move_gap(pos);
+    
+    /* Insert the new text (pos now corresponds to the start of the gap) */
+    memcpy(&mBuf[pos], text, insertedLength);
+    mGapStart += insertedLength;
+  }
   mLength += insertedLength;
+  if (mLineIndex)
+    line_index_inserted_(pos, insertedLength);
   update_selections(pos, 0, insertedLength);
   
-  if (mCanUndo) {
-    if (undowidget == this && undoat == pos && undoinsert) {
-      undoinsert += insertedLength;
-    } else {
-      undoinsert = insertedLength;
-      undoyankcut = (undoat == pos) ? undocut : 0;
-    }
-    undoat = pos + insertedLength;
-    undocut = 0;
-    undowidget = this;
-  }
+  if (mCanUndo)
+    undo_inserted_(pos, insertedLength);
   
   return insertedLength;
 }
@@ -1212,44 +2262,26 @@ int Fl_Text_Buffer::insert_(int pos, const char *text)
  */
 void Fl_Text_Buffer::remove_(int start, int end)
 {
-  /* if the gap is not contiguous to the area to remove, move it there */
-  
-  if (mCanUndo) {
-    if (undowidget == this && undoat == end && undocut) {
-      undobuffersize(undocut + end - start + 1);
-      memmove(undobuffer + end - start, undobuffer, undocut);
-      undocut += end - start;
-    } else {
-      undocut = end - start;
-      undobuffersize(undocut);
-    }
-    undoat = start;
-    undoinsert = 0;
-    undoyankcut = 0;
-    undowidget = this;
-  }
-  
-  if (start > mGapStart) {
-    if (mCanUndo)
-      memcpy(undobuffer, mBuf + (mGapEnd - mGapStart) + start,
-	     end - start);
-    move_gap(start);
-  } else if (end < mGapStart) {
-    if (mCanUndo)
-      memcpy(undobuffer, mBuf + start, end - start);
-    move_gap(end);
+  if (mLineIndex)
+    line_index_removing_(start, end);
+  if (mCanUndo)
+    undo_removing_(start, end);
+
+  if (mRope) {
+    rope_remove(mRope, start, end);
   } else {
-    int prelen = mGapStart - start;
-    if (mCanUndo) {
-      memcpy(undobuffer, mBuf + start, prelen);
-      memcpy(undobuffer + prelen, mBuf + mGapEnd, end - start - prelen);
-    }
+    /* if the gap is not contiguous to the area to remove, move it there */
+    
+    if (start > mGapStart)
+      move_gap(start);
+    else if (end < mGapStart)
+      move_gap(end);
+    
+    /* expand the gap to encompass the deleted characters */
+    mGapEnd += end - mGapStart;
+    mGapStart = start;
   }
   
-  /* expand the gap to encompass the deleted characters */
-  mGapEnd += end - mGapStart;
-  mGapStart = start;
-  
   /* update the length */
   mLength -= end - start;
   
@@ -1354,7 +2386,6 @@ void Fl_Text_Buffer::remove_selection_(Fl_Text_Selection * sel)
   if (!sel->position(&start, &end))
     return;
   remove(start, end);
-  //undoyankcut = undocut;
 }
 
 
@@ -1390,6 +2421,50 @@ void Fl_Text_Buffer::call_modify_callbacks(int pos, int nDeleted,
 					   int nInserted, int nRestyled,
 					   const char *deletedText) const {
   IS_UTF8_ALIGNED2(this, pos)
+  Fl_Text_Batch *b = mBatch;
+  if (b && b->depth) {
+    int changed = nDeleted || nInserted;
+    if (!changed && !nRestyled)
+      return;
+    if (b->start < 0)
+      b->start = b->end = b->old_end = pos;
+    // extend the range of the batch by the part of this change outside it
+    int head = max(0, b->start - pos);
+    int tail = max(0, pos + (changed ? nDeleted : nRestyled) - b->end);
+    int len = b->old_end - b->start;
+    if (len + head + tail > b->alloc) {
+      b->alloc = 2 * (len + head + tail) + 256;
+      b->text = (char *) realloc(b->text, b->alloc);
+    }
+    if (!changed)
+      pos = 0;
+    if (head)
+      memmove(b->text + head, b->text, len);
+    for (int k = 0; k < 2; k++) {
+      // copy the text that was between from and to before this change
+      int from = k ? b->end : b->start - head, to = k ? b->end + tail : b->start;
+      char *dst = k ? b->text + head + len : b->text;
+      int e = pos + nDeleted, n;
+      if (from < pos) {
+        n = min(to, pos) - from;
+        copy_out_(dst, from, from + n);
+        dst += n;
+        from += n;
+      }
+      if (from < e && from < to) {
+        n = min(to, e) - from;
+        memcpy(dst, deletedText + from - pos, n);
+        dst += n;
+        from += n;
+      }
+      if (from < to)
+        copy_out_(dst, from + nInserted - nDeleted, to + nInserted - nDeleted);
+    }
+    b->start -= head;
+    b->old_end += tail;
+    b->end += tail + nInserted - nDeleted;
+    return;
+  }
   for (int i = 0; i < mNModifyProcs; i++)
     (*mModifyProcs[i]) (pos, nInserted, nDeleted, nRestyled,
 			deletedText, mCbArgs[i]);
@@ -1401,11 +2476,78 @@ void Fl_Text_Buffer::call_modify_callbacks(int pos, int nDeleted,
  Unicode safe.
  */
 void Fl_Text_Buffer::call_predelete_callbacks(int pos, int nDeleted) const {
+  if (mBatch && mBatch->depth)
+    return;
   for (int i = 0; i < mNPredeleteProcs; i++)
     (*mPredeleteProcs[i]) (pos, nDeleted, mPredeleteCbArgs[i]);
 } 
 
 
+/**
+ Starts a batch of modifications that are notified and undone together.
+
+ Until the matching end_batch(), the modify callbacks are not called for
+ each insertion, removal or change of the selections. end_batch() calls
+ them once for the smallest range of text that contains all the changes,
+ so that a widget that displays the buffer lays out and redraws its text
+ only once for an operation that does many small edits, like indenting a
+ block of lines or replacing all the matches of a search. The pre-delete
+ callbacks are not called for the changes of a batch. The widgets that
+ display the buffer are out of date until end_batch(), so their cursor
+ should not be moved in between.
+
+ All the changes of the batch are also undone and redone together by a
+ single call of undo() or redo().
+
+ Batches can be nested, only the outermost end_batch() calls the modify
+ callbacks.
+ \see end_batch()
+ \version 1.4.0
+ */
+void Fl_Text_Buffer::begin_batch()
+{
+  if (!mBatch)
+    mBatch = (Fl_Text_Batch *) calloc(1, sizeof(Fl_Text_Batch));
+  if (mBatch->depth++)
+    return;
+  mBatch->start = -1;
+  if (mCanUndo) {
+    if (!mUndo)
+      mUndo = (Fl_Text_Undo *) calloc(1, sizeof(Fl_Text_Undo));
+    mUndo->batch = 1;
+    mUndo->open = 0;
+  }
+}
+
+
+/**
+ Ends a batch of modifications started by begin_batch().
+ The modify callbacks are called once for all the changes of the batch.
+ \version 1.4.0
+ */
+void Fl_Text_Buffer::end_batch()
+{
+  Fl_Text_Batch *b = mBatch;
+  if (!b || !b->depth || --b->depth)
+    return;
+  if (mUndo) {
+    mUndo->batch = 0;
+    mUndo->open = 0;
+  }
+  if (b->start < 0)
+    return;
+  // the callbacks may start a new batch
+  int start = b->start, nDeleted = b->old_end - b->start;
+  char *deletedText = (char *) malloc(nDeleted + 1);
+  if (nDeleted)
+    memcpy(deletedText, b->text, nDeleted);
+  deletedText[nDeleted] = '\0';
+  b->start = -1;
+  call_modify_callbacks(start, nDeleted, b->end - start, 0, deletedText);
+  free(deletedText);
+}
+
+
 /*
  Redisplay a new selected area.
  Unicode safe.
@@ -1569,6 +2711,22 @@ int Fl_Text_Buffer::findchar_forward(int startPos, unsigned searchChar,
   if (startPos<0)
     startPos = 0;
   
+  if (searchChar < 0x80) {
+    // ASCII bytes are never part of a multibyte UTF-8 character
+    while (startPos < mLength) {
+      const char *p;
+      int len = segment_(startPos, &p);
+      const char *c = (const char *) memchr(p, searchChar, len);
+      if (c) {
+        *foundPos = startPos + (int) (c - p);
+        return 1;
+      }
+      startPos += len;
+    }
+    *foundPos = mLength;
+    return 0;
+  }
+  
   for ( ; startPos<mLength; startPos = next_char(startPos)) {
     if (searchChar == char_at(startPos)) {
       *foundPos = startPos;
@@ -1595,6 +2753,22 @@ int Fl_Text_Buffer::findchar_backward(int startPos, unsigned int searchChar,
   if (startPos > mLength)
     startPos = mLength;
   
+  if (searchChar < 0x80) {
+    // ASCII bytes are never part of a multibyte UTF-8 character
+    while (startPos > 0) {
+      const char *p;
+      int len = segment_before_(startPos, &p);
+      const char *c = find_byte_backward(p, len, searchChar);
+      startPos -= len;
+      if (c) {
+        *foundPos = startPos + (int) (c - p);
+        return 1;
+      }
+    }
+    *foundPos = 0;
+    return 0;
+  }
+  
   for (startPos = prev_char(startPos); startPos>=0; startPos = prev_char(startPos)) {
     if (searchChar == char_at(startPos)) {
       *foundPos = startPos;
@@ -1766,6 +2940,12 @@ const char *Fl_Text_Buffer::file_encoding_warning_message =
   FILE *fp;
   if (!(fp = fl_fopen(file, "r")))
     return 1;
+  // make room for the whole file at once, instead of growing the gap
+  // for each block that is read
+  struct stat st;
+  if (!mRope && fl_stat(file, &st) == 0 && st.st_size > mGapEnd - mGapStart
+      && st.st_size < INT_MAX - mLength)
+    reallocate_with_gap(pos, (int) st.st_size + mPreferredGapSize);
   char *buffer = new char[buflen + 1];  
   char *endline, line[100];
   int l;
@@ -1798,6 +2978,64 @@ const char *Fl_Text_Buffer::file_encoding_warning_message =
 }
 
 
+/**
+ Loads a text file into the buffer without reading it, by mapping it in
+ memory.
+
+ The text of the file is read by the operating system when it is
+ accessed, and only the text that is edited afterwards takes memory in the
+ buffer; the file itself is never written. This makes opening and viewing
+ very large files, e.g. logs of several hundreds of megabytes, fast and
+ cheap. The buffer uses ROPE storage afterwards, see storage(int), and the
+ file stays mapped until the text of the buffer is replaced, the storage
+ is changed to GAP_BUFFER, the buffer is destroyed, or it is saved to the
+ same file.
+
+ The file must be UTF-8 encoded, it is not transcoded like with
+ loadfile(), and the text must not be modified through address(). The file
+ must not be truncated by another program while it is mapped. The undo
+ history is cleared. Where files can't be mapped, or if the file is empty
+ or larger than 2 GB, the file is loaded with loadfile() instead.
+ \param file UTF-8 encoded name of the file
+ \return 0 on success, or the value returned by loadfile()
+ \version 1.4.0
+ */
+int Fl_Text_Buffer::mapfile(const char *file)
+{
+  struct stat st;
+  size_t size = 0;
+  void *map = NULL;
+  if (fl_stat(file, &st) == 0)
+    map = Fl::system_driver()->map_file(file, &size);
+  if (map && size >= INT_MAX) {
+    Fl::system_driver()->unmap_file(map, size);
+    map = NULL;
+  }
+  if (!map)
+    return loadfile(file);
+  
+  text("");
+  storage(ROPE);
+  Fl_Text_Rope *r = mRope;
+  rope_borrow(r, (char *) map, (int) size);
+  rope_rebuild(r);
+  r->map = map;
+  r->map_size = size;
+  r->map_stat = st;
+  if (!st.st_ino) {
+    char path[FL_PATH_MAX];
+    fl_filename_absolute(path, sizeof(path), file);
+    r->map_path = strdup(path);
+  }
+  mLength = (int) size;
+  if (mLineIndex)
+    build_line_index_();
+  input_file_was_transcoded = 0;
+  call_modify_callbacks(0, 0, mLength, 0, NULL);
+  return 0;
+}
+
+
 /*
  Write text to file.
  Unicode safe.
@@ -1806,6 +3044,9 @@ int Fl_Text_Buffer::outputfile(const char *file,
 			       int start, int end,
 			       int buflen) {
   FILE *fp;
+  // writing the mapped file would truncate the text we are writing
+  if (mRope && rope_is_mapped(mRope, file))
+    rope_unmap(mRope);
   if (!(fp = fl_fopen(file, "w")))
     return 1;
   for (int n; (n = min(end - start, buflen)); start += n) {
@@ -0,0 +1,694 @@
+//
+// "$Id$"
+//
+// Text search for the Fast Light Tool Kit (FLTK).
+//
+// Copyright 2001-2018 by Bill Spitzak and others.
+//
+// This library is free software. Distribution and use rights are outlined in
+// the file "COPYING" which should have been included with this file.  If this
+// file is missing or damaged, see the license at:
+//
+//     http://www.fltk.org/COPYING.php
+//
+// Please report all bugs and problems on the following page:
+//
+//     http://www.fltk.org/str.php
+//
+
+#include <stdlib.h>
+#include <limits.h>
+#include <FL/fl_utf8.h>
+#include "flstring.h"
+#include <FL/Fl_Text_Buffer.H>
+
+
+#ifndef min
+
+static int max(int i1, int i2)
+{
+  return i1 >= i2 ? i1 : i2;
+}
+
+static int min(int i1, int i2)
+{
+  return i1 <= i2 ? i1 : i2;
+}
+
+#endif
+
+/*
+ Literal patterns are searched with the Boyer-Moore-Horspool algorithm,
+ which skips up to the length of the pattern for each comparison, in each
+ contiguous segment of the text and in a small window around the end of
+ each segment.
+
+ When the case is ignored, the text and the pattern are compared through
+ a table of byte classes: ASCII bytes are mapped to lower case, lead bytes
+ of multibyte characters to their length and continuation bytes to 0x80.
+ fl_tolower() never changes the length of a character, so every match has
+ the classes of the pattern, and each candidate only needs to be checked
+ character by character.
+
+ Regular expressions are matched by backtracking, from the positions where
+ their literal prefix is found if they have one. They are made of:
+   c        a character; \c quotes a special character
+   .        any character but a newline
+   [...]    a character of a set, with ranges like a-z; [^...] negates it
+   \d \w \s a digit, a word character (letter, digit, underscore or
+            non-ASCII character), a white space; \D \W \S negate them
+   \n \t    a newline, a tab
+   ^ $      the start and the end of a line
+   * + ?    repeat the previous item 0 or more, 1 or more, 0 or 1 times
+   a|b      either a or b, for whole expressions
+ */
+
+enum {
+  RE_CHAR, RE_ANY, RE_CLASS, RE_NCLASS, RE_BOL, RE_EOL, RE_ALT, RE_END
+};
+
+enum { RE_ONE, RE_STAR, RE_PLUS, RE_QUEST };
+
+struct Fl_Text_Regex_Atom {
+  int type;
+  int quant;
+  unsigned c;                     // RE_CHAR, folded if the case is ignored
+  int first, count;               // RE_CLASS and RE_NCLASS ranges
+};
+
+struct Fl_Text_Pattern {
+  int fold;                       // ignore the case
+  // literal pattern
+  unsigned char *key;             // the pattern bytes, or their classes
+  int len;
+  unsigned char map[256];         // the class of each byte of the text
+  int shift[256];                 // Horspool shifts for forward searches
+  int rshift[256];                // and for backward searches
+  unsigned *chars;                // folded characters of the pattern
+  int nchars;
+  // regular expression
+  Fl_Text_Regex_Atom *atoms;
+  int natoms, nalts;
+  unsigned *ranges;               // pairs of first and last character
+  int nranges;
+  Fl_Text_Pattern *prefix;        // literal start of all matches, or NULL
+  int bol;                        // all matches start at the start of a line
+};
+
+static void pattern_free(Fl_Text_Pattern *p)
+{
+  free(p->key);
+  free(p->chars);
+  free(p->atoms);
+  free(p->ranges);
+  if (p->prefix) {
+    pattern_free(p->prefix);
+    free(p->prefix);
+  }
+}
+
+static void literal_compile(Fl_Text_Pattern *p, const char *text, int len, int fold)
+{
+  memset(p, 0, sizeof(Fl_Text_Pattern));
+  p->fold = fold;
+  for (int b = 0; b < 256; b++) {
+    if (!fold)
+      p->map[b] = (unsigned char) b;
+    else if (b < 0x80)
+      p->map[b] = (unsigned char) fl_tolower(b);
+    else if ((b & 0xC0) == 0x80)
+      p->map[b] = 0x80;
+    else
+      p->map[b] = b < 0xE0 ? 0xC0 : b < 0xF0 ? 0xE0 : 0xF0;
+  }
+  p->len = len;
+  p->key = (unsigned char *) malloc(len + 1);
+  for (int i = 0; i < len; i++)
+    p->key[i] = p->map[(unsigned char) text[i]];
+  for (int b = 0; b < 256; b++)
+    p->shift[b] = p->rshift[b] = len;
+  for (int i = 0; i < len - 1; i++)
+    p->shift[p->key[i]] = len - 1 - i;
+  for (int i = len - 1; i > 0; i--)
+    p->rshift[p->key[i]] = i;
+  if (fold) {
+    p->chars = (unsigned *) malloc((len + 1) * sizeof(unsigned));
+    for (int i = 0; i < len; ) {
+      int l;
+      p->chars[p->nchars++] = fl_tolower(fl_utf8decode(text + i, text + len, &l));
+      i += l > 0 ? l : 1;
+    }
+  }
+}
+
+/*
+ Return non-zero if the len bytes at s are the folded characters of p.
+ */
+static int literal_verify(const Fl_Text_Pattern *p, const char *s)
+{
+  if (!p->fold)
+    return 1;
+  const char *e = s + p->len;
+  for (int i = 0; i < p->nchars; i++) {
+    int l;
+    if ((unsigned) fl_tolower(fl_utf8decode(s, e, &l)) != p->chars[i])
+      return 0;
+    s += l > 0 ? l : 1;
+  }
+  return 1;
+}
+
+/*
+ Return the offset of the first match of p in the n bytes at s, or -1.
+ */
+static int horspool(const Fl_Text_Pattern *p, const char *s, int n)
+{
+  const unsigned char *t = (const unsigned char *) s;
+  int m = p->len;
+  if (m == 1) {
+    // the shifts are all 1, a plain scan is faster
+    if (!p->fold) {
+      const void *f = memchr(s, p->key[0], n);
+      return f ? (int) ((const char *) f - s) : -1;
+    }
+    for (int i = 0; i < n; i++)
+      if (p->map[t[i]] == p->key[0] && literal_verify(p, s + i))
+        return i;
+    return -1;
+  }
+  for (int i = 0; i <= n - m; ) {
+    unsigned char last = p->map[t[i + m - 1]];
+    if (last == p->key[m - 1]) {
+      int j = m - 2;
+      while (j >= 0 && p->map[t[i + j]] == p->key[j])
+        j--;
+      if (j < 0 && literal_verify(p, s + i))
+        return i;
+    }
+    i += p->shift[last];
+  }
+  return -1;
+}
+
+/*
+ Return the offset of the last match of p in the n bytes at s, or -1.
+ */
+static int rhorspool(const Fl_Text_Pattern *p, const char *s, int n)
+{
+  const unsigned char *t = (const unsigned char *) s;
+  int m = p->len;
+  if (m == 1) {
+    for (int i = n - 1; i >= 0; i--)
+      if (p->map[t[i]] == p->key[0] && literal_verify(p, s + i))
+        return i;
+    return -1;
+  }
+  for (int i = n - m; i >= 0; ) {
+    unsigned char first = p->map[t[i]];
+    if (first == p->key[0]) {
+      int j = 1;
+      while (j < m && p->map[t[i + j]] == p->key[j])
+        j++;
+      if (j == m && literal_verify(p, s + i))
+        return i;
+    }
+    i -= p->rshift[first];
+  }
+  return -1;
+}
+
+/*
+ Parse a character of a regular expression, with its escape sequence.
+ Return its length, and set c to the character and esc to the escaped
+ character if it is an escape sequence.
+ */
+static int regex_char(const char *s, unsigned &c, int &esc)
+{
+  int l;
+  esc = 0;
+  if (*s == '\\' && s[1]) {
+    esc = 1;
+    s++;
+  }
+  c = fl_utf8decode(s, 0, &l);
+  if (l < 1)
+    l = 1;
+  if (esc) {
+    if (c == 'n')
+      c = '\n';
+    else if (c == 't')
+      c = '\t';
+    else if (c != 'd' && c != 'w' && c != 's' && c != 'D' && c != 'W' && c != 'S')
+      esc = 0; // a quoted character
+  }
+  return l + esc;
+}
+
+static void regex_range(Fl_Text_Pattern *p, unsigned first, unsigned last)
+{
+  if (!(p->nranges & 15))
+    p->ranges = (unsigned *) realloc(p->ranges, (p->nranges + 16) * 2 * sizeof(unsigned));
+  p->ranges[2 * p->nranges] = first;
+  p->ranges[2 * p->nranges + 1] = last;
+  p->nranges++;
+}
+
+/*
+ Add the ranges of the class \d, \w or \s (in lower case).
+ */
+static void regex_escape_class(Fl_Text_Pattern *p, unsigned c)
+{
+  if (c == 'd') {
+    regex_range(p, '0', '9');
+  } else if (c == 'w') {
+    regex_range(p, '0', '9');
+    regex_range(p, 'A', 'Z');
+    regex_range(p, '_', '_');
+    regex_range(p, 'a', 'z');
+    regex_range(p, 0x80, 0x10FFFF);
+  } else {
+    regex_range(p, '\t', '\r');
+    regex_range(p, ' ', ' ');
+  }
+}
+
+static Fl_Text_Regex_Atom *regex_add(Fl_Text_Pattern *p, int type)
+{
+  if (!(p->natoms & 15))
+    p->atoms = (Fl_Text_Regex_Atom *) realloc(p->atoms, (p->natoms + 16) * sizeof(Fl_Text_Regex_Atom));
+  Fl_Text_Regex_Atom *a = p->atoms + p->natoms++;
+  a->type = type;
+  a->quant = RE_ONE;
+  a->c = 0;
+  a->first = p->nranges;
+  a->count = 0;
+  return a;
+}
+
+/*
+ Compile a regular expression. Return 0 if it is not valid.
+ */
+static int regex_compile(Fl_Text_Pattern *p, const char *s, int fold)
+{
+  memset(p, 0, sizeof(Fl_Text_Pattern));
+  p->fold = fold;
+  p->nalts = 1;
+  while (*s) {
+    Fl_Text_Regex_Atom *a;
+    unsigned c;
+    int esc;
+    if (*s == '*' || *s == '+' || *s == '?') {
+      if (!p->natoms)
+        return 0;
+      a = p->atoms + p->natoms - 1;
+      if (a->quant != RE_ONE || a->type == RE_BOL || a->type == RE_EOL || a->type == RE_ALT)
+        return 0;
+      a->quant = *s == '*' ? RE_STAR : *s == '+' ? RE_PLUS : RE_QUEST;
+      s++;
+    } else if (*s == '|') {
+      regex_add(p, RE_ALT);
+      p->nalts++;
+      s++;
+    } else if (*s == '.') {
+      regex_add(p, RE_ANY);
+      s++;
+    } else if (*s == '^') {
+      regex_add(p, RE_BOL);
+      s++;
+    } else if (*s == '$') {
+      regex_add(p, RE_EOL);
+      s++;
+    } else if (*s == '[') {
+      s++;
+      a = regex_add(p, RE_CLASS);
+      if (*s == '^') {
+        a->type = RE_NCLASS;
+        s++;
+      }
+      for (int n = 0; *s != ']' || !n; n++) {
+        if (!*s)
+          return 0;
+        s += regex_char(s, c, esc);
+        if (esc) {
+          if (c < 'a') // \D, \W and \S can not be part of a set
+            return 0;
+          regex_escape_class(p, c);
+        } else if (*s == '-' && s[1] && s[1] != ']') {
+          unsigned last;
+          s += 1 + regex_char(s + 1, last, esc);
+          if (esc || last < c)
+            return 0;
+          regex_range(p, c, last);
+        } else {
+          regex_range(p, c, c);
+        }
+      }
+      s++;
+      a = p->atoms + p->natoms - 1;
+      a->count = p->nranges - a->first;
+    } else {
+      s += regex_char(s, c, esc);
+      if (esc) {
+        a = regex_add(p, c < 'a' ? RE_NCLASS : RE_CLASS);
+        regex_escape_class(p, c | 0x20);
+        a->count = p->nranges - a->first;
+      } else {
+        a = regex_add(p, RE_CHAR);
+        a->c = fold ? fl_tolower(c) : c;
+      }
+    }
+  }
+  regex_add(p, RE_END);
+
+  // all matches start with the same text or at the start of a line?
+  if (p->nalts == 1) {
+    p->bol = p->atoms[0].type == RE_BOL;
+    char prefix[256];
+    int len = 0;
+    for (int i = 0; p->atoms[i].type == RE_CHAR && len < (int) sizeof(prefix) - 4; i++) {
+      if (p->atoms[i].quant == RE_STAR || p->atoms[i].quant == RE_QUEST)
+        break;
+      len += fl_utf8encode(p->atoms[i].c, prefix + len);
+      if (p->atoms[i].quant == RE_PLUS)
+        break;
+    }
+    if (len) {
+      p->prefix = (Fl_Text_Pattern *) malloc(sizeof(Fl_Text_Pattern));
+      literal_compile(p->prefix, prefix, len, fold);
+    }
+  }
+  return 1;
+}
+
+static int regex_in_class(const Fl_Text_Pattern *p, const Fl_Text_Regex_Atom *a, unsigned c)
+{
+  const unsigned *r = p->ranges + 2 * a->first;
+  for (int i = 0; i < a->count; i++, r += 2)
+    if (c >= r[0] && c <= r[1])
+      return 1;
+  return 0;
+}
+
+static int regex_atom_matches(const Fl_Text_Pattern *p, const Fl_Text_Regex_Atom *a, unsigned c)
+{
+  switch (a->type) {
+    case RE_CHAR:
+      return (p->fold ? (unsigned) fl_tolower(c) : c) == a->c;
+    case RE_ANY:
+      return c != '\n';
+    default: {
+      int in = regex_in_class(p, a, c);
+      if (!in && p->fold)
+        in = regex_in_class(p, a, fl_tolower(c)) || regex_in_class(p, a, fl_toupper(c));
+      return a->type == RE_CLASS ? in : !in;
+    }
+  }
+}
+
+/*
+ Match the atoms of p from atom i at pos, and return the end of the match
+ or -1. The match must end at or before end.
+ */
+static int regex_match(const Fl_Text_Buffer *buf, const Fl_Text_Pattern *p,
+                       int i, int pos, int end)
+{
+  for (;; i++) {
+    const Fl_Text_Regex_Atom *a = p->atoms + i;
+    if (a->type == RE_ALT || a->type == RE_END)
+      return pos;
+    if (a->type == RE_BOL) {
+      if (pos > 0 && buf->byte_at(pos - 1) != '\n')
+        return -1;
+      continue;
+    }
+    if (a->type == RE_EOL) {
+      if (pos < buf->length() && buf->byte_at(pos) != '\n')
+        return -1;
+      continue;
+    }
+    int min = a->quant == RE_PLUS ? 1 : 0;
+    int max = a->quant == RE_QUEST ? 1 : a->quant == RE_ONE ? 1 : INT_MAX;
+    if (a->quant == RE_ONE)
+      min = 1;
+    int n = 0, q = pos;
+    while (n < max && q < end && regex_atom_matches(p, a, buf->char_at(q))) {
+      q = buf->next_char(q);
+      n++;
+    }
+    if (n < min)
+      return -1;
+    if (a->quant == RE_ONE) {
+      pos = q;
+      continue;
+    }
+    // the longest repetition that lets the rest match
+    for (;; n--) {
+      int r = regex_match(buf, p, i + 1, q, end);
+      if (r >= 0 || n == min)
+        return r;
+      q = buf->prev_char(q);
+    }
+  }
+}
+
+/*
+ Return the end of a match of p at pos, or -1.
+ */
+static int regex_match_at(const Fl_Text_Buffer *buf, const Fl_Text_Pattern *p,
+                          int pos, int end)
+{
+  for (int i = 0; i < p->natoms; i++) {
+    if (i == 0 || p->atoms[i - 1].type == RE_ALT) {
+      int r = regex_match(buf, p, i, pos, end);
+      if (r >= 0)
+        return r;
+    }
+  }
+  return -1;
+}
+
+
+int Fl_Text_Buffer::find_literal_(const Fl_Text_Pattern *p, int start, int end,
+                                  int backward) const
+{
+  int m = p->len;
+  if (start < 0 || start > end || m > end)
+    return -1;
+  if (!m)
+    return start;
+  char small[64];
+  char *window = 2 * m <= (int) sizeof(small) ? small : (char *) malloc(2 * m);
+  int found = -1;
+  if (!backward) {
+    // match in each segment, then across its end
+    for (int pos = start; pos < end && found < 0; ) {
+      const char *s;
+      int n = min(segment_(pos, &s), end - pos);
+      int i = horspool(p, s, n);
+      if (i >= 0) {
+        found = pos + i;
+        break;
+      }
+      pos += n;
+      if (pos < end && m > 1) {
+        int a = max(start, pos - m + 1), b = min(end, pos + m - 1);
+        copy_out_(window, a, b);
+        i = horspool(p, window, b - a);
+        if (i >= 0 && a + i < pos)
+          found = a + i;
+      }
+    }
+  } else {
+    // the same from the end, matches start at or before start
+    int limit = min(end, start + m);
+    for (int pos = limit; pos > 0 && found < 0; ) {
+      const char *s;
+      int n = segment_before_(pos, &s);
+      int i = rhorspool(p, s, n);
+      if (i >= 0) {
+        found = pos - n + i;
+        break;
+      }
+      pos -= n;
+      if (pos > 0 && m > 1) {
+        int a = max(0, pos - m + 1), b = min(limit, pos + m - 1);
+        copy_out_(window, a, b);
+        i = rhorspool(p, window, b - a);
+        if (i >= 0 && a + i + m > pos)
+          found = a + i;
+      }
+    }
+  }
+  if (window != small)
+    free(window);
+  return found;
+}
+
+int Fl_Text_Buffer::find_regex_(const Fl_Text_Pattern *p, int start, int end,
+                                int backward, int *foundEnd) const
+{
+  if (start < 0 || start > end)
+    return -1;
+  int pos = start;
+  for (;;) {
+    if (p->prefix) {
+      pos = find_literal_(p->prefix, pos, end, backward);
+      if (pos < 0)
+        return -1;
+    }
+    if (!p->bol || pos == 0 || byte_at(pos - 1) == '\n') {
+      int r = regex_match_at(this, p, pos, end);
+      if (r >= 0) {
+        *foundEnd = r;
+        return pos;
+      }
+    }
+    if (backward) {
+      if (pos <= 0)
+        return -1;
+      pos = p->bol ? line_start(pos - 1) : prev_char(pos);
+    } else {
+      if (pos >= end)
+        return -1;
+      pos = p->bol ? line_end(pos) + 1 : next_char(pos);
+      if (pos > end)
+        return -1;
+    }
+  }
+}
+
+/*
+ Compile the pattern for search() and search_all().
+ */
+static int pattern_compile(Fl_Text_Pattern *p, const char *pattern, int flags)
+{
+  int fold = !(flags & Fl_Text_Buffer::SEARCH_MATCH_CASE);
+  if (flags & Fl_Text_Buffer::SEARCH_REGEX) {
+    if (regex_compile(p, pattern, fold))
+      return 1;
+    pattern_free(p);
+    return 0;
+  }
+  literal_compile(p, pattern, (int) strlen(pattern), fold);
+  return 1;
+}
+
+/**
+ Searches for a string or a regular expression.
+
+ Text that matches a string is found with the Boyer-Moore-Horspool
+ algorithm, so searching for longer strings is faster, and the case of
+ the string is folded once instead of for each position of the text.
+ With SEARCH_REGEX, \p pattern is a regular expression made of:
+ - \c c: a character; \\c quotes a special character
+ - \c . : any character but a newline
+ - \c [...]: a character of a set, with ranges like \c a-z; \c [^...] negates it
+ - \c \\d, \c \\w, \c \\s: a digit, a word character (letter, digit,
+   underscore or non-ASCII character), a white space; \c \\D, \c \\W,
+   \c \\S negate them
+ - \c \\n, \c \\t: a newline, a tab
+ - \c ^, \c $: the start and the end of a line
+ - \c *, \c +, \c ?: repeats the previous item 0 or more, 1 or more,
+   0 or 1 times, as many times as possible
+ - \c a|b: either the expression \c a or \c b
+
+ \param startPos byte offset to start the search at; with SEARCH_BACKWARD,
+  the last match that starts at or before \p startPos is found
+ \param pattern UTF-8 string or regular expression to find
+ \param flags SEARCH_MATCH_CASE, SEARCH_REGEX and SEARCH_BACKWARD, or 0
+ \param[out] foundPos byte offset of the match
+ \param[out] foundEnd if not NULL, byte offset of the end of the match
+ \return 1 if found, 0 if not found or if \p pattern is not a valid
+  regular expression
+ \see search_all()
+ \version 1.4.0
+ */
+int Fl_Text_Buffer::search(int startPos, const char *pattern, int flags,
+                           int *foundPos, int *foundEnd) const
+{
+  Fl_Text_Pattern p;
+  if (!pattern || !pattern_compile(&p, pattern, flags))
+    return 0;
+  int backward = flags & SEARCH_BACKWARD;
+  if (backward && startPos > mLength)
+    startPos = mLength;
+  int pos, end = -1;
+  if (flags & SEARCH_REGEX) {
+    pos = find_regex_(&p, startPos, mLength, backward, &end);
+  } else {
+    pos = find_literal_(&p, startPos, mLength, backward);
+    end = pos + p.len;
+  }
+  pattern_free(&p);
+  if (pos < 0)
+    return 0;
+  *foundPos = pos;
+  if (foundEnd)
+    *foundEnd = end;
+  return 1;
+}
+
+/**
+ Finds all the matches of a string or a regular expression in a part of
+ the buffer, e.g. to highlight them.
+
+ The matches do not overlap, and are found in a single pass over the
+ text; see search() for the syntax of regular expressions. An empty match
+ is not reported right after a match.
+ \param start, end byte offsets of the part of the buffer to search, all
+  matches start and end in this part
+ \param pattern UTF-8 string or regular expression to find
+ \param flags SEARCH_MATCH_CASE and SEARCH_REGEX, or 0
+ \param[out] matches set to an array of the start and end offsets of each
+  match, in this order, allocated with malloc(); the caller must free() it.
+  It is set to NULL if nothing is found.
+ \return the number of matches, or -1 if \p pattern is not a valid
+  regular expression
+ \version 1.4.0
+ */
+int Fl_Text_Buffer::search_all(int start, int end, const char *pattern, int flags,
+                               int **matches) const
+{
+  *matches = NULL;
+  Fl_Text_Pattern p;
+  if (!pattern || !pattern_compile(&p, pattern, flags & ~SEARCH_BACKWARD))
+    return -1;
+  if (start < 0)
+    start = 0;
+  if (end > mLength)
+    end = mLength;
+  int n = 0, alloc = 0, last = -1;
+  for (int pos = start; pos <= end; ) {
+    int found, found_end;
+    if (flags & SEARCH_REGEX) {
+      found = find_regex_(&p, pos, end, 0, &found_end);
+    } else {
+      found = find_literal_(&p, pos, end, 0);
+      found_end = found + p.len;
+    }
+    if (found < 0)
+      break;
+    if (found_end > found || found != last) {
+      if (n == alloc) {
+        alloc = alloc ? 2 * alloc : 64;
+        *matches = (int *) realloc(*matches, 2 * alloc * sizeof(int));
+      }
+      (*matches)[2 * n] = found;
+      (*matches)[2 * n + 1] = found_end;
+      n++;
+    }
+    last = found_end;
+    if (found_end > found)
+      pos = found_end;
+    else if (found < end)
+      pos = next_char(found);
+    else
+      break;
+  }
+  pattern_free(&p);
+  return n;
+}
+
+//
+// End of "$Id$".
+//
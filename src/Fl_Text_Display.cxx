@@ -31,6 +31,7 @@
 #include <FL/Fl_Text_Buffer.H>
 #include <FL/Fl_Text_Display.H>
 #include <FL/Fl_Window.H>
+#include <FL/Fl_Graphics_Driver.H>
 #include "Fl_Screen_Driver.H"
 
 #undef min
@@ -87,6 +88,333 @@ static int scroll_x = 0;
 // CET - FIXME
 #define TMPFONTWIDTH 6
 
+/*
+ Measuring text is a round trip to the font system for every call, and the
+ display measures the same text again and again to draw, move the cursor or
+ find the longest line. When the graphics driver tells that string widths are
+ the sum of the widths of their characters (no kerning or shaping), these
+ widths are kept for the text font and for each style: in a table for ASCII
+ characters, in a hash table for others. A cache is cleared when its font,
+ the graphics driver or the scale factor change.
+ */
+struct Fl_Text_Width_Cache {
+  Fl_Font font;
+  Fl_Fontsize size;
+  Fl_Graphics_Driver *driver;
+  float scale;
+  double ascii[128];            // < 0 if not measured yet
+  unsigned *keys;               // code points, 0 for empty buckets
+  double *widths;
+  int nkeys, nbuckets;          // nbuckets is a power of two
+};
+
+/*
+ The widths of the visible lines are kept from one call of longest_vline()
+ to the next, so that the horizontal scrollbar can be updated without
+ measuring all lines again. A line is known by its start position and its
+ length; its width is forgotten when the buffer is modified or restyled
+ between its start and its end, and the start of the following lines is
+ moved with the text. All widths are forgotten when the fonts change.
+ */
+struct Fl_Text_Line_Width {
+  int start, len, width;
+};
+
+struct Fl_Text_Line_Widths {
+  Fl_Text_Line_Width *lines;    // sorted by start position
+  Fl_Text_Line_Width *tmp;
+  int n, alloc;
+  Fl_Font font;
+  Fl_Fontsize size;
+  const void *styles;
+  int nstyles;
+  float scale;
+};
+
+/*
+ With incremental_wrap(), the wrapped lines are counted in blocks of whole
+ lines of about WRAP_BLOCK_SIZE bytes, a few blocks at a time in an idle
+ callback. The number of lines of the counted blocks is kept until the
+ wrap width or the fonts change; a modification of the buffer only changes
+ the count of its block, or counts the following blocks again if it
+ crosses the end of its block.
+ */
+#define WRAP_BLOCK_SIZE 16384
+#define WRAP_SLICE_SIZE (4 * WRAP_BLOCK_SIZE)
+
+struct Fl_Text_Wrap_Block {
+  int start;                    // a line start
+  int lines;                    // line breaks up to the next block
+};
+
+struct Fl_Text_Wrap_Count {
+  Fl_Text_Wrap_Block *blocks;
+  int n, alloc;
+  int pos;                      // start of the text not counted yet
+  int lines;                    // line breaks before pos
+  int done;                     // all text is counted
+  int exact;                    // mNBufferLines is exact before the count is done
+  int idle;                     // wrap_idle_cb() is registered
+  int width;                    // what the count is valid for
+  Fl_Font font;
+  Fl_Fontsize size;
+  const void *styles;
+  int nstyles;
+};
+
+/*
+ Find the counted block that contains pos.
+ */
+static int wrap_block(const Fl_Text_Wrap_Count *c, int pos)
+{
+  int lo = 0, hi = c->n - 1;
+  while (lo < hi) {
+    int mid = (lo + hi + 1) / 2;
+    if (c->blocks[mid].start <= pos) lo = mid;
+    else hi = mid - 1;
+  }
+  return lo;
+}
+
+/*
+ Update the count after the buffer was modified at pos, up to modEnd in
+ the new text. Returns 1 if the blocks after the modification must be
+ counted again.
+ */
+static int wrap_count_modified(Fl_Text_Wrap_Count *c, int pos, int nInserted,
+                               int nDeleted, int modEnd, int dLines)
+{
+  int k;
+  if (pos >= c->pos) {
+    if (!c->done)
+      return 0;
+    // Text was appended to the counted text: the last block may now end in
+    // the middle of a line, so count it again with the new text
+    k = c->n ? c->n - 1 : 0;
+  } else {
+    int delta = nInserted - nDeleted;
+    k = wrap_block(c, pos);
+    int blockEnd = k + 1 < c->n ? c->blocks[k + 1].start : c->pos;
+    if (pos + nDeleted < blockEnd && modEnd - delta <= blockEnd) {
+      c->blocks[k].lines += dLines;
+      c->lines += dLines;
+      for (int i = k + 1; i < c->n; i++)
+        c->blocks[i].start += delta;
+      c->pos += delta;
+      return 0;
+    }
+  }
+  for (int i = k; i < c->n; i++)
+    c->lines -= c->blocks[i].lines;
+  c->pos = k < c->n ? c->blocks[k].start : 0;
+  c->n = k;
+  if (c->done)
+    c->exact = 1;
+  c->done = 0;
+  return 1;
+}
+
+/*
+ Forget the lines that contain text between start and end, and move the
+ lines after it by delta.
+ */
+static void line_widths_changed(Fl_Text_Line_Widths *c, int start, int end, int delta)
+{
+  int j = 0;
+  for (int i = 0; i < c->n; i++) {
+    Fl_Text_Line_Width &l = c->lines[i];
+    if (l.start + l.len < start) {
+      c->lines[j++] = l;
+    } else if (l.start > end) {
+      c->lines[j] = l;
+      c->lines[j++].start += delta;
+    }
+  }
+  c->n = j;
+}
+
+/*
+ With highlight_lines(), the state of the highlighting callback at the
+ start of each line of the buffer is kept for the lines [0, n). The styles
+ of a line are computed from its state when it is drawn, and only those of
+ the last styled line are kept.
+
+ A modification forgets the states after the line where it starts, but
+ keeps the old states of the following lines in [check, old_n), moved by
+ the number of inserted and deleted lines: as soon as the state computed
+ again for one of these lines is the same as before, the states of all
+ lines up to old_n are known again. The states are computed again up to
+ the last displayed line right away, to redraw the lines whose styles
+ changed, and for the rest of the buffer, a slice at a time, when the
+ application is idle.
+
+ The position of the start of a line, the anchor, is kept to find the line
+ numbers of positions near the last ones quickly.
+ */
+#define HIGHLIGHT_SLICE_SIZE 65536
+
+struct Fl_Text_Highlight {
+  Fl_Text_Display::Highlight_Line_Cb cb;
+  void *data;
+  int *states;
+  int n, old_n, check, alloc;
+  int anchor, anchor_pos;       // a line number and the position of its start
+  char *style;                  // styles of the line at line_start
+  int line_start, line_len, style_alloc;
+  int idle;                     // highlight_idle_cb() is registered
+};
+
+static void highlight_free(Fl_Text_Highlight *h)
+{
+  free(h->states);
+  free(h->style);
+  free(h);
+}
+
+static void highlight_reset(Fl_Text_Highlight *h)
+{
+  h->states[0] = 0;
+  h->n = h->old_n = h->check = 1;
+  h->anchor = h->anchor_pos = 0;
+  h->line_start = -1;
+}
+
+/*
+ Return the number of the line that contains pos.
+ */
+static int highlight_line_of(Fl_Text_Highlight *h, Fl_Text_Buffer *buf, int pos)
+{
+  int start = buf->line_start(pos);
+  if (start >= h->anchor_pos)
+    h->anchor += buf->count_lines(h->anchor_pos, start);
+  else
+    h->anchor -= buf->count_lines(start, h->anchor_pos);
+  h->anchor_pos = start;
+  return h->anchor;
+}
+
+/*
+ Return the start of a line.
+ */
+static int highlight_line_start(Fl_Text_Highlight *h, Fl_Text_Buffer *buf, int line)
+{
+  if (line > h->anchor)
+    h->anchor_pos = buf->skip_lines(h->anchor_pos, line - h->anchor);
+  else if (line < h->anchor)
+    h->anchor_pos = buf->rewind_lines(h->anchor_pos, h->anchor - line);
+  h->anchor = line;
+  return h->anchor_pos;
+}
+
+/*
+ Compute the styles of the line at start, from its state. Return the state
+ at the start of the next line.
+ */
+static int highlight_line(Fl_Text_Highlight *h, Fl_Text_Buffer *buf, int start, int state)
+{
+  int len = buf->line_end(start) - start;
+  if (len + 1 > h->style_alloc) {
+    h->style_alloc = len + 256;
+    h->style = (char *) realloc(h->style, h->style_alloc);
+  }
+  memset(h->style, 'A', len + 1);
+  char *text = buf->text_range(start, start + len);
+  state = h->cb(text, len, state, h->style, h->data);
+  free(text);
+  h->line_start = start;
+  h->line_len = len + 1;      // with the newline
+  return state;
+}
+
+/*
+ Compute the states of the lines up to line, or until about maxBytes of
+ text are styled. Return the first line from which the states are the
+ same as before a modification, or else -1 if the states of all lines are
+ known, or -2.
+ */
+static int highlight_states(Fl_Text_Highlight *h, Fl_Text_Buffer *buf, int line,
+                            int maxBytes)
+{
+  int stable = -2;
+  for (int bytes = 0; h->n <= line && bytes < maxBytes; ) {
+    int k = h->n - 1;
+    int start = highlight_line_start(h, buf, k);
+    int state = highlight_line(h, buf, start, h->states[k]);
+    int next = start + h->line_len;
+    if (next > buf->length())
+      return stable == -2 ? -1 : stable;
+    bytes += h->line_len;
+    h->anchor = k + 1;
+    h->anchor_pos = next;
+    if (k + 1 >= h->check && k + 1 < h->old_n) {
+      if (h->states[k + 1] == state) {
+        if (stable < 0)
+          stable = k + 1;
+        h->n = h->old_n;
+        continue;
+      }
+      // the next old state followed from the old state of this line
+      h->check = k + 2;
+    }
+    if (k + 1 == h->alloc) {
+      h->alloc *= 2;
+      h->states = (int *) realloc(h->states, h->alloc * sizeof(int));
+    }
+    h->states[k + 1] = state;
+    h->n = k + 2;
+    if (h->n > h->old_n)
+      h->old_n = h->n;
+  }
+  return stable;
+}
+
+/*
+ Forget the states of the lines after a modification of the buffer.
+ */
+static void highlight_modified(Fl_Text_Highlight *h, Fl_Text_Buffer *buf, int pos,
+                               int nInserted, int nDeleted, const char *deletedText)
+{
+  int linesInserted = nInserted ? buf->count_lines(pos, pos + nInserted) : 0;
+  int linesDeleted = nDeleted ? countlines(deletedText) : 0;
+  int delta = linesInserted - linesDeleted;
+  h->line_start = -1;
+
+  // find the line of pos from the anchor, that may have been modified
+  if (h->anchor_pos > pos + nDeleted) {
+    h->anchor += delta;
+    h->anchor_pos += nInserted - nDeleted;
+  } else if (h->anchor_pos > pos) {
+    for (int i = 0; i < h->anchor_pos - pos; i++)
+      if (deletedText[i] == '\n')
+        h->anchor--;
+    h->anchor_pos = buf->line_start(pos);
+  }
+  int first = highlight_line_of(h, buf, pos) + 1;
+
+  int pending = h->n < h->old_n;
+  int check = first + linesInserted;
+  if (pending && h->check > first + linesDeleted)
+    check = max(check, h->check + delta);
+  if (h->old_n > first) {
+    if (first + linesDeleted >= h->old_n) {
+      h->old_n = first;
+    } else {
+      int n = h->old_n + delta;
+      if (n > h->alloc) {
+        while (n > h->alloc)
+          h->alloc *= 2;
+        h->states = (int *) realloc(h->states, h->alloc * sizeof(int));
+      }
+      memmove(h->states + first + linesInserted, h->states + first + linesDeleted,
+              (h->old_n - first - linesDeleted) * sizeof(int));
+      h->old_n = n;
+    }
+  }
+  h->check = check;
+  if (h->n > first)
+    h->n = first;
+}
+
 
 
 /**
@@ -129,6 +457,7 @@ Fl_Text_Display::Fl_Text_Display(int X, int Y, int W, int H, const char* l)
   mHorizOffset = 0;
   mTopLineNumHint = 1;
   mHorizOffsetHint = 0;
+  mScrollDX = mScrollDY = 0;
   mNStyles = 0;
   mStyleTable = NULL;
   mUnfinishedStyle = 0;
@@ -139,6 +468,11 @@ Fl_Text_Display::Fl_Text_Display(int X, int Y, int W, int H, const char* l)
   mNLinesDeleted = 0;
   mModifyingTabDistance = 0;	// XXX: UNUSED
   mColumnScale = 0;
+  mWidthCache = NULL;
+  mNWidthCaches = 0;
+  mLineWidths = NULL;
+  mWrapCount = NULL;
+  mHighlight = NULL;
   mCursor_color = FL_FOREGROUND_COLOR;
 
   mHScrollBar = new Fl_Scrollbar(0,0,1,1);
@@ -204,6 +538,20 @@ Fl_Text_Display::~Fl_Text_Display() {
     mBuffer->remove_predelete_callback(buffer_predelete_cb, this);
   }
   if (mLineStarts) delete[] mLineStarts;
+  for (int i = 0; i < mNWidthCaches; i++)
+    free(mWidthCache[i].keys);
+  free(mWidthCache);
+  incremental_wrap(0);
+  if (mHighlight) {
+    if (mHighlight->idle)
+      Fl::remove_idle(highlight_idle_cb, this);
+    highlight_free(mHighlight);
+  }
+  if (mLineWidths) {
+    free(mLineWidths->lines);
+    free(mLineWidths->tmp);
+    free(mLineWidths);
+  }
   if (linenumber_format_) {
     free((void*)linenumber_format_);
     linenumber_format_ = 0;
@@ -365,6 +713,16 @@ void Fl_Text_Display::buffer( Fl_Text_Buffer *buf ) {
   /* Add the buffer to the display, and attach a callback to the buffer for
    receiving modification information when the buffer contents change */
   mBuffer = buf;
+
+  /* The highlighting states and anchor were those of the old buffer */
+  if (mHighlight) {
+    highlight_reset(mHighlight);
+    if (mBuffer && !mHighlight->idle) {
+      Fl::add_idle(highlight_idle_cb, this);
+      mHighlight->idle = 1;
+    }
+  }
+
   if (mBuffer) {
     mBuffer->add_modify_callback( buffer_modified_cb, this );
     mBuffer->add_predelete_callback( buffer_predelete_cb, this );
@@ -414,6 +772,8 @@ void Fl_Text_Display::highlight_data(Fl_Text_Buffer *styleBuffer,
                                      int nStyles, char unfinishedStyle,
                                      Unfinished_Style_Cb unfinishedHighlightCB,
                                      void *cbArg ) {
+  if (mHighlight)
+    highlight_lines(NULL, 0, NULL, NULL);
   mStyleBuffer = styleBuffer;
   mStyleTable = styleTable;
   mNStyles = nStyles;
@@ -421,12 +781,120 @@ void Fl_Text_Display::highlight_data(Fl_Text_Buffer *styleBuffer,
   mUnfinishedHighlightCB = unfinishedHighlightCB;
   mHighlightCBArg = cbArg;
   mColumnScale = 0;
+  // The widths of the lines were measured with the old styles, even if
+  // the style table is at the same address
+  if (mLineWidths)
+    mLineWidths->n = 0;
 
   mStyleBuffer->canUndo(0);
   damage(FL_DAMAGE_EXPOSE);
 }
 
 
+/**
+ \brief Highlights the text line by line, as it is displayed.
+
+ This is an alternative to highlight_data() for syntax highlighting that
+ does not need a style buffer. The callback computes the styles of a
+ single line of text from the state of the highlighting at its start,
+ e.g. whether it starts in a comment or a string, and returns the state
+ at the start of the next line:
+ \code
+   int style_line(const char *text, int len, int state, char *style, void *data) {
+     for (int i = 0; i < len; i++) {
+       // ... set state and style[i] from text[i] ...
+     }
+     return state;
+   }
+ \endcode
+ The display keeps the state at the start of each line (4 bytes per line)
+ and only calls the callback for the lines that it draws or measures, and
+ for the lines before them whose state is not known yet. When the buffer
+ is modified, the states are computed again from the modified line until
+ they are the same as before, so typing usually styles a single line, and
+ the lines whose styles changed are redrawn. The states of the rest of
+ the buffer are computed a slice at a time when the application is idle,
+ see Fl::add_idle(), so that scrolling to the end of a large buffer does
+ not need to style all of it at once.
+
+ \param styleTable a list of styles, as for highlight_data()
+ \param nStyles number of styles in the style table
+ \param cb the callback that styles a line; it gets the text of the line,
+   without its newline and not nul-terminated, its length, the state at its
+   start (0 for the first line), the array of styles to fill with one byte
+   per byte of the line ('A' for the first style of the style table, which
+   is the default) and \p data. It returns the state at the start of the next
+   line. Pass NULL to remove the highlighting.
+ \param data passed to the callback
+
+ \see highlight_data()
+ \version 1.4.0
+ */
+void Fl_Text_Display::highlight_lines(const Style_Table_Entry *styleTable,
+                                      int nStyles, Highlight_Line_Cb cb,
+                                      void *data) {
+  if (mHighlight) {
+    if (mHighlight->idle)
+      Fl::remove_idle(highlight_idle_cb, this);
+    highlight_free(mHighlight);
+    mHighlight = NULL;
+  }
+  mStyleTable = styleTable;
+  mNStyles = nStyles;
+  mColumnScale = 0;
+  if (mLineWidths)
+    mLineWidths->n = 0;
+  if (cb) {
+    mStyleBuffer = NULL;
+    mUnfinishedStyle = 0;
+    mUnfinishedHighlightCB = 0;
+    mHighlight = (Fl_Text_Highlight *) calloc(1, sizeof(Fl_Text_Highlight));
+    mHighlight->cb = cb;
+    mHighlight->data = data;
+    mHighlight->alloc = 64;
+    mHighlight->states = (int *) malloc(mHighlight->alloc * sizeof(int));
+    highlight_reset(mHighlight);
+    if (buffer()) {
+      Fl::add_idle(highlight_idle_cb, this);
+      mHighlight->idle = 1;
+    }
+  }
+  damage(FL_DAMAGE_EXPOSE);
+}
+
+
+/**
+ \brief Returns the style of a position of the buffer from highlight_lines().
+ */
+int Fl_Text_Display::line_style(int pos) const {
+  Fl_Text_Highlight *h = mHighlight;
+  if (h->line_start < 0 || pos < h->line_start || pos >= h->line_start + h->line_len) {
+    Fl_Text_Buffer *buf = buffer();
+    int line = highlight_line_of(h, buf, pos);
+    highlight_states(h, buf, line, INT_MAX);
+    highlight_line(h, buf, highlight_line_start(h, buf, line), h->states[line]);
+  }
+  return (unsigned char) h->style[pos - h->line_start];
+}
+
+
+/**
+ \brief Computes the highlighting states of the next lines when the application is idle.
+ */
+void Fl_Text_Display::highlight_idle_cb(void *data) {
+  Fl_Text_Display *d = (Fl_Text_Display *) data;
+  Fl_Text_Highlight *h = d->mHighlight;
+  Fl_Text_Buffer *buf = d->buffer();
+  if (buf)
+    highlight_states(h, buf, INT_MAX, HIGHLIGHT_SLICE_SIZE);
+  // done when the state of the last line is known
+  if (!buf || buf->line_end(highlight_line_start(h, buf, h->n - 1)) == buf->length()) {
+    Fl::remove_idle(highlight_idle_cb, d);
+    h->idle = 0;
+  }
+}
+
+
 
 /**
  \brief Find the longest line of all visible lines.
@@ -434,9 +902,44 @@ void Fl_Text_Display::highlight_data(Fl_Text_Buffer *styleBuffer,
  \return the width of the longest visible line in pixels
  */
 int Fl_Text_Display::longest_vline() const {
-  int longest = 0;
-  for (int i = 0; i < mNVisibleLines; i++)
-    longest = max(longest, measure_vline(i));
+  if (!mLineWidths)
+    mLineWidths = (Fl_Text_Line_Widths *) calloc(1, sizeof(Fl_Text_Line_Widths));
+  Fl_Text_Line_Widths *c = mLineWidths;
+  float scale = fl_graphics_driver->scale();
+  if (c->font != textfont() || c->size != textsize() || c->styles != mStyleTable
+      || c->nstyles != mNStyles || c->scale != scale) {
+    c->font = textfont();
+    c->size = textsize();
+    c->styles = mStyleTable;
+    c->nstyles = mNStyles;
+    c->scale = scale;
+    c->n = 0;
+  }
+  if (c->alloc < mNVisibleLines) {
+    c->alloc = mNVisibleLines;
+    c->lines = (Fl_Text_Line_Width *) realloc(c->lines, c->alloc * sizeof(Fl_Text_Line_Width));
+    c->tmp = (Fl_Text_Line_Width *) realloc(c->tmp, c->alloc * sizeof(Fl_Text_Line_Width));
+  }
+
+  // keep the widths of the visible lines only, they are sorted like mLineStarts
+  int longest = 0, j = 0, n = 0;
+  for (int i = 0; i < mNVisibleLines && mLineStarts[i] != -1; i++) {
+    int start = mLineStarts[i], len = vline_length(i), w;
+    while (j < c->n && c->lines[j].start < start)
+      j++;
+    if (j < c->n && c->lines[j].start == start && c->lines[j].len == len)
+      w = c->lines[j].width;
+    else
+      w = measure_vline(i);
+    c->tmp[n].start = start;
+    c->tmp[n].len = len;
+    c->tmp[n++].width = w;
+    longest = max(longest, w);
+  }
+  Fl_Text_Line_Width *t = c->lines;
+  c->lines = c->tmp;
+  c->tmp = t;
+  c->n = n;
   return longest;
 }
 
@@ -479,6 +982,8 @@ void Fl_Text_Display::recalc_display() {
   int scrollsize = scrollbar_width_ ? scrollbar_width_ : Fl::scrollbar_size();
 
   int oldTAWidth = text_area.w;
+  int oldX = text_area.x, oldY = text_area.y, oldW = text_area.w;
+  int oldH = text_area.h, oldMaxsize = mMaxsize, moved = 0;
 
   int X = x() + Fl::box_dx(box());
   int Y = y() + Fl::box_dy(box());
@@ -537,9 +1042,9 @@ void Fl_Text_Display::recalc_display() {
     if (mContinuousWrap && !mWrapMarginPix && text_area.w != oldTAWidth) {
 
       int oldFirstChar = mFirstChar;
-      mNBufferLines = count_lines(0, buffer()->length(), true);
       mFirstChar = line_start(mFirstChar);
-      mTopLineNum = count_lines(0, mFirstChar, true)+1;
+      if (mFirstChar != oldFirstChar) moved = 1;
+      count_wrapped_lines();
       absolute_top_line_number(oldFirstChar);
 #ifdef DEBUG2
       printf("    mNBufferLines=%d\n", mNBufferLines);
@@ -689,7 +1194,13 @@ void Fl_Text_Display::recalc_display() {
   mHorizOffsetHint = mHorizOffset;
   display_insert_position_hint = 0;
 
-  if (mContinuousWrap ||
+  // the text that was drawn can only be moved by draw() if it is still
+  // wrapped and laid out the same way
+  int relayout = mMaxsize != oldMaxsize ||
+                 text_area.x != oldX || text_area.y != oldY ||
+                 text_area.w != oldW || text_area.h != oldH;
+  if ((mContinuousWrap && (text_area.w != oldW || moved)) ||
+      ((mScrollDX || mScrollDY) && relayout) ||
       hscrollbarvisible != mHScrollBar->visible() ||
       vscrollbarvisible != mVScrollBar->visible())
     redraw();
@@ -735,6 +1246,10 @@ void Fl_Text_Display::redisplay_range(int startpos, int endpos) {
   IS_UTF8_ALIGNED2(buffer(), startpos)
   IS_UTF8_ALIGNED2(buffer(), endpos)
 
+  // the style of the text may have changed
+  if (mLineWidths)
+    line_widths_changed(mLineWidths, startpos, endpos, 0);
+
   if (damage_range1_start == -1 && damage_range1_end == -1) {
     damage_range1_start = startpos;
     damage_range1_end = endpos;
@@ -937,14 +1452,12 @@ void Fl_Text_Display::wrap_mode(int wrap, int wrapMargin) {
   }
 
   if (buffer()) {
-    /* wrapping can change the total number of lines, re-count */
-    mNBufferLines = count_lines(0, buffer()->length(), true);
-
     /* changing wrap margins or changing from wrapped mode to non-wrapped
      can leave the character at the top no longer at a line start, and/or
-     change the line number */
+     change the line number; wrapping can change the total number of lines,
+     re-count */
     mFirstChar = line_start(mFirstChar);
-    mTopLineNum = count_lines(0, mFirstChar, true) + 1;
+    count_wrapped_lines();
 
     reset_absolute_top_line_number();
 
@@ -963,6 +1476,177 @@ void Fl_Text_Display::wrap_mode(int wrap, int wrapMargin) {
 }
 
 
+/**
+ \brief Counts wrapped lines in the background.
+
+ In continuous wrap mode, the display needs the number of lines of the
+ whole buffer after wrapping to set the vertical scrollbar, and counting
+ them means measuring all the text. This is done again whenever the width
+ of the widget changes in WRAP_AT_BOUNDS mode, which can take a long time
+ with a large buffer.
+
+ If incremental wrapping is enabled, the lines are counted in small slices
+ in an idle callback, see Fl::add_idle(). Until this is done, the number
+ of lines and the top line number are estimated from the number of
+ newlines, so the vertical scrollbar may be inaccurate for a while. The
+ counts are kept per block of text until the wrap width or the fonts
+ change, and the modifications of the buffer only count their blocks again.
+
+ \param onoff non-zero to count wrapped lines in the background (default: off)
+ \see wrap_mode()
+ */
+void Fl_Text_Display::incremental_wrap(int onoff) {
+  if (!onoff == !mWrapCount)
+    return;
+  if (onoff) {
+    mWrapCount = (Fl_Text_Wrap_Count *) calloc(1, sizeof(Fl_Text_Wrap_Count));
+    mWrapCount->width = -1;
+    if (buffer() && mContinuousWrap)
+      count_wrapped_lines();
+  } else {
+    if (mWrapCount->idle)
+      Fl::remove_idle(wrap_idle_cb, this);
+    free(mWrapCount->blocks);
+    free(mWrapCount);
+    mWrapCount = NULL;
+  }
+}
+
+
+/**
+ \brief Counts the lines of the buffer and the top line number after wrapping.
+
+ This sets mNBufferLines and mTopLineNum when the wrap width may have changed.
+ mFirstChar must be at the start of a line. With incremental_wrap(), this
+ counts the first slice of text and estimates the rest.
+ */
+void Fl_Text_Display::count_wrapped_lines() {
+  Fl_Text_Wrap_Count *c = mWrapCount;
+  if (!c || !mContinuousWrap) {
+    if (c) {
+      c->width = -1;
+      c->done = 0;
+    }
+    mNBufferLines = count_lines(0, buffer()->length(), true);
+    mTopLineNum = count_lines(0, mFirstChar, true) + 1;
+    return;
+  }
+
+  int width = mWrapMarginPix ? mWrapMarginPix : text_area.w;
+  if (c->width != width || c->font != textfont() || c->size != textsize()
+      || c->styles != mStyleTable || c->nstyles != mNStyles) {
+    c->width = width;
+    c->font = textfont();
+    c->size = textsize();
+    c->styles = mStyleTable;
+    c->nstyles = mNStyles;
+    c->n = c->pos = c->lines = 0;
+    c->done = c->exact = 0;
+  }
+  if (!c->done)
+    count_wrapped_lines_slice(WRAP_SLICE_SIZE);
+  if (c->done || !c->exact)
+    update_wrapped_line_count();
+  if (!c->done && !c->idle) {
+    Fl::add_idle(wrap_idle_cb, this);
+    c->idle = 1;
+  }
+}
+
+
+/**
+ \brief Counts the wrapped lines of the next blocks of text.
+ \param size number of bytes to count, rounded up to whole blocks
+ */
+void Fl_Text_Display::count_wrapped_lines_slice(int size) {
+  Fl_Text_Wrap_Count *c = mWrapCount;
+  Fl_Text_Buffer *buf = buffer();
+  int len = buf->length();
+  int end = min(c->pos + size, len);
+  while (c->pos < end) {
+    int blockEnd = buf->line_end(min(c->pos + WRAP_BLOCK_SIZE, len));
+    if (blockEnd < len)
+      blockEnd++;
+    int lines, retPos, retLineStart, retLineEnd;
+    wrapped_line_counter(buf, c->pos, blockEnd, INT_MAX, true, 0, &retPos,
+                         &lines, &retLineStart, &retLineEnd, false);
+    if (blockEnd == len && buf->byte_at(len - 1) != '\n')
+      lines++;
+    if (c->n == c->alloc) {
+      c->alloc = c->alloc ? 2 * c->alloc : 64;
+      c->blocks = (Fl_Text_Wrap_Block *) realloc(c->blocks, c->alloc * sizeof(Fl_Text_Wrap_Block));
+    }
+    c->blocks[c->n].start = c->pos;
+    c->blocks[c->n++].lines = lines;
+    c->lines += lines;
+    c->pos = blockEnd;
+  }
+  if (c->pos >= len)
+    c->done = 1;
+}
+
+
+/**
+ \brief Sets mNBufferLines and mTopLineNum from the wrapped lines counted so far.
+
+ If the count is not done, the lines of the rest of the text are estimated
+ from its newlines and the ratio of lines to newlines of the counted text.
+ */
+void Fl_Text_Display::update_wrapped_line_count() {
+  Fl_Text_Wrap_Count *c = mWrapCount;
+  if (c->done) {
+    mNBufferLines = c->lines;
+    mTopLineNum = wrapped_lines_before(mFirstChar) + 1;
+    return;
+  }
+  Fl_Text_Buffer *buf = buffer();
+  int len = buf->length();
+  int rest = buf->count_lines(c->pos, len);
+  int counted = buf->count_lines(0, c->pos);
+  double ratio = counted ? double(c->lines) / counted : 1.0;
+  mNBufferLines = c->lines + int(rest * ratio);
+  if (mFirstChar < c->pos)
+    mTopLineNum = wrapped_lines_before(mFirstChar) + 1;
+  else
+    mTopLineNum = c->lines + int(buf->count_lines(c->pos, mFirstChar) * ratio) + 1;
+}
+
+
+/**
+ \brief Returns the number of wrapped lines before a position of the counted text.
+ */
+int Fl_Text_Display::wrapped_lines_before(int pos) const {
+  const Fl_Text_Wrap_Count *c = mWrapCount;
+  if (!c->n)
+    return count_lines(0, pos, true);
+  int k = wrap_block(c, pos);
+  int lines = 0;
+  for (int i = 0; i < k; i++)
+    lines += c->blocks[i].lines;
+  return lines + count_lines(c->blocks[k].start, pos, true);
+}
+
+
+/**
+ \brief Counts the next slice of wrapped lines when the application is idle.
+ */
+void Fl_Text_Display::wrap_idle_cb(void *data) {
+  Fl_Text_Display *d = (Fl_Text_Display *) data;
+  Fl_Text_Wrap_Count *c = d->mWrapCount;
+  if (!c->done && d->buffer() && d->mContinuousWrap) {
+    d->count_wrapped_lines_slice(WRAP_SLICE_SIZE);
+    if (c->done || !c->exact) {
+      d->update_wrapped_line_count();
+      d->update_v_scrollbar();
+    }
+  }
+  if (c->done || !d->buffer() || !d->mContinuousWrap) {
+    Fl::remove_idle(wrap_idle_cb, d);
+    c->idle = 0;
+  }
+}
+
+
 /**
  \brief Inserts "text" at the current cursor location.
 
@@ -1687,6 +2371,10 @@ void Fl_Text_Display::buffer_modified_cb( int pos, int nInserted, int nDeleted,
   if ( nInserted != 0 || nDeleted != 0 )
     textD->mCursorPreferredXPos = -1;
 
+  if (textD->mLineWidths)
+    line_widths_changed(textD->mLineWidths, pos, pos + max(nDeleted, nRestyled),
+                        nInserted - nDeleted);
+
   /* Count the number of lines inserted and deleted, and in the case
    of continuous wrap mode, how much has changed */
   if (textD->mContinuousWrap) {
@@ -1697,13 +2385,17 @@ void Fl_Text_Display::buffer_modified_cb( int pos, int nInserted, int nDeleted,
     linesDeleted = nDeleted == 0 ? 0 : countlines( deletedText );
   }
 
-  /* Update the line starts and mTopLineNum */
+  /* Update the line starts and mTopLineNum, and remember if all of the
+   changes were before the displayed text, e.g. trimmed log lines */
+  int changedAbove = 0;
   if ( nInserted != 0 || nDeleted != 0 ) {
     if (textD->mContinuousWrap) {
+      int charsDeleted = nDeleted + pos-wrapModStart + (wrapModEnd-(pos+nInserted));
+      changedAbove = wrapModStart + charsDeleted < oldFirstChar;
       textD->update_line_starts( wrapModStart, wrapModEnd-wrapModStart,
-                                nDeleted + pos-wrapModStart + (wrapModEnd-(pos+nInserted)),
-                                linesInserted, linesDeleted, &scrolled );
+                                charsDeleted, linesInserted, linesDeleted, &scrolled );
     } else {
+      changedAbove = pos + nDeleted < oldFirstChar;
       textD->update_line_starts( pos, nInserted, nDeleted, linesInserted,
                                 linesDeleted, &scrolled );
     }
@@ -1724,6 +2416,29 @@ void Fl_Text_Display::buffer_modified_cb( int pos, int nInserted, int nDeleted,
   /* Update the line count for the whole buffer */
   textD->mNBufferLines += linesInserted - linesDeleted;
 
+  Fl_Text_Wrap_Count *wc = textD->mWrapCount;
+  if (wc && textD->mContinuousWrap && (nInserted != 0 || nDeleted != 0)
+      && wrap_count_modified(wc, pos, nInserted, nDeleted, wrapModEnd,
+                             linesInserted - linesDeleted) && !wc->idle) {
+    Fl::add_idle(wrap_idle_cb, textD);
+    wc->idle = 1;
+  }
+
+  /* Style the modified lines again, and the following displayed lines up to
+   those whose highlighting state did not change */
+  int styledEnd = -1;
+  Fl_Text_Highlight *hl = textD->mHighlight;
+  if (hl && (nInserted != 0 || nDeleted != 0)) {
+    highlight_modified(hl, buf, pos, nInserted, nDeleted, deletedText);
+    int last = highlight_line_of(hl, buf, textD->mLastChar);
+    int stable = highlight_states(hl, buf, last, INT_MAX);
+    styledEnd = stable < 0 ? buf->length() : highlight_line_start(hl, buf, stable);
+    if (!hl->idle) {
+      Fl::add_idle(highlight_idle_cb, textD);
+      hl->idle = 1;
+    }
+  }
+
   /* Update the cursor position */
   if ( textD->mCursorToHint != NO_HINT ) {
     textD->mCursorPos = textD->mCursorToHint;
@@ -1749,6 +2464,15 @@ void Fl_Text_Display::buffer_modified_cb( int pos, int nInserted, int nDeleted,
     return;
   }
 
+  /* If all of the changes were before the displayed text, it only moved in
+   the buffer; only the line numbers may have changed */
+  if ( changedAbove && styledEnd <= textD->mFirstChar
+      && !(textD->mStyleBuffer && textD->mStyleBuffer->primary_selection()->selected()) ) {
+    if ( textD->mLineNumWidth && linesInserted != linesDeleted )
+      textD->damage(FL_DAMAGE_EXPOSE);
+    return;
+  }
+
   /* If the changes didn't cause scrolling, decide the range of characters
    that need to be re-painted.  Also if the cursor position moved, be
    sure that the redisplay range covers the old cursor position so the
@@ -1800,6 +2524,8 @@ void Fl_Text_Display::buffer_modified_cb( int pos, int nInserted, int nDeleted,
    text).  Extend the redraw range to incorporate style changes */
   if ( textD->mStyleBuffer )
     textD->extend_range_for_styles( &startDispPos, &endDispPos );
+  if ( styledEnd > endDispPos )
+    endDispPos = styledEnd;
   IS_UTF8_ALIGNED2(buf, startDispPos)
   IS_UTF8_ALIGNED2(buf, endDispPos)
 
@@ -2510,6 +3236,8 @@ int Fl_Text_Display::position_style( int lineStartPos, int lineLen, int lineInde
       (mUnfinishedHighlightCB)( pos, mHighlightCBArg);
       style = (unsigned char) styleBuf->byte_at( pos);
     }
+  } else if ( mHighlight ) {
+    style = line_style( pos );
   }
   if (buf->primary_selection()->includes(pos))
     style |= PRIMARY_MASK;
@@ -2521,6 +3249,102 @@ int Fl_Text_Display::position_style( int lineStartPos, int lineLen, int lineInde
 }
 
 
+// forget the characters of a font when it has that many
+#define WIDTH_CACHE_MAX_KEYS 65536
+
+static void reset_width_cache(Fl_Text_Width_Cache *c, Fl_Font font, Fl_Fontsize size)
+{
+  c->font = font;
+  c->size = size;
+  c->driver = fl_graphics_driver;
+  c->scale = fl_graphics_driver->scale();
+  for (int i = 0; i < 128; i++)
+    c->ascii[i] = -1;
+  free(c->keys);
+  c->keys = NULL;
+  c->widths = NULL;
+  c->nkeys = c->nbuckets = 0;
+}
+
+static inline unsigned width_cache_hash(unsigned ucs, int nbuckets)
+{
+  return (ucs * 2654435761U) & (nbuckets - 1);
+}
+
+/*
+ Return the bucket of ucs in the hash table, inserting it if necessary.
+ */
+static int width_cache_bucket(Fl_Text_Width_Cache *c, unsigned ucs)
+{
+  if (c->nbuckets) {
+    unsigned h = width_cache_hash(ucs, c->nbuckets);
+    while (c->keys[h]) {
+      if (c->keys[h] == ucs)
+        return h;
+      h = (h + 1) & (c->nbuckets - 1);
+    }
+  }
+  if (2 * (c->nkeys + 1) > c->nbuckets) {
+    if (c->nkeys >= WIDTH_CACHE_MAX_KEYS)
+      c->nkeys = c->nbuckets = 0;
+    int n = c->nkeys ? 2 * c->nbuckets : 256;
+    // keys and widths share a single allocation
+    unsigned *keys = (unsigned *) calloc(n, sizeof(unsigned) + sizeof(double));
+    double *widths = (double *) (keys + n);
+    for (int i = 0; i < c->nbuckets; i++) {
+      if (!c->keys[i]) continue;
+      unsigned h = width_cache_hash(c->keys[i], n);
+      while (keys[h])
+        h = (h + 1) & (n - 1);
+      keys[h] = c->keys[i];
+      widths[h] = c->widths[i];
+    }
+    free(c->keys);
+    c->keys = keys;
+    c->widths = widths;
+    c->nbuckets = n;
+  }
+  unsigned h = width_cache_hash(ucs, c->nbuckets);
+  while (c->keys[h])
+    h = (h + 1) & (c->nbuckets - 1);
+  c->keys[h] = ucs;
+  c->widths[h] = -1;
+  c->nkeys++;
+  return h;
+}
+
+/*
+ Sum the cached widths of the characters of a string, measuring the
+ characters that are not in the cache.
+ */
+static double cached_width(Fl_Text_Width_Cache *c, const char *s, int n)
+{
+  int font_set = 0;
+  double w = 0;
+  for (int i = 0; i < n; ) {
+    unsigned char b = (unsigned char) s[i];
+    double *cw;
+    int l = 1;
+    if (b < 0x80) {
+      cw = c->ascii + b;
+    } else {
+      unsigned ucs = fl_utf8decode(s + i, s + n, &l);
+      cw = c->widths + width_cache_bucket(c, ucs);
+    }
+    if (*cw < 0) {
+      if (!font_set) {
+        fl_font(c->font, c->size);
+        font_set = 1;
+      }
+      *cw = fl_width(s + i, l);
+    }
+    w += *cw;
+    i += l;
+  }
+  return w;
+}
+
+
 /**
  \brief Find the width of a string in the font of a particular style.
 
@@ -2534,6 +3358,7 @@ double Fl_Text_Display::string_width( const char *string, int length, int style
 
   Fl_Font font;
   Fl_Fontsize fsize;
+  int slot = 0;
 
   if ( mNStyles && (style & STYLE_LOOKUP_MASK) ) {
     int si = (style & STYLE_LOOKUP_MASK) - 'A';
@@ -2542,12 +3367,26 @@ double Fl_Text_Display::string_width( const char *string, int length, int style
 
     font  = mStyleTable[si].font;
     fsize = mStyleTable[si].size;
+    slot = si + 1;
   } else {
     font  = textfont();
     fsize = textsize();
   }
-  fl_font( font, fsize );
-  return fl_width( string, length );
+  if (!fl_graphics_driver->has_feature(Fl_Graphics_Driver::ADDITIVE_WIDTH)) {
+    fl_font( font, fsize );
+    return fl_width( string, length );
+  }
+
+  if (slot >= mNWidthCaches) {
+    mWidthCache = (Fl_Text_Width_Cache *) realloc(mWidthCache, (slot + 1) * sizeof(Fl_Text_Width_Cache));
+    memset(mWidthCache + mNWidthCaches, 0, (slot + 1 - mNWidthCaches) * sizeof(Fl_Text_Width_Cache));
+    mNWidthCaches = slot + 1;
+  }
+  Fl_Text_Width_Cache *c = mWidthCache + slot;
+  if (c->font != font || c->size != fsize || !c->driver || c->driver != fl_graphics_driver
+      || c->scale != fl_graphics_driver->scale())
+    reset_width_cache(c, font, fsize);
+  return cached_width(c, string, length);
 }
 
 
@@ -2916,17 +3755,34 @@ int Fl_Text_Display::scroll_(int topLineNum, int horizOffset) {
 
   /* If the vertical scroll position has changed, update the line
    starts array and related counters in the text display */
+  int oldTopLineNum = mTopLineNum, oldHorizOffset = mHorizOffset;
   offset_line_starts(topLineNum);
 
   /* Just setting mHorizOffset is enough information for redisplay */
   mHorizOffset = horizOffset;
 
-  // redraw all text
-  damage(FL_DAMAGE_EXPOSE);
+  /* Unless all text is redrawn anyway, remember how far the text moved, so
+   that draw() moves what is still displayed and only draws the rest */
+  if (!(damage() & (FL_DAMAGE_ALL | FL_DAMAGE_EXPOSE)) && mMaxsize) {
+    mScrollDX += oldHorizOffset - mHorizOffset;
+    mScrollDY += (oldTopLineNum - mTopLineNum) * mMaxsize;
+    damage(FL_DAMAGE_SCROLL);
+  } else {
+    // redraw all text
+    damage(FL_DAMAGE_EXPOSE);
+  }
   return 1;
 }
 
 
+/**
+ \brief Draw the text in an area exposed by fl_scroll() in draw().
+ */
+void Fl_Text_Display::scroll_area_cb(void *v, int X, int Y, int W, int H) {
+  ((Fl_Text_Display *)v)->draw_text(X, Y, W, H);
+}
+
+
 /**
  \brief Update vertical scrollbar.
 
@@ -3578,6 +4434,8 @@ double Fl_Text_Display::measure_proportional_character(const char *s, int xPix,
   int charLen = fl_utf8len1(*s), style = 0;
   if (mStyleBuffer) {
     style = mStyleBuffer->byte_at(pos);
+  } else if (mHighlight) {
+    style = line_style(pos);
   }
   return string_width(s, charLen, style);
 }
@@ -3795,6 +4653,26 @@ void Fl_Text_Display::draw(void) {
   update_child(*mVScrollBar);
   update_child(*mHScrollBar);
 
+  // move the text that is still displayed after scrolling, and draw the
+  // text scrolled into view
+  if (mScrollDX || mScrollDY) {
+    if (!(damage() & (FL_DAMAGE_ALL | FL_DAMAGE_EXPOSE))) {
+      // only move whole lines, the partial line at the bottom is drawn again
+      int H = mScrollDY ? text_area.h / mMaxsize * mMaxsize : text_area.h;
+      float scale = Fl_Surface_Device::surface()->driver()->scale();
+      if (scale != int(scale) ||
+          abs(mScrollDX) >= text_area.w || abs(mScrollDY) >= H) {
+        draw_text(text_area.x, text_area.y, text_area.w, text_area.h);
+      } else {
+        fl_scroll(text_area.x, text_area.y, text_area.w, H,
+                  mScrollDX, mScrollDY, scroll_area_cb, this);
+        if (H < text_area.h)
+          draw_text(text_area.x, text_area.y + H, text_area.w, text_area.h - H);
+      }
+    }
+    mScrollDX = mScrollDY = 0;
+  }
+
   // draw all of the text
   if (damage() & (FL_DAMAGE_ALL | FL_DAMAGE_EXPOSE)) {
     //printf("drawing all text\n");
@@ -3814,7 +4692,8 @@ void Fl_Text_Display::draw(void) {
     fl_push_clip(text_area.x, text_area.y,
                  text_area.w, text_area.h);
     //printf("drawing text from %d to %d\n", damage_range1_start, damage_range1_end);
-    draw_range(damage_range1_start, damage_range1_end);
+    if (damage_range1_end != -1)    // not only scrolled?
+      draw_range(damage_range1_start, damage_range1_end);
     if (damage_range2_end != -1) {
       //printf("drawing text from %d to %d\n", damage_range2_start, damage_range2_end);
       draw_range(damage_range2_start, damage_range2_end);
@@ -0,0 +1,274 @@
+//
+// "$Id$"
+//
+// Timeout scheduler for the Fast Light Tool Kit (FLTK).
+//
+// Copyright 1998-2018 by Bill Spitzak and others.
+//
+// This library is free software. Distribution and use rights are outlined in
+// the file "COPYING" which should have been included with this file.  If this
+// file is missing or damaged, see the license at:
+//
+//     http://www.fltk.org/COPYING.php
+//
+// Please report all bugs and problems on the following page:
+//
+//     http://www.fltk.org/str.php
+//
+
+#include "Fl_Timeout_Queue.H"
+#include <FL/platform_types.h>
+#include <stdlib.h>
+
+// Slots are allocated in chunks of this size; the hash tables are resized
+// so that they always have at least as many buckets as allocated slots.
+#define CHUNK_SIZE 32
+
+Fl_Timeout_Queue::Fl_Timeout_Queue() {
+  entries_ = 0;
+  size_ = 0;
+  free_ = -1;
+  heap_[DUE] = heap_[LATEST] = 0;
+  count_ = 0;
+  buckets_ = 0;
+  id_buckets_ = 0;
+  nbuckets_ = 0;
+  last_id_ = 0;
+}
+
+Fl_Timeout_Queue::~Fl_Timeout_Queue() {
+  free(entries_);
+  free(heap_[DUE]);
+  free(heap_[LATEST]);
+  free(buckets_);
+  free(id_buckets_);
+}
+
+unsigned Fl_Timeout_Queue::hash(Fl_Timeout_Handler cb, void *data) const {
+  fl_uintptr_t h = (fl_uintptr_t)cb * 31 + (fl_uintptr_t)data;
+  h ^= h >> 16;
+  h *= 0x45d9f3b;
+  h ^= h >> 16;
+  return (unsigned)h & (nbuckets_ - 1);
+}
+
+// Returns the slot of the pending timeout with this id, or -1.
+int Fl_Timeout_Queue::find(Fl_Timeout_Id id) const {
+  if (!count_ || !id) return -1;
+  for (int slot = id_buckets_[id & (nbuckets_ - 1)]; slot >= 0; slot = entries_[slot].id_next)
+    if (entries_[slot].id == id) return slot;
+  return -1;
+}
+
+// Returns non-zero if slot a comes before slot b in heap h.
+int Fl_Timeout_Queue::before(int h, int a, int b) const {
+  const Entry &ea = entries_[a], &eb = entries_[b];
+  if (ea.time[h] != eb.time[h]) return ea.time[h] < eb.time[h];
+  return (int)(ea.id - eb.id) < 0;
+}
+
+void Fl_Timeout_Queue::place(int h, int pos, int slot) {
+  heap_[h][pos] = slot;
+  entries_[slot].heap_pos[h] = pos;
+}
+
+void Fl_Timeout_Queue::sift_up(int h, int pos) {
+  int *heap = heap_[h];
+  int slot = heap[pos];
+  while (pos > 0) {
+    int parent = (pos - 1) / 2;
+    if (!before(h, slot, heap[parent])) break;
+    place(h, pos, heap[parent]);
+    pos = parent;
+  }
+  place(h, pos, slot);
+}
+
+void Fl_Timeout_Queue::sift_down(int h, int pos) {
+  int *heap = heap_[h];
+  int slot = heap[pos];
+  for (;;) {
+    int child = 2 * pos + 1;
+    if (child >= count_) break;
+    if (child + 1 < count_ && before(h, heap[child + 1], heap[child])) child++;
+    if (!before(h, heap[child], slot)) break;
+    place(h, pos, heap[child]);
+    pos = child;
+  }
+  place(h, pos, slot);
+}
+
+// Removes a slot from heap h. count_ must already be decremented.
+void Fl_Timeout_Queue::heap_remove(int h, int slot) {
+  int pos = entries_[slot].heap_pos[h];
+  entries_[slot].heap_pos[h] = -1;
+  if (pos == count_) return;
+  int *heap = heap_[h];
+  place(h, pos, heap[count_]);
+  if (pos > 0 && before(h, heap[pos], heap[(pos - 1) / 2])) sift_up(h, pos);
+  else sift_down(h, pos);
+}
+
+void Fl_Timeout_Queue::grow() {
+  int n = size_ ? 2 * size_ : CHUNK_SIZE;
+  entries_ = (Entry*)realloc(entries_, n * sizeof(Entry));
+  heap_[DUE] = (int*)realloc(heap_[DUE], n * sizeof(int));
+  heap_[LATEST] = (int*)realloc(heap_[LATEST], n * sizeof(int));
+  for (int i = n - 1; i >= size_; i--) {
+    entries_[i].heap_pos[DUE] = entries_[i].heap_pos[LATEST] = -1;
+    entries_[i].next = free_;
+    free_ = i;
+  }
+  size_ = n;
+  rehash(n);
+}
+
+void Fl_Timeout_Queue::rehash(int nbuckets) {
+  free(buckets_);
+  free(id_buckets_);
+  buckets_ = (int*)malloc(nbuckets * sizeof(int));
+  id_buckets_ = (int*)malloc(nbuckets * sizeof(int));
+  nbuckets_ = nbuckets;
+  for (int i = 0; i < nbuckets; i++) buckets_[i] = id_buckets_[i] = -1;
+  for (int i = 0; i < count_; i++) {
+    int slot = heap_[DUE][i];
+    Entry &e = entries_[slot];
+    unsigned h;
+    if (!e.by_id) {
+      h = hash(e.cb, e.data);
+      e.next = buckets_[h];
+      buckets_[h] = slot;
+    }
+    h = e.id & (nbuckets - 1);
+    e.id_next = id_buckets_[h];
+    id_buckets_[h] = slot;
+  }
+}
+
+// Removes a pending slot from the hash tables.
+void Fl_Timeout_Queue::unlink(int slot) {
+  int *p;
+  if (!entries_[slot].by_id) {
+    p = &buckets_[hash(entries_[slot].cb, entries_[slot].data)];
+    while (*p != slot) p = &entries_[*p].next;
+    *p = entries_[slot].next;
+  }
+  p = &id_buckets_[entries_[slot].id & (nbuckets_ - 1)];
+  while (*p != slot) p = &entries_[*p].id_next;
+  *p = entries_[slot].id_next;
+}
+
+// Removes a pending slot from the heaps and the hash tables and puts it
+// on the free list.
+void Fl_Timeout_Queue::release(int slot) {
+  unlink(slot);
+  count_--;
+  heap_remove(DUE, slot);
+  heap_remove(LATEST, slot);
+  entries_[slot].next = free_;
+  free_ = slot;
+}
+
+/**
+ Schedules \p cb to be called with \p data at the absolute time \p deadline,
+ or up to \p slack seconds later.
+ Timeouts with equal deadlines are called in the order they were added.
+ If \p by_id is non-zero, the timeout can only be found by its identifier,
+ and not by has() and remove() with its callback and data.
+ \return an identifier of the new timeout, never 0 nor the identifier of
+  another pending timeout
+ */
+Fl_Timeout_Id Fl_Timeout_Queue::add(double deadline, Fl_Timeout_Handler cb, void *data, double slack,
+                                    int by_id) {
+  if (free_ < 0) grow();
+  int slot = free_;
+  Entry &e = entries_[slot];
+  free_ = e.next;
+  e.time[DUE] = deadline;
+  e.time[LATEST] = slack > 0.0 ? deadline + slack : deadline;
+  e.cb = cb;
+  e.data = data;
+  e.by_id = by_id;
+  // after the identifiers wrap around, skip those of pending timeouts
+  do {
+    if (!++last_id_) ++last_id_;
+  } while (find(last_id_) >= 0);
+  e.id = last_id_;
+  unsigned h;
+  if (!by_id) {
+    h = hash(cb, data);
+    e.next = buckets_[h];
+    buckets_[h] = slot;
+  }
+  h = e.id & (nbuckets_ - 1);
+  e.id_next = id_buckets_[h];
+  id_buckets_[h] = slot;
+  heap_[DUE][count_] = slot;
+  heap_[LATEST][count_] = slot;
+  sift_up(DUE, count_);
+  sift_up(LATEST, count_);
+  count_++;
+  return e.id;
+}
+
+/**
+ Removes the timeout with the earliest deadline if it is due at time \p now.
+ \return non-zero if a timeout was removed; its callback, data and deadline
+  are then returned in \p cb, \p data and \p deadline.
+ */
+int Fl_Timeout_Queue::pop_expired(double now, Fl_Timeout_Handler &cb, void *&data, double &deadline) {
+  if (!count_) return 0;
+  int slot = heap_[DUE][0];
+  Entry &e = entries_[slot];
+  if (e.time[DUE] > now) return 0;
+  cb = e.cb;
+  data = e.data;
+  deadline = e.time[DUE];
+  release(slot);
+  return 1;
+}
+
+/**
+ Returns non-zero if a timeout for \p cb with \p data is pending.
+ */
+int Fl_Timeout_Queue::has(Fl_Timeout_Handler cb, void *data) const {
+  if (!count_) return 0;
+  for (int slot = buckets_[hash(cb, data)]; slot >= 0; slot = entries_[slot].next)
+    if (entries_[slot].cb == cb && entries_[slot].data == data) return 1;
+  return 0;
+}
+
+/**
+ Removes all pending timeouts for \p cb with \p data.
+ If \p data is NULL, all timeouts for \p cb are removed, whatever their data;
+ this needs a scan of all pending timeouts.
+ */
+void Fl_Timeout_Queue::remove(Fl_Timeout_Handler cb, void *data) {
+  if (!count_) return;
+  if (!data) {
+    // slots don't move while the heaps are reordered, so scan them instead
+    for (int slot = 0; slot < size_; slot++)
+      if (entries_[slot].heap_pos[DUE] >= 0 && !entries_[slot].by_id && entries_[slot].cb == cb)
+        release(slot);
+    return;
+  }
+  int slot = buckets_[hash(cb, data)];
+  while (slot >= 0) {
+    int next = entries_[slot].next;
+    if (entries_[slot].cb == cb && entries_[slot].data == data) release(slot);
+    slot = next;
+  }
+}
+
+/**
+ Removes the pending timeout identified by \p id.
+ It is harmless to remove a timeout that was already called or removed.
+ */
+void Fl_Timeout_Queue::remove(Fl_Timeout_Id id) {
+  int slot = find(id);
+  if (slot >= 0) release(slot);
+}
+
+//
+// End of "$Id$".
+//
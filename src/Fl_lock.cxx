@@ -66,67 +66,194 @@
    returns the most recent value!
 */
 
-#ifndef FL_DOXYGEN
-Fl_Awake_Handler *Fl::awake_ring_;
-void **Fl::awake_data_;
-int Fl::awake_ring_size_;
-int Fl::awake_ring_head_;
-int Fl::awake_ring_tail_;
+/*
+   Awake handlers are queued in a lock-free stack: producer threads push
+   nodes with a compare-and-swap on awake_head, and the main thread takes
+   the whole stack at once, reverses it into awake_batch (so handlers are
+   called in the order they were queued) and calls them from there. There
+   is no ABA problem since only the main thread ever removes nodes, and
+   always all of them. The queue is only limited by available memory.
+
+   Only the thread that finds the stack empty needs to wake the main
+   thread: all handlers queued later are called in the same batch.
+
+   Without atomic operations, the compare-and-swap is done with
+   lock_ring() and unlock_ring().
+*/
+
+struct Fl_Awake_Node {
+  Fl_Awake_Handler func;
+  void *data;
+  Fl_Awake_Node *next;
+};
+
+static Fl_Awake_Node *volatile awake_head; // shared stack, newest first
+static Fl_Awake_Node *awake_batch;          // main thread only, oldest first
+
+// statistics, see Fl::awake_statistics()
+static volatile long awake_enqueued;
+static volatile long awake_dropped;
+static volatile long awake_depth;
+static volatile long awake_max_depth;
+
+#if defined(FL_CFG_SYS_WIN32)
+#  include <windows.h>
+void *fl_cas_ptr(void *volatile *p, void *oldval, void *newval) {
+  return InterlockedCompareExchangePointer(p, newval, oldval);
+}
+static long cas_long(volatile long *p, long oldval, long newval) {
+  return InterlockedCompareExchange(p, newval, oldval);
+}
+static long add_long(volatile long *p, long v) {
+  return InterlockedExchangeAdd(p, v) + v;
+}
+static long long add_llong(volatile long long *p, long long v) {
+  return InterlockedExchangeAdd64(p, v) + v;
+}
+#elif defined(__GNUC__)
+void *fl_cas_ptr(void *volatile *p, void *oldval, void *newval) {
+  return __sync_val_compare_and_swap(p, oldval, newval);
+}
+static long cas_long(volatile long *p, long oldval, long newval) {
+  return __sync_val_compare_and_swap(p, oldval, newval);
+}
+static long add_long(volatile long *p, long v) {
+  return __sync_add_and_fetch(p, v);
+}
+static long long add_llong(volatile long long *p, long long v) {
+  return __sync_add_and_fetch(p, v);
+}
+#else
+#  if defined(HAVE_PTHREAD)
+#    include <pthread.h>
+static pthread_mutex_t ring_mutex = PTHREAD_MUTEX_INITIALIZER;
+static void lock_ring() { pthread_mutex_lock(&ring_mutex); }
+static void unlock_ring() { pthread_mutex_unlock(&ring_mutex); }
+#  else
+static void lock_ring() {}
+static void unlock_ring() {}
+#  endif
+void *fl_cas_ptr(void *volatile *p, void *oldval, void *newval) {
+  lock_ring();
+  void *r = *p;
+  if (r == oldval) *p = newval;
+  unlock_ring();
+  return r;
+}
+static long cas_long(volatile long *p, long oldval, long newval) {
+  lock_ring();
+  long r = *p;
+  if (r == oldval) *p = newval;
+  unlock_ring();
+  return r;
+}
+static long add_long(volatile long *p, long v) {
+  lock_ring();
+  long r = (*p += v);
+  unlock_ring();
+  return r;
+}
+static long long add_llong(volatile long long *p, long long v) {
+  lock_ring();
+  long long r = (*p += v);
+  unlock_ring();
+  return r;
+}
+#endif
+
+/*
+   Statistics about Fl::lock() are updated with the atomic operations above
+   when a thread has to wait for the lock, see Fl::lock_statistics().
+*/
+
+static volatile long lock_contended;
+static volatile long long lock_wait_usec; // 32 bits would wrap after 36 minutes
+
+// set by Fl::use_shared_lock(), used when Fl::lock() is first called
+static int shared_lock_enabled;
+
+#if defined(FL_CFG_SYS_WIN32)
+static double lock_clock() {
+  static LARGE_INTEGER freq;
+  LARGE_INTEGER now;
+  if (!freq.QuadPart) QueryPerformanceFrequency(&freq);
+  QueryPerformanceCounter(&now);
+  return (double)now.QuadPart / (double)freq.QuadPart;
+}
+#else
+#  include <time.h>
+#  include <sys/time.h>
+#  include <unistd.h>
+static double lock_clock() {
+#  if defined(_POSIX_MONOTONIC_CLOCK) && _POSIX_MONOTONIC_CLOCK >= 0
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#  endif
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1e6;
+}
 #endif
 
-static const int AWAKE_RING_SIZE = 1024;
-static void lock_ring();
-static void unlock_ring();
+// Records that a thread had to wait for the lock since time start.
+static void count_lock_wait(double start) {
+  add_long(&lock_contended, 1);
+  add_llong(&lock_wait_usec, (long long)((lock_clock() - start) * 1e6));
+}
+
+// Queues an awake handler. Returns -1 on error, 1 if the queue was empty,
+// and 0 otherwise.
+static int push_awake_handler(Fl_Awake_Handler func, void *data) {
+  Fl_Awake_Node *node = (Fl_Awake_Node*)malloc(sizeof(Fl_Awake_Node));
+  if (!node) {
+    add_long(&awake_dropped, 1);
+    return -1;
+  }
+  node->func = func;
+  node->data = data;
+  Fl_Awake_Node *head;
+  do {
+    head = awake_head;
+    node->next = head;
+  } while (fl_cas_ptr((void *volatile *)&awake_head, head, node) != head);
+  add_long(&awake_enqueued, 1);
+  long depth = add_long(&awake_depth, 1), max;
+  while (depth > (max = awake_max_depth) && cas_long(&awake_max_depth, max, depth) != max) {}
+  return head ? 0 : 1;
+}
 
 /** Adds an awake handler for use in awake(). */
 int Fl::add_awake_handler_(Fl_Awake_Handler func, void *data)
 {
-  int ret = 0;
-  lock_ring();
-  if (!awake_ring_) {
-    awake_ring_size_ = AWAKE_RING_SIZE;
-    awake_ring_ = (Fl_Awake_Handler*)malloc(awake_ring_size_*sizeof(Fl_Awake_Handler));
-    awake_data_ = (void**)malloc(awake_ring_size_*sizeof(void*));
-    // explicitly initialize the head and tail indices
-    awake_ring_head_= awake_ring_tail_ = 0;
-  }
-  // The next head index we will want (not the current index):
-  // We use this to check if the ring-buffer is full or not
-  // (and to update awake_ring_head_ if we do use the current index.)
-  int next_head = awake_ring_head_ + 1;
-  if (next_head >= awake_ring_size_) {
-    next_head = 0;
-  }
-  // check that the ring buffer is not full, and that it exists
-  if ((!awake_ring_) || (next_head == awake_ring_tail_)) {
-    // ring is non-existent or full. Return -1 as an error indicator.
-    ret = -1;
-  } else {
-    awake_ring_[awake_ring_head_] = func;
-    awake_data_[awake_ring_head_] = data;
-    awake_ring_head_ = next_head;
-  }
-  unlock_ring();
-  return ret;
+  return push_awake_handler(func, data) < 0 ? -1 : 0;
 }
 
-/** Gets the last stored awake handler for use in awake(). */
+/** Gets the oldest stored awake handler for use in awake().
+ This must only be called by the main thread. */
 int Fl::get_awake_handler_(Fl_Awake_Handler &func, void *&data)
 {
-  int ret = 0;
-  lock_ring();
-  if ((!awake_ring_) || (awake_ring_head_ == awake_ring_tail_)) {
-    ret = -1;
-  } else {
-    func = awake_ring_[awake_ring_tail_];
-    data = awake_data_[awake_ring_tail_];
-    ++awake_ring_tail_;
-    if (awake_ring_tail_ >= awake_ring_size_) {
-      awake_ring_tail_ = 0;
+  if (!awake_batch) {
+    if (!awake_head) return -1;
+    Fl_Awake_Node *head;
+    do {
+      head = awake_head;
+    } while (fl_cas_ptr((void *volatile *)&awake_head, head, 0) != head);
+    // reverse the stack into the batch
+    while (head) {
+      Fl_Awake_Node *next = head->next;
+      head->next = awake_batch;
+      awake_batch = head;
+      head = next;
     }
   }
-  unlock_ring();
-  return ret;
+  Fl_Awake_Node *node = awake_batch;
+  awake_batch = node->next;
+  func = node->func;
+  data = node->data;
+  free(node);
+  add_long(&awake_depth, -1);
+  return 0;
 }
 
 /**
@@ -134,17 +261,106 @@ int Fl::get_awake_handler_(Fl_Awake_Handler &func, void *&data)
  Registers a function that will be 
  called by the main thread during the next message handling cycle. 
  Returns 0 if the callback function was registered, 
- and -1 if registration failed. Over a thousand awake callbacks can be
- registered simultaneously.
+ and -1 if registration failed. The number of awake callbacks that can be
+ registered simultaneously is only limited by available memory.
+
+ Registering a callback is lock-free. The main thread is only woken up
+ when the first callback is registered, and then calls all registered
+ callbacks in the order they were registered.
  
  \see Fl::awake(void* message=0)
+ \see Fl::awake_statistics()
 */
 int Fl::awake(Fl_Awake_Handler func, void *data) {
-  int ret = add_awake_handler_(func, data);
-  Fl::awake();
-  return ret;
+  int ret = push_awake_handler(func, data);
+  if (ret > 0) Fl::awake();
+  return ret < 0 ? -1 : 0;
+}
+
+/**
+ Returns statistics about the awake callbacks registered with
+ Fl::awake(Fl_Awake_Handler, void*).
+ \param[out] enqueued   number of callbacks registered since the program started
+ \param[out] dropped    number of callbacks that could not be registered
+ \param[out] max_depth  largest number of callbacks waiting to be called
+ \version 1.4.0
+*/
+void Fl::awake_statistics(unsigned long &enqueued, unsigned long &dropped,
+                          unsigned long &max_depth) {
+  enqueued = (unsigned long)awake_enqueued;
+  dropped = (unsigned long)awake_dropped;
+  max_depth = (unsigned long)awake_max_depth;
+}
+
+/**
+ Returns statistics about the contention of the lock set with Fl::lock()
+ and Fl::lock_shared().
+ A thread is only counted when it could not get the lock immediately,
+ so these values cost nothing on the fast path and are meant to be
+ monitored in production: a high wait time means that threads hold the
+ lock too long, or that they should use lock_shared().
+ \param[out] contended  number of times a thread had to wait for the lock
+ \param[out] wait_time  total time threads waited for the lock, in seconds
+ \version 1.4.0
+*/
+void Fl::lock_statistics(unsigned long &contended, double &wait_time) {
+  contended = (unsigned long)lock_contended;
+  wait_time = add_llong(&lock_wait_usec, 0) / 1e6; // atomic read on 32-bit systems too
+}
+
+/**
+ Enables or disables the shared lock mode.
+ In this mode, the lock set with Fl::lock() is a reader-writer lock:
+ threads that only read widgets or other FLTK data can call
+ Fl::lock_shared() instead of Fl::lock(), and then run concurrently
+ with each other. Fl::lock() still gives exclusive access, and the
+ main thread still holds it except while Fl::wait() is waiting for
+ events.
+
+ This must be called before the first call to Fl::lock(); later calls
+ have no effect. The shared lock mode is only available on POSIX systems
+ with read-write locks; elsewhere Fl::lock_shared() is the same as
+ Fl::lock().
+
+ With glibc, a thread waiting in Fl::lock() is served before threads
+ that call Fl::lock_shared() after it. Other systems may prefer readers:
+ there, as long as the shared locks of several threads overlap, a call
+ of Fl::lock(), e.g. by the main thread, keeps waiting.
+ \version 1.4.0
+ \see Fl::lock_shared()
+*/
+void Fl::use_shared_lock(int enable) {
+  shared_lock_enabled = enable;
 }
 
+/**
+ Returns non-zero if the shared lock mode was requested.
+ \see Fl::use_shared_lock(int)
+*/
+int Fl::use_shared_lock() {
+  return shared_lock_enabled;
+}
+
+/** \fn int Fl::lock_shared()
+    Blocks the current thread until it can read FLTK widgets and data.
+    Several threads can hold the shared lock at the same time, but
+    not while a thread holds the lock set with Fl::lock(). A thread
+    holding the shared lock must not modify widgets or call
+    Fl::lock(), and must not call lock_shared() again before
+    unlock_shared(). A thread that already holds Fl::lock() may call
+    lock_shared(), this is then the same as a nested Fl::lock().
+
+    Without the shared lock mode set with Fl::use_shared_lock(int),
+    this is the same as Fl::lock().
+
+    \return 0 if threading is available on the platform; non-zero
+    otherwise.
+    \version 1.4.0
+*/
+/** \fn void Fl::unlock_shared()
+    Releases the lock set with Fl::lock_shared().
+    \version 1.4.0
+*/
 /** \fn int Fl::lock()
     The lock() method blocks the current thread until it
     can safely access FLTK widgets and data. Child threads should
@@ -210,19 +426,6 @@ static DWORD main_thread;
 
 // Microsoft's version of a MUTEX...
 CRITICAL_SECTION cs;
-CRITICAL_SECTION *cs_ring;
-
-void unlock_ring() {
-  LeaveCriticalSection(cs_ring);
-}
-
-void lock_ring() {
-  if (!cs_ring) {
-    cs_ring = (CRITICAL_SECTION*)malloc(sizeof(CRITICAL_SECTION));
-    InitializeCriticalSection(cs_ring);
-  }
-  EnterCriticalSection(cs_ring);
-}
 
 //
 // 'unlock_function()' - Release the lock.
@@ -237,7 +440,11 @@ static void unlock_function() {
 //
 
 static void lock_function() {
-  EnterCriticalSection(&cs);
+  if (!TryEnterCriticalSection(&cs)) {
+    double start = lock_clock();
+    EnterCriticalSection(&cs);
+    count_lock_wait(start);
+  }
 }
 
 int Fl_WinAPI_System_Driver::lock() {
@@ -260,6 +467,34 @@ void Fl_WinAPI_System_Driver::unlock() {
 void Fl_WinAPI_System_Driver::awake(void* msg) {
   PostThreadMessage( main_thread, fl_wake_msg, (WPARAM)msg, 0);
 }
+
+struct Fl_Thread_Start {
+  void *(*func)(void *);
+  void *data;
+};
+
+static unsigned __stdcall thread_start(void *p) {
+  Fl_Thread_Start start = *(Fl_Thread_Start *)p;
+  free(p);
+  start.func(start.data);
+  return 0;
+}
+
+// Threads are only started once Fl::lock() was called, so that they
+// can report to the main thread with Fl::awake()
+int Fl_WinAPI_System_Driver::create_thread(void *(*f)(void *), void *data) {
+  if (!main_thread) return -1;
+  Fl_Thread_Start *start = (Fl_Thread_Start *)malloc(sizeof(Fl_Thread_Start));
+  start->func = f;
+  start->data = data;
+  uintptr_t thread = _beginthreadex(NULL, 0, thread_start, start, 0, NULL);
+  if (!thread) {
+    free(start);
+    return -1;
+  }
+  CloseHandle((HANDLE)thread);
+  return 0;
+}
 #endif // FL_CFG_SYS_WIN32
 
 
@@ -286,7 +521,11 @@ static void lock_function_init_std() {
 
 static void lock_function_std() {
   if (!counter || owner != pthread_self()) {
-    pthread_mutex_lock(&fltk_mutex);
+    if (pthread_mutex_trylock(&fltk_mutex)) {
+      double start = lock_clock();
+      pthread_mutex_lock(&fltk_mutex);
+      count_lock_wait(start);
+    }
     owner = pthread_self();
   }
   counter++;
@@ -310,7 +549,11 @@ static bool lock_function_init_rec() {
 }
 
 static void lock_function_rec() {
-  pthread_mutex_lock(&fltk_mutex);
+  if (pthread_mutex_trylock(&fltk_mutex)) {
+    double start = lock_clock();
+    pthread_mutex_lock(&fltk_mutex);
+    count_lock_wait(start);
+  }
 }
 
 static void unlock_function_rec() {
@@ -318,6 +561,45 @@ static void unlock_function_rec() {
 }
 #  endif // PTHREAD_MUTEX_RECURSIVE
 
+#  if defined(_POSIX_READER_WRITER_LOCKS) && _POSIX_READER_WRITER_LOCKS > 0
+#    define USE_RWLOCK 1
+
+// In shared lock mode, Fl::lock() takes the write lock and
+// Fl::lock_shared() takes the read lock. The write lock is made
+// recursive with the same owner and counter as lock_function_std().
+static pthread_rwlock_t fltk_rwlock;
+
+// Initializes the read-write lock. glibc prefers readers by default: as
+// long as the read locks of several threads overlap, Fl::lock() would
+// wait, so waiting writers are preferred there.
+static int init_rwlock() {
+  pthread_rwlockattr_t attr;
+  if (pthread_rwlockattr_init(&attr)) return -1;
+#    if defined(__GLIBC__)
+  pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#    endif
+  int r = pthread_rwlock_init(&fltk_rwlock, &attr);
+  pthread_rwlockattr_destroy(&attr);
+  return r;
+}
+
+static void lock_function_rw() {
+  if (!counter || !pthread_equal(owner, pthread_self())) {
+    if (pthread_rwlock_trywrlock(&fltk_rwlock)) {
+      double start = lock_clock();
+      pthread_rwlock_wrlock(&fltk_rwlock);
+      count_lock_wait(start);
+    }
+    owner = pthread_self();
+  }
+  counter++;
+}
+
+static void unlock_function_rw() {
+  if (!--counter) pthread_rwlock_unlock(&fltk_rwlock);
+}
+#  endif // _POSIX_READER_WRITER_LOCKS
+
 void Fl_Posix_System_Driver::awake(void* msg) {
   if (write(thread_filedes[1], &msg, sizeof(void*))==0) { /* ignore */ }
 }
@@ -344,6 +626,28 @@ static void thread_awake_cb(int fd, void*) {
 extern void (*fl_lock_function)();
 extern void (*fl_unlock_function)();
 
+// Sets the lock/unlock functions for this system, using a read-write lock
+// in shared lock mode, or a system-supplied recursive mutex if supported...
+static void init_lock_functions() {
+#  ifdef USE_RWLOCK
+  if (shared_lock_enabled && !init_rwlock()) {
+    fl_lock_function   = lock_function_rw;
+    fl_unlock_function = unlock_function_rw;
+    return;
+  }
+#  endif // USE_RWLOCK
+#  ifdef PTHREAD_MUTEX_RECURSIVE
+  if (!lock_function_init_rec()) {
+    fl_lock_function   = lock_function_rec;
+    fl_unlock_function = unlock_function_rec;
+    return;
+  }
+#  endif // PTHREAD_MUTEX_RECURSIVE
+  lock_function_init_std();
+  fl_lock_function   = lock_function_std;
+  fl_unlock_function = unlock_function_std;
+}
+
 int Fl_Posix_System_Driver::lock() {
   if (!thread_filedes[1]) {
     // Initialize thread communication pipe to let threads awake FLTK
@@ -362,20 +666,7 @@ int Fl_Posix_System_Driver::lock() {
     // Fl::wait().
     Fl::add_fd(thread_filedes[0], FL_READ, thread_awake_cb);
 
-    // Set lock/unlock functions for this system, using a system-supplied
-    // recursive mutex if supported...
-#  ifdef PTHREAD_MUTEX_RECURSIVE
-    if (!lock_function_init_rec()) {
-      fl_lock_function   = lock_function_rec;
-      fl_unlock_function = unlock_function_rec;
-    } else {
-#  endif // PTHREAD_MUTEX_RECURSIVE
-      lock_function_init_std();
-      fl_lock_function   = lock_function_std;
-      fl_unlock_function = unlock_function_std;
-#  ifdef PTHREAD_MUTEX_RECURSIVE
-    }
-#  endif // PTHREAD_MUTEX_RECURSIVE
+    init_lock_functions();
   }
 
   fl_lock_function();
@@ -386,19 +677,43 @@ void Fl_Posix_System_Driver::unlock() {
   fl_unlock_function();
 }
 
-// Mutex code for the awake ring buffer
-static pthread_mutex_t *ring_mutex;
-
-void unlock_ring() {
-  pthread_mutex_unlock(ring_mutex);
+int Fl_Posix_System_Driver::lock_shared() {
+#  ifdef USE_RWLOCK
+  if (fl_lock_function == lock_function_rw) {
+    if (counter && pthread_equal(owner, pthread_self())) {
+      counter++; // this thread holds the write lock already
+    } else if (pthread_rwlock_tryrdlock(&fltk_rwlock)) {
+      double start = lock_clock();
+      pthread_rwlock_rdlock(&fltk_rwlock);
+      count_lock_wait(start);
+    }
+    return 0;
+  }
+#  endif // USE_RWLOCK
+  return lock();
 }
 
-void lock_ring() {
-  if (!ring_mutex) {
-    ring_mutex = (pthread_mutex_t*)malloc(sizeof(pthread_mutex_t));
-    pthread_mutex_init(ring_mutex, NULL);
+void Fl_Posix_System_Driver::unlock_shared() {
+#  ifdef USE_RWLOCK
+  if (fl_lock_function == lock_function_rw) {
+    if (counter && pthread_equal(owner, pthread_self()))
+      unlock_function_rw();
+    else
+      pthread_rwlock_unlock(&fltk_rwlock);
+    return;
   }
-  pthread_mutex_lock(ring_mutex);
+#  endif // USE_RWLOCK
+  unlock();
+}
+
+// Threads are only started once Fl::lock() was called, so that they
+// can report to the main thread with Fl::awake()
+int Fl_Posix_System_Driver::create_thread(void *(*f)(void *), void *data) {
+  pthread_t thread;
+  if (!thread_filedes[1] || pthread_create(&thread, NULL, f, data))
+    return -1;
+  pthread_detach(thread);
+  return 0;
 }
 
 #else // ! HAVE_PTHREAD
@@ -406,10 +721,10 @@ void lock_ring() {
 void Fl_Posix_System_Driver::awake(void*) {}
 int Fl_Posix_System_Driver::lock() { return 1; }
 void Fl_Posix_System_Driver::unlock() {}
+int Fl_Posix_System_Driver::lock_shared() { return 1; }
+void Fl_Posix_System_Driver::unlock_shared() {}
 void* Fl_Posix_System_Driver::thread_message() { return NULL; }
-
-void lock_ring() {}
-void unlock_ring() {}
+int Fl_Posix_System_Driver::create_thread(void *(*)(void *), void *) { return -1; }
 
 #endif // HAVE_PTHREAD
 
@@ -420,16 +735,6 @@ void unlock_ring() {}
 // TODO: can these functions be moved to the system drivers?
 #ifdef __ANDROID__
 
-static void unlock_ring()
-{
-  // TODO: implement me
-}
-
-static void lock_ring()
-{
-  // TODO: implement me
-}
-
 static void unlock_function()
 {
   // TODO: implement me
@@ -460,6 +765,14 @@ void Fl::unlock() {
   Fl::system_driver()->unlock();
 }
 
+int Fl::lock_shared() {
+  return Fl::system_driver()->lock_shared();
+}
+
+void Fl::unlock_shared() {
+  Fl::system_driver()->unlock_shared();
+}
+
 //
 // End of "$Id$".
 //
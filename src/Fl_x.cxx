@@ -78,9 +78,194 @@ static bool have_xfixes = false;
 extern Fl_Widget *fl_selection_requestor;
 
 ////////////////////////////////////////////////////////////////
-// interface to poll/select call:
+// interface to epoll/poll/select call:
 
-#  if USE_POLL
+#  if USE_EPOLL
+
+// The callbacks of each file descriptor are found directly in fd_table,
+// indexed by the descriptor. The kernel keeps the set of watched descriptors,
+// so nothing is copied or scanned when waiting, and callbacks are only
+// looked up for the descriptors that are ready.
+// POLLIN, POLLOUT and POLLERR have the same values as EPOLLIN, EPOLLOUT and
+// EPOLLERR, so the events are passed unchanged to epoll_ctl().
+// epoll refuses some descriptors, e.g. regular files (EPERM). These are
+// kept in polled[] and watched with poll(), together with epoll_fd, so
+// that they are reported as ready like without epoll.
+
+#    include <sys/epoll.h>
+#    include <poll.h>
+#    include <errno.h>
+
+struct FD {
+  int events;
+  void (*cb)(int, void*);
+  void* arg;
+  FD *next;
+};
+
+static FD **fd_table = 0;       // callbacks of each file descriptor
+static int fd_table_size = 0;
+static int nfds = 0;            // number of file descriptors with callbacks
+static int epoll_fd = -1;
+static pollfd *polled = 0;      // descriptors refused by epoll, and a free slot
+static int npolled = 0;
+static int polled_size = 0;
+
+static int get_epoll_fd() {
+  if (epoll_fd < 0) epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  return epoll_fd;
+}
+
+// number of ready file descriptors handled by one epoll_wait() call
+#    define EPOLL_EVENTS 64
+
+// Adds descriptor n to polled[]. Returns -1 if there is no memory.
+static int add_polled(int n, int events) {
+  if (npolled + 2 > polled_size) {
+    int size = 2*polled_size + 2;
+    pollfd *temp = (pollfd*)realloc(polled, size*sizeof(pollfd));
+    if (!temp) return -1;
+    polled = temp;
+    polled_size = size;
+  }
+  polled[npolled].fd = n;
+  polled[npolled].events = events;
+  polled[npolled++].revents = 0;
+  return 0;
+}
+
+// Tells the kernel which events of descriptor n are watched now.
+static void update_epoll(int n, int old_events) {
+  int events = 0;
+  for (FD *f = fd_table[n]; f; f = f->next) events |= f->events;
+  if (events == old_events) return;
+  for (int i = 0; i < npolled; i++) {
+    if (polled[i].fd != n) continue;
+    if (events) {
+      polled[i].events = events;
+    } else {
+      polled[i] = polled[--npolled];
+      nfds--;
+    }
+    return;
+  }
+  epoll_event ev;
+  ev.events = events;
+  ev.data.fd = n;
+  if (!events) {
+    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, n, &ev); // fails harmlessly if n was closed
+    nfds--;
+  } else if (!old_events) {
+    // n may still be registered if it was closed without Fl::remove_fd()
+    // while a duplicate of it remained open:
+    int r = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, n, &ev);
+    if (r < 0 && errno == EEXIST)
+      r = epoll_ctl(epoll_fd, EPOLL_CTL_MOD, n, &ev);
+    if (r < 0 && add_polled(n, events) < 0)
+      Fl::warning("Fl::add_fd(): can't watch file descriptor %d", n);
+    nfds++;
+  } else {
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, n, &ev);
+  }
+}
+
+// Waits for events of the watched descriptors like epoll_wait(). The
+// ready descriptors of polled[] come first in events, with their poll()
+// events; an invalid descriptor is reported as an error.
+static int wait_fds(epoll_event *events, int timeout) {
+  if (!npolled) return ::epoll_wait(get_epoll_fd(), events, EPOLL_EVENTS, timeout);
+  polled[npolled].fd = epoll_fd;
+  polled[npolled].events = POLLIN;
+  int n = ::poll(polled, npolled + 1, timeout);
+  if (n <= 0) return n;
+  n = 0;
+  // leave room for the epoll events, the other polled descriptors are
+  // still ready the next time
+  for (int i = 0; i < npolled && n < EPOLL_EVENTS/2; i++) {
+    int revents = polled[i].revents;
+    if (!revents) continue;
+    if (revents & POLLNVAL) revents |= EPOLLERR;
+    events[n].events = revents;
+    events[n++].data.fd = polled[i].fd;
+  }
+  if (polled[npolled].revents) {
+    int m = ::epoll_wait(epoll_fd, events + n, EPOLL_EVENTS - n, 0);
+    if (m > 0) n += m;
+  }
+  return n;
+}
+
+static int fd_events(int n) {
+  int events = 0;
+  if (n < fd_table_size)
+    for (FD *f = fd_table[n]; f; f = f->next) events |= f->events;
+  return events;
+}
+
+void Fl_X11_System_Driver::add_fd(int n, int events, void (*cb)(int, void*), void *v) {
+  if (n < 0) return;
+  remove_fd(n, events);
+  if (get_epoll_fd() < 0) return;
+  if (n >= fd_table_size) {
+    int size = 2*fd_table_size+1;
+    if (size <= n) size = n+1;
+    FD **temp = (FD**)realloc(fd_table, size*sizeof(FD*));
+    if (!temp) return;
+    for (int i = fd_table_size; i < size; i++) temp[i] = 0;
+    fd_table = temp;
+    fd_table_size = size;
+  }
+  int old_events = fd_events(n);
+  FD *f = new FD;
+  f->events = events;
+  f->cb = cb;
+  f->arg = v;
+  f->next = fd_table[n];
+  fd_table[n] = f;
+  update_epoll(n, old_events);
+}
+
+void Fl_X11_System_Driver::add_fd(int n, void (*cb)(int, void*), void* v) {
+  add_fd(n, POLLIN, cb, v);
+}
+
+void Fl_X11_System_Driver::remove_fd(int n, int events) {
+  if (n < 0 || n >= fd_table_size || !fd_table[n]) return;
+  int old_events = fd_events(n);
+  for (FD **p = &fd_table[n]; *p;) {
+    FD *f = *p;
+    f->events &= ~events;
+    if (!f->events) { // if no events left, delete this callback
+      *p = f->next;
+      delete f;
+    } else {
+      p = &(f->next);
+    }
+  }
+  update_epoll(n, old_events);
+}
+
+void Fl_X11_System_Driver::remove_fd(int n) {
+  remove_fd(n, -1);
+}
+
+// Calls the callbacks of descriptor n for the events it reported. The table
+// is searched again after each callback because it may add or remove
+// callbacks; the events of the callbacks of a descriptor never overlap, so
+// each one is called at most once.
+static void dispatch_fd(int n, int revents) {
+  // a hangup or an error is reported to all callbacks, like poll() does
+  int pending = (revents & (EPOLLHUP | EPOLLERR)) ? -1 : revents;
+  while (n < fd_table_size) {
+    FD *f = fd_table[n];
+    while (f && !(f->events & pending)) f = f->next;
+    if (!f) break;
+    pending &= ~f->events;
+    f->cb(n, f->arg);
+  }
+}
+
+#  elif USE_POLL
 
 #    include <poll.h>
 static pollfd *pollfds = 0;
@@ -99,7 +284,9 @@ static int maxfd;
 #    define POLLOUT 4
 #    define POLLERR 8
 
-#  endif /* USE_POLL */
+#  endif /* USE_EPOLL */
+
+#  if !USE_EPOLL
 
 static int nfds = 0;
 static int fd_array_size = 0;
@@ -197,6 +384,8 @@ void Fl_X11_System_Driver::remove_fd(int n) {
   remove_fd(n, -1);
 }
 
+#  endif /* USE_EPOLL */
+
 extern int fl_send_system_handlers(void *e);
 
 #if CONSOLIDATE_MOTION
@@ -238,7 +427,9 @@ int Fl_X11_Screen_Driver::poll_or_select_with_delay(double time_to_wait) {
   // so we must check for already-read events:
   if (fl_display && XQLength(fl_display)) {do_queued_events(); return 1;}
 
-#  if !USE_POLL
+#  if USE_EPOLL
+  epoll_event events[EPOLL_EVENTS];
+#  elif !USE_POLL
   fd_set fdt[3];
   fdt[0] = fdsets[0];
   fdt[1] = fdsets[1];
@@ -249,7 +440,9 @@ int Fl_X11_Screen_Driver::poll_or_select_with_delay(double time_to_wait) {
   fl_unlock_function();
 
   if (time_to_wait < 2147483.648) {
-#  if USE_POLL
+#  if USE_EPOLL
+    n = wait_fds(events, int(time_to_wait*1000 + .5));
+#  elif USE_POLL
     n = ::poll(pollfds, nfds, int(time_to_wait*1000 + .5));
 #  else
     timeval t;
@@ -258,7 +451,9 @@ int Fl_X11_Screen_Driver::poll_or_select_with_delay(double time_to_wait) {
     n = ::select(maxfd+1,&fdt[0],&fdt[1],&fdt[2],&t);
 #  endif
   } else {
-#  if USE_POLL
+#  if USE_EPOLL
+    n = wait_fds(events, -1);
+#  elif USE_POLL
     n = ::poll(pollfds, nfds, -1);
 #  else
     n = ::select(maxfd+1,&fdt[0],&fdt[1],&fdt[2],0);
@@ -267,6 +462,9 @@ int Fl_X11_Screen_Driver::poll_or_select_with_delay(double time_to_wait) {
 
   fl_lock_function();
 
+#  if USE_EPOLL
+  for (int i=0; i<n; i++) dispatch_fd(events[i].data.fd, events[i].events);
+#  else
   if (n > 0) {
     for (int i=0; i<nfds; i++) {
 #  if USE_POLL
@@ -281,6 +479,7 @@ int Fl_X11_Screen_Driver::poll_or_select_with_delay(double time_to_wait) {
 #  endif
     }
   }
+#  endif /* USE_EPOLL */
   return n;
 }
 
@@ -288,7 +487,10 @@ int Fl_X11_Screen_Driver::poll_or_select_with_delay(double time_to_wait) {
 int Fl_X11_Screen_Driver::poll_or_select() {
   if (XQLength(fl_display)) return 1;
   if (!nfds) return 0; // nothing to select or poll
-#  if USE_POLL
+#  if USE_EPOLL
+  epoll_event events[EPOLL_EVENTS];
+  return wait_fds(events, 0);
+#  elif USE_POLL
   return ::poll(pollfds, nfds, 0);
 #  else
   timeval t;
@@ -31,6 +31,8 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <fcntl.h>
 #include <pwd.h>
 #include <unistd.h>
 #include <time.h>
@@ -86,6 +88,29 @@ void *Fl_Posix_System_Driver::dlopen(const char *filename)
   return ptr;
 }
 
+void *Fl_Posix_System_Driver::map_file(const char *f, size_t *size)
+{
+  int fd = ::open(f, O_RDONLY);
+  if (fd < 0)
+    return NULL;
+  struct stat st;
+  void *addr = NULL;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    addr = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED)
+      addr = NULL;
+    else
+      *size = (size_t) st.st_size;
+  }
+  ::close(fd); // the mapping keeps the file open
+  return addr;
+}
+
+void Fl_Posix_System_Driver::unmap_file(void *addr, size_t size)
+{
+  munmap(addr, size);
+}
+
 int Fl_Posix_System_Driver::file_type(const char *filename)
 {
   int filetype;
@@ -901,6 +901,29 @@ void *Fl_WinAPI_System_Driver::dlopen(const char *filename) {
   return LoadLibraryW(utf8_to_wchar(filename, wbuf));
 }
 
+void *Fl_WinAPI_System_Driver::map_file(const char *f, size_t *size) {
+  HANDLE file = CreateFileW(utf8_to_wchar(f, wbuf), GENERIC_READ,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                            NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE) return NULL;
+  void *addr = NULL;
+  LARGE_INTEGER fsize;
+  if (GetFileSizeEx(file, &fsize) && fsize.QuadPart > 0 && fsize.QuadPart == (SIZE_T)fsize.QuadPart) {
+    HANDLE mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    if (mapping) {
+      addr = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      if (addr) *size = (size_t)fsize.QuadPart;
+      CloseHandle(mapping); // the view keeps the mapping open
+    }
+  }
+  CloseHandle(file);
+  return addr;
+}
+
+void Fl_WinAPI_System_Driver::unmap_file(void *addr, size_t size) {
+  UnmapViewOfFile(addr);
+}
+
 void Fl_WinAPI_System_Driver::png_extra_rgba_processing(unsigned char *ptr, int w, int h)
 {
   // Some Windows graphics drivers don't honor transparency when RGB == white
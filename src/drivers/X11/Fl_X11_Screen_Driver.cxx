@@ -22,6 +22,7 @@
 #include "../Xlib/Fl_Font.H"
 #include "Fl_X11_Window_Driver.H"
 #include "../../Fl_System_Driver.H"
+#include "../../Fl_Timeout_Queue.H"
 #include "../Xlib/Fl_Xlib_Graphics_Driver.H"
 #include <FL/Fl.H>
 #include <FL/platform.H>
@@ -31,6 +32,8 @@
 #include <FL/Fl_Tooltip.H>
 #include <FL/filename.H>
 #include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
 
 #if HAVE_XINERAMA
 #  include <X11/extensions/Xinerama.h>
@@ -66,46 +69,32 @@ extern const char *fl_bg2;
 
 
 ////////////////////////////////////////////////////////////////////////
-// Timeouts are stored in a sorted list (*first_timeout), so only the
-// first one needs to be checked to see if any should be called.
-// Allocated, but unused (free) Timeout structs are stored in another
-// linked list (*free_timeout).
-
-struct Timeout {
-  double time;
-  void (*cb)(void*);
-  void* arg;
-  Timeout* next;
-};
-static Timeout* first_timeout, *free_timeout;
-
-// I avoid the overhead of getting the current time when we have no
-// timeouts by setting this flag instead of getting the time.
-// In this case calling elapse_timeouts() does nothing, but records
-// the current time, and the next call will actually elapse time.
-static char reset_clock = 1;
-
-static void elapse_timeouts() {
-  static struct timeval prevclock;
-  struct timeval newclock;
-  gettimeofday(&newclock, NULL);
-  double elapsed = newclock.tv_sec - prevclock.tv_sec +
-    (newclock.tv_usec - prevclock.tv_usec)/1000000.0;
-  prevclock.tv_sec = newclock.tv_sec;
-  prevclock.tv_usec = newclock.tv_usec;
-  if (reset_clock) {
-    reset_clock = 0;
-  } else if (elapsed > 0) {
-    for (Timeout* t = first_timeout; t; t = t->next) t->time -= elapsed;
-  }
+// Timeouts are stored with absolute deadlines in a Fl_Timeout_Queue, so
+// only the earliest one needs to be checked to see if any should be called,
+// and adding or removing a timeout does not depend on how many are pending.
+// Fl::wait() sleeps until the latest time allowed by the slack of the next
+// timeout, then calls all timeouts whose deadline has passed.
+
+static Fl_Timeout_Queue timeout_queue;
+
+// Returns the current time in seconds, from a clock that is not affected
+// by changes of the system date if one is available.
+static double timeout_clock() {
+#if defined(_POSIX_MONOTONIC_CLOCK) && _POSIX_MONOTONIC_CLOCK >= 0
+  struct timespec ts;
+  if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+    return ts.tv_sec + ts.tv_nsec / 1000000000.0;
+#endif
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec / 1000000.0;
 }
 
-
-// Continuously-adjusted error value, this is a number <= 0 for how late
-// we were at calling the last timeout. This appears to make repeat_timeout
-// very accurate even when processing takes a significant portion of the
-// time interval:
-static double missed_timeout_by;
+// Deadline of the last timeout that was called, or the time of the last
+// add_timeout(). Fl::repeat_timeout() is scheduled relative to this time,
+// which makes it very accurate even when processing takes a significant
+// portion of the time interval:
+static double repeat_timeout_base;
 
 /**
  Creates a driver that manages all screen and display related calls.
@@ -439,24 +428,14 @@ double Fl_X11_Screen_Driver::wait(double time_to_wait)
 {
   static char in_idle;
 
-  if (first_timeout) {
-    elapse_timeouts();
-    Timeout *t;
-    while ((t = first_timeout)) {
-      if (t->time > 0) break;
-      // The first timeout in the array has expired.
-      missed_timeout_by = t->time;
-      // We must remove timeout from array before doing the callback:
-      void (*cb)(void*) = t->cb;
-      void *argp = t->arg;
-      first_timeout = t->next;
-      t->next = free_timeout;
-      free_timeout = t;
-      // Now it is safe for the callback to do add_timeout:
+  if (!timeout_queue.empty()) {
+    double now = timeout_clock();
+    Fl_Timeout_Handler cb;
+    void *argp;
+    // We must remove timeout from queue before doing the callback, then
+    // it is safe for the callback to do add_timeout:
+    while (timeout_queue.pop_expired(now, cb, argp, repeat_timeout_base))
       cb(argp);
-    }
-  } else {
-    reset_clock = 1; // we are not going to check the clock
   }
   Fl::run_checks();
   if (Fl::idle) {
@@ -468,8 +447,10 @@ double Fl_X11_Screen_Driver::wait(double time_to_wait)
     // the idle function may turn off idle, we can then wait:
     if (Fl::idle) time_to_wait = 0.0;
   }
-  if (first_timeout && first_timeout->time < time_to_wait)
-    time_to_wait = first_timeout->time;
+  if (!timeout_queue.empty()) {
+    double delay = timeout_queue.next_wakeup() - timeout_clock();
+    if (delay < time_to_wait) time_to_wait = delay;
+  }
   if (time_to_wait <= 0.0) {
     // do flush second so that the results of events are visible:
     int ret = this->poll_or_select_with_delay(0.0);
@@ -480,9 +461,10 @@ double Fl_X11_Screen_Driver::wait(double time_to_wait)
     Fl::flush();
     if (Fl::idle && !in_idle) // 'idle' may have been set within flush()
       time_to_wait = 0.0;
-    else if (first_timeout && first_timeout->time < time_to_wait) {
+    else if (!timeout_queue.empty()) {
       // another timeout may have been queued within flush(), see STR #3188
-      time_to_wait = first_timeout->time >= 0.0 ? first_timeout->time : 0.0;
+      double delay = timeout_queue.next_wakeup() - timeout_clock();
+      if (delay < time_to_wait) time_to_wait = delay >= 0.0 ? delay : 0.0;
     }
     return this->poll_or_select_with_delay(time_to_wait);
   }
@@ -491,12 +473,8 @@ double Fl_X11_Screen_Driver::wait(double time_to_wait)
 
 int Fl_X11_Screen_Driver::ready()
 {
-  if (first_timeout) {
-    elapse_timeouts();
-    if (first_timeout->time <= 0) return 1;
-  } else {
-    reset_clock = 1;
-  }
+  if (!timeout_queue.empty() && timeout_queue.next_deadline() <= timeout_clock())
+    return 1;
   return this->poll_or_select();
 }
 
@@ -633,37 +611,44 @@ const char *Fl_X11_Screen_Driver::get_system_scheme()
 // X11 timers
 //
 
+// Returns the deadline of a timeout repeated after the one being called.
+static double repeat_deadline(double time) {
+  double deadline = repeat_timeout_base + time;
+  double now = timeout_clock();
+  return deadline < now - .05 ? now : deadline;
+}
+
 void Fl_X11_Screen_Driver::add_timeout(double time, Fl_Timeout_Handler cb, void *argp) {
-  elapse_timeouts();
-  missed_timeout_by = 0;
-  repeat_timeout(time, cb, argp);
+  repeat_timeout_base = timeout_clock();
+  timeout_queue.add(repeat_timeout_base + time, cb, argp);
 }
 
 void Fl_X11_Screen_Driver::repeat_timeout(double time, Fl_Timeout_Handler cb, void *argp) {
-  time += missed_timeout_by; if (time < -.05) time = 0;
-  Timeout* t = free_timeout;
-  if (t) {
-      free_timeout = t->next;
-  } else {
-      t = new Timeout;
-  }
-  t->time = time;
-  t->cb = cb;
-  t->arg = argp;
-  // insert-sort the new timeout:
-  Timeout** p = &first_timeout;
-  while (*p && (*p)->time <= time) p = &((*p)->next);
-  t->next = *p;
-  *p = t;
+  timeout_queue.add(repeat_deadline(time), cb, argp);
+}
+
+Fl_Timeout_Id Fl_X11_Screen_Driver::add_timeout_id(double time, Fl_Timeout_Handler cb, void *argp, double slack) {
+  repeat_timeout_base = timeout_clock();
+  return timeout_queue.add(repeat_timeout_base + time, cb, argp, slack, 1);
+}
+
+Fl_Timeout_Id Fl_X11_Screen_Driver::repeat_timeout_id(double time, Fl_Timeout_Handler cb, void *argp, double slack) {
+  return timeout_queue.add(repeat_deadline(time), cb, argp, slack, 1);
+}
+
+int Fl_X11_Screen_Driver::has_timeout_id(Fl_Timeout_Id id) {
+  return timeout_queue.has(id);
+}
+
+void Fl_X11_Screen_Driver::remove_timeout_id(Fl_Timeout_Id id) {
+  timeout_queue.remove(id);
 }
 
 /**
   Returns true if the timeout exists and has not been called yet.
 */
 int Fl_X11_Screen_Driver::has_timeout(Fl_Timeout_Handler cb, void *argp) {
-  for (Timeout* t = first_timeout; t; t = t->next)
-    if (t->cb == cb && t->arg == argp) return 1;
-  return 0;
+  return timeout_queue.has(cb, argp);
 }
 
 /**
@@ -674,16 +659,7 @@ int Fl_X11_Screen_Driver::has_timeout(Fl_Timeout_Handler cb, void *argp) {
 	This may change in the future.
 */
 void Fl_X11_Screen_Driver::remove_timeout(Fl_Timeout_Handler cb, void *argp) {
-  for (Timeout** p = &first_timeout; *p;) {
-    Timeout* t = *p;
-    if (t->cb == cb && (t->arg == argp || !argp)) {
-      *p = t->next;
-      t->next = free_timeout;
-      free_timeout = t;
-    } else {
-      p = &(t->next);
-    }
-  }
+  timeout_queue.remove(cb, argp);
 }
 
 int Fl_X11_Screen_Driver::compose(int& del) {
@@ -742,6 +718,12 @@ fl_subimage_offsets(int a, int aw, int b, int bw, int &obw)
 
 // this handler will catch and ignore exceptions during XGetImage
 // to avoid an application crash
+#if HAVE_XSHM
+// in Fl_Xlib_Graphics_Driver_image.cxx
+extern XImage *fl_xshm_get_image(Drawable d, int x, int y, int w, int h);
+extern void fl_xshm_destroy_image(XImage *image);
+#endif
+
 extern "C" {
   static int xgetimageerrhandler(Display *display, XErrorEvent *error) {
     return 0;
@@ -772,6 +754,9 @@ Fl_RGB_Image *Fl_X11_Screen_Driver::read_win_rectangle(int X, int Y, int w, int
   // ReadDisplay extension which does all of the really hard work for
   // us...
   //
+#if HAVE_XSHM
+  bool shm_image = false;       // image was read with the MIT-SHM extension
+#endif
   int allow_outside = w < 0;    // negative w allows negative X or Y, that is, window frame
   if (w < 0) w = - w;
   
@@ -812,9 +797,17 @@ Fl_RGB_Image *Fl_X11_Screen_Driver::read_win_rectangle(int X, int Y, int w, int
       // the image is fully contained, we can use the traditional method
       // however, if the window is obscured etc. the function will still fail. Make sure we
       // catch the error and continue, otherwise an exception will be thrown.
+#if HAVE_XSHM
+      image = fl_xshm_get_image(xid, Xs, Ys, ws, hs);
+      shm_image = (image != NULL);
+      if (!image) {
+#endif
       XErrorHandler old_handler = XSetErrorHandler(xgetimageerrhandler);
       image = XGetImage(fl_display, xid, Xs, Ys, ws, hs, AllPlanes, ZPixmap);
       XSetErrorHandler(old_handler);
+#if HAVE_XSHM
+      }
+#endif
     } else {
       // image is crossing borders, determine visible region
       int nw, nh, noffx, noffy;
@@ -1167,6 +1160,10 @@ Fl_RGB_Image *Fl_X11_Screen_Driver::read_win_rectangle(int X, int Y, int w, int
   }
   
   // Destroy the X image we've read and return the RGB(A) image...
+#if HAVE_XSHM
+  if (shm_image) fl_xshm_destroy_image(image);
+  else
+#endif
   XDestroyImage(image);
   
   Fl_RGB_Image *rgb = new Fl_RGB_Image(p, w, h, d);
@@ -59,6 +59,11 @@
 #if HAVE_XRENDER
 #include <X11/extensions/Xrender.h>
 #endif
+#if HAVE_XSHM
+#  include <sys/ipc.h>
+#  include <sys/shm.h>
+#  include <X11/extensions/XShm.h>
+#endif
 
 static XImage xi;	// template used to pass info to X
 static int bytes_per_pixel;
@@ -67,6 +72,10 @@ static int scanline_mask;
 
 static void (*converter)(const uchar *from, uchar *to, int w, int delta);
 static void (*mono_converter)(const uchar *from, uchar *to, int w, int delta);
+static void (*premul_converter)(const uchar *from, uchar *to, int w, int delta);
+
+static XPixmapFormatValues *pfvlist;
+static int FL_NUM_pfv;
 
 static int dir;		// direction-alternator
 static int ri,gi,bi;	// saved error-diffusion value
@@ -358,15 +367,161 @@ mono32_converter(const uchar *from,uchar *to,int w, int delta) {
     (*from << fl_redshift)+(*from << fl_greenshift)+(*from << fl_blueshift));
 }
 
+////////////////////////////////////////////////////////////////
+// SSSE3 versions of the 32bit TrueColor converters, used if the processor
+// supports them. They give exactly the same results as the converters
+// above, which they call for the last pixels of each line and for pixel
+// sizes they don't handle.
+
+#  if defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__)) && \
+      (defined(__x86_64__) || defined(__i386__)) && !WORDS_BIGENDIAN
+#    define USE_SSSE3 1
+#    include <tmmintrin.h>
+#    define SSSE3_FUNCTION __attribute__((target("ssse3")))
+
+#    define Z ((char)0x80) // makes _mm_shuffle_epi8() set a byte to 0
+
+// Converts pixels of delta bytes to 32-bit pixels. m[i] is the byte of
+// the source pixel copied to the byte i of the 32-bit pixel, or Z.
+SSSE3_FUNCTION
+static void shuffle32_ssse3(const uchar *from, uchar *to, int w, int delta, const char m[4],
+                            void (*scalar)(const uchar *from, uchar *to, int w, int delta))
+{
+  // the same mask converts 4 pixels starting at the first byte of a vector
+  char mask[16];
+  for (int i = 0; i < 16; i++) {
+    if (m[i & 3] >= delta) { // pixels overlap, e.g. RGB converters with delta 1
+      scalar(from, to, w, delta);
+      return;
+    }
+    mask[i] = (m[i & 3] == Z) ? Z : (char)((i >> 2) * delta + m[i & 3]);
+  }
+  const __m128i M = _mm_loadu_si128((const __m128i*)mask);
+  __m128i *t = (__m128i*)to;
+  switch (delta) {
+  case 1:
+    for (; w >= 16; w -= 16, from += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i*)from);
+      _mm_storeu_si128(t++, _mm_shuffle_epi8(v, M));
+      _mm_storeu_si128(t++, _mm_shuffle_epi8(_mm_srli_si128(v, 4), M));
+      _mm_storeu_si128(t++, _mm_shuffle_epi8(_mm_srli_si128(v, 8), M));
+      _mm_storeu_si128(t++, _mm_shuffle_epi8(_mm_srli_si128(v, 12), M));
+    }
+    break;
+  case 2:
+    for (; w >= 8; w -= 8, from += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i*)from);
+      _mm_storeu_si128(t++, _mm_shuffle_epi8(v, M));
+      _mm_storeu_si128(t++, _mm_shuffle_epi8(_mm_srli_si128(v, 8), M));
+    }
+    break;
+  case 3:
+    // 16 pixels are in 3 vectors, never read past the last pixel
+    for (; w >= 16; w -= 16, from += 48) {
+      __m128i a = _mm_loadu_si128((const __m128i*)from);
+      __m128i b = _mm_loadu_si128((const __m128i*)(from + 16));
+      __m128i c = _mm_loadu_si128((const __m128i*)(from + 32));
+      _mm_storeu_si128(t++, _mm_shuffle_epi8(a, M));
+      _mm_storeu_si128(t++, _mm_shuffle_epi8(_mm_alignr_epi8(b, a, 12), M));
+      _mm_storeu_si128(t++, _mm_shuffle_epi8(_mm_alignr_epi8(c, b, 8), M));
+      _mm_storeu_si128(t++, _mm_shuffle_epi8(_mm_srli_si128(c, 4), M));
+    }
+    break;
+  case 4:
+    for (; w >= 4; w -= 4, from += 16)
+      _mm_storeu_si128(t++, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)from), M));
+    break;
+  }
+  if (w > 0) scalar(from, (uchar*)t, w, delta);
+}
+
+static const char rgbx_mask[4] = {Z, 2, 1, 0};
+static const char xbgr_mask[4] = {0, 1, 2, Z};
+static const char xrgb_mask[4] = {2, 1, 0, Z};
+static const char bgrx_mask[4] = {Z, 0, 1, 2};
+static const char rrrx_mask[4] = {Z, 0, 0, 0};
+static const char xrrr_mask[4] = {0, 0, 0, Z};
+
+SSSE3_FUNCTION
+static void rgbx_ssse3_converter(const uchar *from, uchar *to, int w, int delta) {
+  shuffle32_ssse3(from, to, w, delta, rgbx_mask, rgbx_converter);
+}
+
+SSSE3_FUNCTION
+static void xbgr_ssse3_converter(const uchar *from, uchar *to, int w, int delta) {
+  shuffle32_ssse3(from, to, w, delta, xbgr_mask, xbgr_converter);
+}
+
+SSSE3_FUNCTION
+static void xrgb_ssse3_converter(const uchar *from, uchar *to, int w, int delta) {
+  shuffle32_ssse3(from, to, w, delta, xrgb_mask, xrgb_converter);
+}
+
+SSSE3_FUNCTION
+static void bgrx_ssse3_converter(const uchar *from, uchar *to, int w, int delta) {
+  shuffle32_ssse3(from, to, w, delta, bgrx_mask, bgrx_converter);
+}
+
+SSSE3_FUNCTION
+static void rrrx_ssse3_converter(const uchar *from, uchar *to, int w, int delta) {
+  shuffle32_ssse3(from, to, w, delta, rrrx_mask, rrrx_converter);
+}
+
+SSSE3_FUNCTION
+static void xrrr_ssse3_converter(const uchar *from, uchar *to, int w, int delta) {
+  shuffle32_ssse3(from, to, w, delta, xrrr_mask, xrrr_converter);
+}
+
+// Premultiplies 2 RGBA pixels unpacked to 16 bits, leaving alpha as is.
+// (c * a * 0x8081) >> 23 is exactly (c * a) / 255 for 8-bit c and a.
+SSSE3_FUNCTION
+static inline __m128i premul_ssse3(__m128i v) {
+  const __m128i alpha_lanes = _mm_setr_epi16(0, 0, 0, -1, 0, 0, 0, -1);
+  __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xff), 0xff);
+  __m128i c = _mm_mullo_epi16(v, a);
+  c = _mm_srli_epi16(_mm_mulhi_epu16(c, _mm_set1_epi16((short)0x8081)), 7);
+  return _mm_or_si128(_mm_andnot_si128(alpha_lanes, c), _mm_and_si128(alpha_lanes, v));
+}
+
+SSSE3_FUNCTION
+static void argb_premul_ssse3_converter(const uchar *from, uchar *to, int w, int delta) {
+  if (delta == 4) {
+    const __m128i zero = _mm_setzero_si128();
+    // RGBA to the bytes of a little-endian ARGB pixel
+    const __m128i M = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+    for (; w >= 4; w -= 4, from += 16, to += 16) {
+      __m128i v = _mm_loadu_si128((const __m128i*)from);
+      __m128i lo = premul_ssse3(_mm_unpacklo_epi8(v, zero));
+      __m128i hi = premul_ssse3(_mm_unpackhi_epi8(v, zero));
+      _mm_storeu_si128((__m128i*)to, _mm_shuffle_epi8(_mm_packus_epi16(lo, hi), M));
+    }
+  }
+  if (w > 0) argb_premul_converter(from, to, w, delta);
+}
+
+#    undef Z
+
+// Replaces the converters by their SSSE3 versions.
+static void use_ssse3_converters() {
+  if (converter == rgbx_converter) converter = rgbx_ssse3_converter;
+  else if (converter == xbgr_converter) converter = xbgr_ssse3_converter;
+  else if (converter == xrgb_converter) converter = xrgb_ssse3_converter;
+  else if (converter == bgrx_converter) converter = bgrx_ssse3_converter;
+  if (mono_converter == rrrx_converter) mono_converter = rrrx_ssse3_converter;
+  else if (mono_converter == xrrr_converter) mono_converter = xrrr_ssse3_converter;
+  premul_converter = argb_premul_ssse3_converter;
+}
+#  endif // USE_SSSE3
+
 ////////////////////////////////////////////////////////////////
 
 static void figure_out_visual() {
 
+  premul_converter = argb_premul_converter;
+
   fl_xpixel(FL_BLACK); // setup fl_redmask, etc, in fl_color.cxx
   fl_xpixel(FL_WHITE); // also make sure white is allocated
 
-  static XPixmapFormatValues *pfvlist;
-  static int FL_NUM_pfv;
   if (!pfvlist) pfvlist = XListPixmapFormats(fl_display,&FL_NUM_pfv);
   XPixmapFormatValues *pfv;
   for (pfv = pfvlist; pfv < pfvlist+FL_NUM_pfv; pfv++)
@@ -463,8 +618,195 @@ static void figure_out_visual() {
     Fl::fatal("Can't do %d bits_per_pixel",xi.bits_per_pixel);
   }
 
+#  if USE_SSSE3
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("ssse3")) use_ssse3_converters();
+#  endif
+
+}
+
+#if HAVE_XSHM
+////////////////////////////////////////////////////////////////
+// MIT-SHM support
+
+// Images are sent to the X server through shared memory segments, reused
+// and enlarged as needed, instead of copying all pixels through the X
+// connection. The extension may be announced but unusable, e.g. on a
+// remote display: attaching a segment then fails, and XPutImage() and
+// XGetImage() are used from then on. They are also used for small images,
+// whose pixels cost less to copy than the shared memory requests.
+//
+// The X server reads a segment after XShmPutImage() returns, so there are
+// two segments: while the server reads one, the next image is written in
+// the other. The server sends a ShmCompletion event when it has read a
+// segment; if neither segment is done yet, the image is sent with
+// XPutImage() rather than waiting for the server.
+
+#  define SHM_MIN_PIXELS 16384	// smaller images don't use MIT-SHM
+
+struct Fl_Xlib_Shm_Segment {
+  XShmSegmentInfo info;
+  size_t size;			// 0 if the segment is not attached
+  unsigned long serial;		// last request that reads the segment
+};
+
+static Fl_Xlib_Shm_Segment shm_segments[2];
+static int shm_state;		// 0: untested, 1: usable, -1: not usable
+static int shm_completion;	// type of the ShmCompletion events
+static bool shm_error;
+
+extern "C" {
+  static int shm_error_handler(Display *display, XErrorEvent *error) {
+    shm_error = true;
+    return 0;
+  }
+}
+
+// Returns true if the X server may still read the segment.
+static bool shm_busy(const Fl_Xlib_Shm_Segment *seg) {
+  return seg->size && (long)(LastKnownRequestProcessed(fl_display) - seg->serial) < 0;
+}
+
+static void shm_detach(Fl_Xlib_Shm_Segment *seg) {
+  XShmDetach(fl_display, &seg->info);
+  shmdt(seg->info.shmaddr);
+  seg->info.shmaddr = NULL;
+  seg->size = 0;
+}
+
+// Returns a shared memory segment at least size bytes large that the
+// X server doesn't read, or NULL if none can be used now.
+static Fl_Xlib_Shm_Segment *shm_segment(size_t size) {
+  if (!shm_state) {
+    shm_state = XShmQueryExtension(fl_display) ? 1 : -1;
+    if (shm_state > 0) shm_completion = XShmGetEventBase(fl_display) + ShmCompletion;
+  }
+  if (shm_state < 0) return NULL;
+  // read the completion events that arrived, without waiting for more,
+  // so that LastKnownRequestProcessed() tells which segments are done
+  XEvent event;
+  while (XCheckTypedEvent(fl_display, shm_completion, &event)) {}
+  Fl_Xlib_Shm_Segment *seg = NULL;
+  for (int i = 0; i < 2; i++) {
+    Fl_Xlib_Shm_Segment *s = shm_segments + i;
+    if (shm_busy(s)) continue;
+    if (!seg || (seg->size < size && s->size > seg->size)) seg = s;
+  }
+  if (!seg) return NULL;
+  if (size <= seg->size) return seg;
+  if (seg->size) shm_detach(seg);
+  size = (size + 0xffff) & ~(size_t)0xffff; // limit reallocations
+  XShmSegmentInfo *info = &seg->info;
+  info->shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+  if (info->shmid < 0) return NULL; // too large, try again later
+  info->shmaddr = (char *)shmat(info->shmid, NULL, 0);
+  if (info->shmaddr == (char *)-1) {
+    shmctl(info->shmid, IPC_RMID, NULL);
+    info->shmaddr = NULL;
+    return NULL;
+  }
+  info->readOnly = False;
+  shm_error = false;
+  XErrorHandler old_handler = XSetErrorHandler(shm_error_handler);
+  XShmAttach(fl_display, info);
+  XSync(fl_display, False);
+  XSetErrorHandler(old_handler);
+  // the segment is freed when both the X server and we have detached it
+  shmctl(info->shmid, IPC_RMID, NULL);
+  if (shm_error) {
+    shmdt(info->shmaddr);
+    info->shmaddr = NULL;
+    shm_state = -1;
+    return NULL;
+  }
+  seg->size = size;
+  seg->serial = 0;
+  return seg;
 }
 
+// Returns non-zero if the X server computes the same bytes_per_line
+// as xi for an image of width xi.width.
+static int shm_same_stride() {
+  int pad = 32;
+  for (XPixmapFormatValues *pfv = pfvlist; pfv < pfvlist+FL_NUM_pfv; pfv++)
+    if (pfv->depth == xi.depth) pad = pfv->scanline_pad;
+  return ((xi.width * xi.bits_per_pixel + pad - 1) / pad) * pad / 8 == xi.bytes_per_line;
+}
+
+// Converts and draws the image through the shared segment.
+// Returns 0 if that's not possible.
+static int shm_innards(const uchar *buf, int X, int Y, int W, int w, int h,
+                       int dx, int dy, int delta, int linedelta,
+                       void (*conv)(const uchar *from, uchar *to, int w, int delta),
+                       Fl_Draw_Image_Cb cb, void* userdata, GC gc)
+{
+  if (w * h < SHM_MIN_PIXELS) return 0;
+  // the X server only knows the width of the whole image, so make it
+  // as wide as our lines
+  int linesize = ((w*bytes_per_pixel+scanline_add)&scanline_mask);
+  if (linesize % bytes_per_pixel) return 0;
+  xi.width = linesize / bytes_per_pixel;
+  xi.height = h;
+  xi.bytes_per_line = linesize;
+  Fl_Xlib_Shm_Segment *seg = NULL;
+  if (shm_same_stride()) seg = shm_segment((size_t)linesize * h);
+  if (!seg) {
+    xi.width = w;
+    return 0;
+  }
+  uchar *to = (uchar *)seg->info.shmaddr;
+  if (buf) {
+    buf += delta*dx+linedelta*dy;
+    for (int j=0; j<h; j++, buf += linedelta, to += linesize)
+      conv(buf, to, w, delta);
+  } else {
+    STORETYPE* linebuf = new STORETYPE[(W*delta+(sizeof(STORETYPE)-1))/sizeof(STORETYPE)];
+    for (int j=0; j<h; j++, to += linesize) {
+      cb(userdata, dx, dy+j, w, (uchar*)linebuf);
+      conv((uchar*)linebuf, to, w, delta);
+    }
+    delete[] linebuf;
+  }
+  xi.data = seg->info.shmaddr;
+  xi.obdata = (char *)&seg->info;
+  XShmPutImage(fl_display, fl_window, gc, &xi, 0, 0, X+dx, Y+dy, w, h, True);
+  seg->serial = NextRequest(fl_display) - 1;
+  xi.obdata = NULL;
+  xi.width = w;
+  return 1;
+}
+
+// Destroys an image returned by fl_xshm_get_image().
+void fl_xshm_destroy_image(XImage *image) {
+  // neither the pixels nor the segment info belong to the image
+  image->data = NULL;
+  image->obdata = NULL;
+  XDestroyImage(image);
+}
+
+// Reads an image of the default visual with XShmGetImage(), or returns NULL.
+// The image must be destroyed with fl_xshm_destroy_image().
+XImage *fl_xshm_get_image(Drawable d, int x, int y, int w, int h) {
+  if (shm_state < 0 || w * h < SHM_MIN_PIXELS) return NULL;
+  XImage *image = XShmCreateImage(fl_display, fl_visual->visual, fl_visual->depth,
+                                  ZPixmap, NULL, NULL, w, h);
+  if (!image) return NULL;
+  Fl_Xlib_Shm_Segment *seg = shm_segment((size_t)image->bytes_per_line * h);
+  if (seg) {
+    image->data = seg->info.shmaddr;
+    image->obdata = (char *)&seg->info;
+    shm_error = false;
+    XErrorHandler old_handler = XSetErrorHandler(shm_error_handler);
+    // this is a round trip, so the segment is not busy afterwards
+    if (!XShmGetImage(fl_display, d, image, x, y, AllPlanes)) shm_error = true;
+    XSetErrorHandler(old_handler);
+    if (!shm_error) return image;
+  }
+  fl_xshm_destroy_image(image);
+  return NULL;
+}
+#endif // HAVE_XSHM
+
 #  define MAXBUFFER 0x40000 // 256k
 
 static void innards(const uchar *buf, int X, int Y, int W, int H,
@@ -490,7 +832,7 @@ static void innards(const uchar *buf, int X, int Y, int W, int H,
   if (alpha) {
     // This flag states the destination format is ARGB32 (big-endian), pre-multiplied.
     bytes_per_pixel = 4;
-    conv = (mono ? depth2_to_argb_premul_converter : argb_premul_converter);
+    conv = (mono ? depth2_to_argb_premul_converter : premul_converter);
     xi.depth = 32;
     xi.bits_per_pixel = 32;
 
@@ -523,6 +865,10 @@ static void innards(const uchar *buf, int X, int Y, int W, int H,
     xi.data = (char *)(buf+delta*dx+linedelta*dy);
     xi.bytes_per_line = linedelta;
 
+#if HAVE_XSHM
+  } else if (shm_innards(buf, X, Y, W, w, h, dx, dy, delta, linedelta, conv, cb, userdata, gc)) {
+    // done
+#endif
   } else {
     int linesize = ((w*bytes_per_pixel+scanline_add)&scanline_mask)/sizeof(STORETYPE);
     int blocking = h;
@@ -803,24 +803,27 @@ void replall_cb(Fl_Widget*, void* v) {
 
   e->replace_dlg->hide();
 
-  e->editor->insert_position(0);
   int times = 0;
+  int pos = 0;
 
-  // Loop through the whole string
+  // Loop through the whole string, and redraw the editor only once
+  textbuf->begin_batch();
   for (int found = 1; found;) {
-    int pos = e->editor->insert_position();
     found = textbuf->search_forward(pos, find, &pos);
 
     if (found) {
       // Found a match; update the position and replace text...
-      textbuf->select(pos, pos+strlen(find));
-      textbuf->remove_selection();
-      textbuf->insert(pos, replace);
-      e->editor->insert_position(pos+strlen(replace));
-      e->editor->show_insert_position();
+      textbuf->replace(pos, pos+strlen(find), replace);
+      pos += strlen(replace);
       times++;
     }
   }
+  textbuf->end_batch();
+
+  if (times) {
+    e->editor->insert_position(pos);
+    e->editor->show_insert_position();
+  }
 
   if (times) fl_message("Replaced %d occurrences.", times);
   else fl_alert("No occurrences of \'%s\' found!", find);
@@ -959,6 +962,7 @@ void cb(const char *fname) {
 
 int main(int argc, char **argv) {
   textbuf = new Fl_Text_Buffer;
+  textbuf->undo_budget(4 * 1024 * 1024);  // keep a multi-level undo history
 //textbuf->transcoding_warning_action = NULL;
   style_init();
   fl_open_callback(cb);
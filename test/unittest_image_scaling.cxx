@@ -0,0 +1,217 @@
+//
+// "$Id$"
+//
+// Unit tests for the Fast Light Tool Kit (FLTK).
+//
+// Copyright 1998-2018 by Bill Spitzak and others.
+//
+// This library is free software. Distribution and use rights are outlined in
+// the file "COPYING" which should have been included with this file.  If this
+// file is missing or damaged, see the license at:
+//
+//     http://www.fltk.org/COPYING.php
+//
+// Please report all bugs and problems on the following page:
+//
+//     http://www.fltk.org/str.php
+//
+
+#include <FL/Fl_Group.H>
+#include <FL/Fl_Box.H>
+#include <FL/Fl_Image.H>
+#include <stdio.h>
+#include <stdlib.h>
+
+//
+//------- check and compare the speed of the RGB image scaling methods ----------
+//
+
+static const char *scaling_names[] = {
+  "Nearest", "Bilinear", "Box", "Catmull-Rom", "Lanczos"
+};
+
+class ImageScalingTest : public ResultsTest {
+  enum { SRC_W = 1024, SRC_H = 768, NMETHOD = 5 };
+  uchar *pixels;
+  Fl_RGB_Image *source;
+  Fl_Image *thumb[NMETHOD];
+  int copy_w, copy_h;
+
+  // Fills the source image with fine detail that aliases easily:
+  // concentric rings, a thin grid and an alpha ramp
+  void make_source() {
+    pixels = new uchar[SRC_W * SRC_H * 4];
+    uchar *p = pixels;
+    for (int y = 0; y < SRC_H; y++) {
+      for (int x = 0; x < SRC_W; x++, p += 4) {
+        int dx = x - SRC_W / 2, dy = y - SRC_H / 2;
+        int ring = ((dx * dx + dy * dy) / 256) & 1;
+        int grid = (x % 16) == 0 || (y % 16) == 0;
+        p[0] = (uchar)(ring ? 255 : x * 255 / SRC_W);
+        p[1] = (uchar)(grid ? 0 : y * 255 / SRC_H);
+        p[2] = (uchar)(ring ? 64 : 192);
+        p[3] = (uchar)(x < SRC_W / 2 ? 255 : 255 - (x - SRC_W / 2) * 192 / (SRC_W / 2));
+      }
+    }
+    source = new Fl_RGB_Image(pixels, SRC_W, SRC_H, 4);
+  }
+
+  // Returns a copy of a W x H image of d bytes per pixel, all set to pixel,
+  // or to random values in [lo, hi] if pixel is NULL
+  static Fl_Image *scale(int W, int H, int d, const uchar *pixel, int lo, int hi,
+                         int cw, int ch) {
+    uchar *data = new uchar[W * H * d];
+    for (int i = 0; i < W * H * d; i++)
+      data[i] = (uchar)(pixel ? pixel[i % d] : lo + rand() % (hi - lo + 1));
+    Fl_RGB_Image img(data, W, H, d);
+    Fl_Image *copy = img.copy(cw, ch);
+    delete[] data;
+    return copy;
+  }
+
+  // Returns 1 if all bytes of the copy are within tolerance of pixel,
+  // and its alpha channel, if any, is unchanged
+  static int same_pixels(Fl_Image *copy, const uchar *pixel, int cw, int ch, int tolerance) {
+    int d = copy->d();
+    if (copy->w() != cw || copy->h() != ch) return 0;
+    const uchar *p = (const uchar *)copy->data()[0];
+    for (int i = 0; i < cw * ch * d; i++) {
+      int k = i % d, diff = abs(p[i] - pixel[k]);
+      if ((d == 2 || d == 4) && k == d - 1 ? diff != 0 : diff > tolerance) return 0;
+    }
+    return 1;
+  }
+
+  // Returns 1 if all bytes of the copy are in [lo, hi]
+  static int in_range(Fl_Image *copy, int lo, int hi) {
+    const uchar *p = (const uchar *)copy->data()[0];
+    for (int i = 0; i < copy->w() * copy->h() * copy->d(); i++)
+      if (p[i] < lo || p[i] > hi) return 0;
+    return 1;
+  }
+
+  // Checks each method with flat images of each depth, enlarged, reduced
+  // and copied from and to single pixels, rows and columns
+  void run() {
+    static const int sizes[][4] = {       // source and copy sizes
+      {1, 1, 1, 1}, {1, 1, 7, 5}, {1, 1, 1, 9}, {37, 1, 1, 1}, {37, 1, 10, 1},
+      {37, 1, 80, 1}, {37, 1, 37, 4}, {1, 37, 1, 12}, {1, 37, 3, 80},
+      {64, 48, 13, 7}, {13, 7, 64, 48}, {300, 200, 299, 201}
+    };
+    // opaque and translucent pixels for each depth
+    static const uchar opaque[5][4] = {
+      {0}, {37}, {37, 255}, {37, 150, 222}, {37, 150, 222, 255}
+    };
+    static const uchar translucent[5][4] = {
+      {0}, {0}, {37, 100}, {0}, {37, 150, 222, 100}
+    };
+    char what[256];
+    Fl_RGB_Scaling keep = Fl_Image::RGB_scaling();
+    srand(1);
+    for (int m = 0; m < NMETHOD; m++) {
+      Fl_Image::RGB_scaling((Fl_RGB_Scaling)m);
+      int ok_flat = 1, ok_alpha = 1, ok_range = 1;
+      for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        const int *z = sizes[s];
+        for (int d = 1; d <= 4; d++) {
+          Fl_Image *copy = scale(z[0], z[1], d, opaque[d], 0, 0, z[2], z[3]);
+          ok_flat = ok_flat && same_pixels(copy, opaque[d], z[2], z[3], 0);
+          delete copy;
+          // premultiplying by an alpha of 100 loses up to 1.3 steps of color,
+          // and more with the bilinear method, that truncates
+          if (d == 1 || d == 3 || m == FL_RGB_SCALING_BILINEAR) continue;
+          copy = scale(z[0], z[1], d, translucent[d], 0, 0, z[2], z[3]);
+          ok_alpha = ok_alpha && same_pixels(copy, translucent[d], z[2], z[3], 2);
+          delete copy;
+        }
+        // box filtering averages pixels, so it stays within the source range,
+        // except for the rounding of colors premultiplied by alpha; the
+        // filters with negative lobes overshoot at edges
+        if (m != FL_RGB_SCALING_NEAREST && m != FL_RGB_SCALING_BOX) continue;
+        for (int d = 1; d <= 4; d++) {
+          int slack = (d == 2 || d == 4) ? 2 : 0;
+          Fl_Image *copy = scale(z[0], z[1], d, 0, 64, 191, z[2], z[3]);
+          ok_range = ok_range && in_range(copy, 64 - slack, 191 + slack);
+          delete copy;
+        }
+      }
+      snprintf(what, sizeof(what), "%s: flat images stay flat, also 1x1, Nx1 and 1xN",
+               scaling_names[m]);
+      check(what, ok_flat);
+      if (m != FL_RGB_SCALING_BILINEAR) {
+        snprintf(what, sizeof(what), "%s: flat images with alpha stay flat and keep their alpha",
+                 scaling_names[m]);
+        check(what, ok_alpha);
+      }
+      if (m == FL_RGB_SCALING_NEAREST || m == FL_RGB_SCALING_BOX) {
+        snprintf(what, sizeof(what), "%s: pixels stay within the source range",
+                 scaling_names[m]);
+        check(what, ok_range);
+      }
+    }
+    Fl_Image::RGB_scaling(keep);
+  }
+
+  static void copy_cb(void *data) {
+    ImageScalingTest *t = (ImageScalingTest *)data;
+    delete t->source->copy(t->copy_w, t->copy_h);
+  }
+
+  // Times copy() for a few common thumbnail sizes with each method
+  void bench() {
+    static const int sizes[][2] = { {64, 48}, {128, 96}, {256, 192}, {1280, 960} };
+    char line[256];
+    Fl_RGB_Scaling keep = Fl_Image::RGB_scaling();
+    bench_begin("@bMethod\t@b64x48\t@b128x96\t@b256x192\t@b1280x960");
+    for (int m = 0; m < NMETHOD; m++) {
+      Fl_Image::RGB_scaling((Fl_RGB_Scaling)m);
+      int n = snprintf(line, sizeof(line), "%s", scaling_names[m]);
+      for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        copy_w = sizes[s][0];
+        copy_h = sizes[s][1];
+        n += snprintf(line + n, sizeof(line) - n, "\t%.2f ms", time_calls(copy_cb, this));
+      }
+      results->add(line);
+    }
+    results->add("");
+    results->add("Time of Fl_RGB_Image::copy() of a 1024x768 RGBA image");
+    Fl_Image::RGB_scaling(keep);
+    bench_end();
+  }
+
+public:
+  static Fl_Widget *create() {
+    return new ImageScalingTest(TESTAREA_X, TESTAREA_Y, TESTAREA_W, TESTAREA_H);
+  }
+  ImageScalingTest(int x, int y, int w, int h) : ResultsTest(x, y, w, h) {
+    static const int widths[] = { 100, 95, 95, 95, 95, 0 };
+    make_source();
+    Fl_RGB_Scaling keep = Fl_Image::RGB_scaling();
+    int tw = (w - 10) / NMETHOD;
+    for (int m = 0; m < NMETHOD; m++) {
+      Fl_Image::RGB_scaling((Fl_RGB_Scaling)m);
+      thumb[m] = source->copy(tw - 6, (tw - 6) * SRC_H / SRC_W);
+      Fl_Box *b = new Fl_Box(x + 5 + m * tw, y + 5, tw, thumb[m]->h() + 6, scaling_names[m]);
+      b->box(FL_DOWN_BOX);
+      b->image(thumb[m]);
+      b->align(FL_ALIGN_BOTTOM);
+    }
+    Fl_Image::RGB_scaling(keep);
+    int by = y + thumb[0]->h() + 40;
+    add_results(x + 5, by, w - 10, y + h - by - 5, "Fl_RGB_Image::copy() scaling methods",
+                widths, "Run Copy Benchmark");
+    end();
+    run();
+  }
+  ~ImageScalingTest() {
+    for (int m = 0; m < NMETHOD; m++) delete thumb[m];
+    delete source;
+    delete[] pixels;
+  }
+};
+
+UnitTest image_scaling("image scaling", ImageScalingTest::create);
+
+//
+// End of "$Id$"
+//
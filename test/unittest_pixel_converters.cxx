@@ -0,0 +1,190 @@
+//
+// "$Id$"
+//
+// Unit tests for the Fast Light Tool Kit (FLTK).
+//
+// Copyright 1998-2018 by Bill Spitzak and others.
+//
+// This library is free software. Distribution and use rights are outlined in
+// the file "COPYING" which should have been included with this file.  If this
+// file is missing or damaged, see the license at:
+//
+//     http://www.fltk.org/COPYING.php
+//
+// Please report all bugs and problems on the following page:
+//
+//     http://www.fltk.org/str.php
+//
+
+#include <FL/platform.H>
+
+#if defined(USE_X11)
+
+#include <FL/Fl_Group.H>
+#include <FL/Fl_Image.H>
+#include <FL/Fl_Image_Surface.H>
+#include <FL/fl_draw.H>
+#include <stdio.h>
+
+//
+//------- check the pixels drawn by fl_draw_image() on 24-bit X11 visuals ----------
+//
+
+// On a TrueColor visual of 24 bits or more, fl_draw_image() must give back
+// the exact bytes of the image, whichever converter is used to pack them,
+// the SSSE3 ones or the scalar ones.
+class PixelConvertersTest : public ResultsTest {
+  enum { MAX_W = 100, MAX_DELTA = 5, BENCH_W = 1920, BENCH_H = 100 };
+  uchar *from;
+  int ran, bench_delta, bench_mono;
+
+  // Fills a line with pseudo-random bytes
+  static void fill(uchar *p, int n, unsigned seed) {
+    for (int i = 0; i < n; i++) {
+      seed = seed * 1103515245 + 12345;
+      p[i] = (uchar)(seed >> 16);
+    }
+  }
+
+  // Draws lines of 1 to MAX_W pixels of delta bytes on black, one per row,
+  // and checks that the pixels read back are those of the lines, and that
+  // nothing was drawn right of them, which covers the lines that end with a
+  // partial vector
+  void check_lines(int delta, int mono) {
+    char what[256];
+    Fl_Image_Surface surf(MAX_W + 1, MAX_W);
+    Fl_Surface_Device::push_current(&surf);
+    fl_color(FL_BLACK);
+    fl_rectf(0, 0, MAX_W + 1, MAX_W);
+    for (int w = 1; w <= MAX_W; w++) {
+      fill(from, w * delta, w * 31 + delta);
+      if (mono) fl_draw_image_mono(from, 0, w - 1, w, 1, delta);
+      else fl_draw_image(from, 0, w - 1, w, 1, delta);
+    }
+    uchar *rgb = fl_read_image(NULL, 0, 0, MAX_W + 1, MAX_W);
+    Fl_Surface_Device::pop_current();
+    if (!rgb) {
+      check("fl_read_image() of an Fl_Image_Surface", 0);
+      return;
+    }
+    int bad = 0;
+    for (int w = 1; w <= MAX_W && !bad; w++) {
+      fill(from, w * delta, w * 31 + delta);
+      const uchar *p = rgb + (w - 1) * (MAX_W + 1) * 3;
+      for (int x = 0; x <= MAX_W && !bad; x++, p += 3) {
+        for (int c = 0; c < 3; c++) {
+          int expected = x >= w ? 0 : from[x * delta + (mono ? 0 : c)];
+          if (p[c] != expected) bad = w;
+        }
+      }
+    }
+    delete[] rgb;
+    if (bad)
+      snprintf(what, sizeof(what), "%s, %d bytes per pixel: line of %d pixels differs",
+               mono ? "fl_draw_image_mono()" : "fl_draw_image()", delta, bad);
+    else
+      snprintf(what, sizeof(what), "%s, %d bytes per pixel, 1 to %d pixels wide",
+               mono ? "fl_draw_image_mono()" : "fl_draw_image()", delta, MAX_W);
+    check(what, !bad);
+  }
+
+  // Draws an RGBA image with every pair of color and alpha values on black,
+  // which gives the colors premultiplied by alpha
+  void check_alpha() {
+    Fl_Image_Surface surf(256, 256);
+    Fl_Surface_Device::push_current(&surf);
+    fl_color(FL_BLACK);
+    fl_rectf(0, 0, 256, 256);
+    for (int y = 0; y < 256; y++) {
+      for (int x = 0; x < 256; x++) {
+        uchar *p = from + (y * 256 + x) * 4;
+        p[0] = p[1] = p[2] = (uchar)x;
+        p[3] = (uchar)y;
+      }
+    }
+    Fl_RGB_Image *img = new Fl_RGB_Image(from, 256, 256, 4);
+    img->draw(0, 0);
+    delete img;
+    uchar *rgb = fl_read_image(NULL, 0, 0, 256, 256);
+    Fl_Surface_Device::pop_current();
+    if (!rgb) {
+      check("fl_read_image() of an Fl_Image_Surface", 0);
+      return;
+    }
+    int bad = 0;
+    for (int i = 0; i < 256 * 256 * 3 && !bad; i++)
+      if (rgb[i] != (i / 3 % 256) * (i / 768) / 255) bad = 1;
+    delete[] rgb;
+    check("Fl_RGB_Image::draw() with alpha, every color and alpha value", !bad);
+  }
+
+  void run() {
+    ran = 1;
+    fl_open_display();
+    if (fl_visual->c_class != TrueColor || fl_visual->depth < 24) {
+      results->add("@C2skipped\tthe visual is not a TrueColor visual of 24 bits or more");
+      return;
+    }
+    for (int delta = 3; delta <= MAX_DELTA; delta++)
+      check_lines(delta, 0);
+    for (int delta = 1; delta <= MAX_DELTA; delta++)
+      check_lines(delta, 1);
+    if (fl_can_do_alpha_blending())
+      check_alpha();
+  }
+
+  static void draw_cb(void *data) {
+    PixelConvertersTest *t = (PixelConvertersTest *)data;
+    if (t->bench_mono) fl_draw_image_mono(t->from, 0, 0, BENCH_W, BENCH_H, t->bench_delta);
+    else fl_draw_image(t->from, 0, 0, BENCH_W, BENCH_H, t->bench_delta);
+  }
+
+  // Times fl_draw_image() of an image of each pixel size to an offscreen
+  void bench() {
+    char line[256];
+    bench_begin("@bFunction\t@b1 byte\t@b2 bytes\t@b3 bytes\t@b4 bytes");
+    fill(from, BENCH_W * BENCH_H * 4, 1);
+    Fl_Image_Surface surf(BENCH_W, BENCH_H);
+    Fl_Surface_Device::push_current(&surf);
+    for (bench_mono = 0; bench_mono < 2; bench_mono++) {
+      int n = snprintf(line, sizeof(line), "%s", bench_mono ? "mono" : "color");
+      for (bench_delta = 1; bench_delta <= 4; bench_delta++)
+        n += snprintf(line + n, sizeof(line) - n, "\t%.2f ms", time_calls(draw_cb, this));
+      results->add(line);
+    }
+    Fl_Surface_Device::pop_current();
+    results->add("");
+    results->add("Time of fl_draw_image() of a 1920x100 image to an Fl_Image_Surface");
+    bench_end();
+  }
+
+public:
+  static Fl_Widget *create() {
+    return new PixelConvertersTest(TESTAREA_X, TESTAREA_Y, TESTAREA_W, TESTAREA_H);
+  }
+  PixelConvertersTest(int x, int y, int w, int h) : ResultsTest(x, y, w, h) {
+    static const int widths[] = { 100, 80, 80, 80, 80, 0 };
+    ran = 0;
+    from = new uchar[BENCH_W * BENCH_H * 4];
+    add_results(x + 5, y + 5, w - 10, h - 5, "fl_draw_image() on 24-bit X11 visuals", widths,
+                "Run Drawing Benchmark");
+    end();
+  }
+  ~PixelConvertersTest() {
+    delete[] from;
+  }
+  // The display is opened with the visual of the main window, so run the
+  // test when shown
+  void show() {
+    Fl_Group::show();
+    if (!ran) run();
+  }
+};
+
+UnitTest pixel_converters("pixel converters", PixelConvertersTest::create);
+
+#endif // USE_X11
+
+//
+// End of "$Id$"
+//
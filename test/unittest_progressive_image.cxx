@@ -0,0 +1,253 @@
+//
+// "$Id$"
+//
+// Unit tests for the Fast Light Tool Kit (FLTK).
+//
+// Copyright 1998-2018 by Bill Spitzak and others.
+//
+// This library is free software. Distribution and use rights are outlined in
+// the file "COPYING" which should have been included with this file.  If this
+// file is missing or damaged, see the license at:
+//
+//     http://www.fltk.org/COPYING.php
+//
+// Please report all bugs and problems on the following page:
+//
+//     http://www.fltk.org/str.php
+//
+
+#include <FL/Fl_Group.H>
+#include <FL/Fl_Progressive_Image.H>
+#include <FL/Fl_BMP_Image.H>
+#include <FL/Fl_GIF_Image.H>
+#include <FL/Fl_JPEG_Image.H>
+#include <FL/Fl_PNG_Image.H>
+#include <string.h>
+
+//
+//------- test decoding of complete and truncated image data ----------
+//
+
+// 1x1 GIF with a transparent pixel
+static const unsigned char progressive_gif[] = {
+  'G', 'I', 'F', '8', '9', 'a', 0x01, 0x00, 0x01, 0x00, 0x80, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0xff, 0xff, 0xff,
+  0x21, 0xf9, 0x04, 0x01, 0x00, 0x00, 0x00, 0x00,
+  0x2c, 0x00, 0x00, 0x00, 0x00, 0x01, 0x00, 0x01, 0x00, 0x00,
+  0x02, 0x02, 0x44, 0x01, 0x00, 0x3b
+};
+
+// 8x8 RGB PNG images with red = 32 * x and green = 32 * y, not interlaced
+// and interlaced
+static const unsigned char progressive_png[] = {
+  0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a, 0x00, 0x00, 0x00, 0x0d,
+  0x49, 0x48, 0x44, 0x52, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x08,
+  0x08, 0x02, 0x00, 0x00, 0x00, 0x4b, 0x6d, 0x29, 0xdc, 0x00, 0x00, 0x00,
+  0x6c, 0x49, 0x44, 0x41, 0x54, 0x78, 0xda, 0x15, 0xcd, 0x41, 0x15, 0x00,
+  0x51, 0x08, 0x42, 0x51, 0xa3, 0x18, 0x85, 0x28, 0x46, 0x79, 0x51, 0x88,
+  0x42, 0x14, 0xa2, 0xcc, 0x1f, 0x97, 0x5c, 0x0e, 0xce, 0x0c, 0x3b, 0x68,
+  0xb8, 0x81, 0xc1, 0x43, 0x86, 0x0e, 0x33, 0xcb, 0x2e, 0x5a, 0x6e, 0x61,
+  0xf1, 0x92, 0xa5, 0xfb, 0x40, 0xac, 0x90, 0x38, 0x81, 0xb0, 0x88, 0xa8,
+  0x1e, 0x1c, 0x7b, 0xe8, 0xb8, 0x83, 0xc3, 0x47, 0x8e, 0xde, 0x83, 0x7f,
+  0xe0, 0x55, 0x5f, 0xf8, 0x9f, 0x21, 0xd0, 0xf7, 0x6e, 0xcc, 0x1a, 0x99,
+  0xf3, 0x1f, 0xdb, 0xc4, 0xd4, 0x0f, 0xc2, 0x06, 0x85, 0xcb, 0x5f, 0x76,
+  0x48, 0x68, 0x1e, 0x94, 0x2d, 0x2a, 0xd7, 0x7f, 0xc2, 0x25, 0xa5, 0xe5,
+  0x03, 0xc6, 0x7b, 0x58, 0x01, 0x57, 0x39, 0x36, 0xf2, 0x00, 0x00, 0x00,
+  0x00, 0x49, 0x45, 0x4e, 0x44, 0xae, 0x42, 0x60, 0x82
+};
+
+static const unsigned char progressive_png_interlaced[] = {
+  0x89, 0x50, 0x4e, 0x47, 0x0d, 0x0a, 0x1a, 0x0a, 0x00, 0x00, 0x00, 0x0d,
+  0x49, 0x48, 0x44, 0x52, 0x00, 0x00, 0x00, 0x08, 0x00, 0x00, 0x00, 0x08,
+  0x08, 0x02, 0x00, 0x00, 0x01, 0x3c, 0x6a, 0x19, 0x4a, 0x00, 0x00, 0x00,
+  0x70, 0x49, 0x44, 0x41, 0x54, 0x78, 0xda, 0x1d, 0x8d, 0x59, 0x01, 0x00,
+  0x41, 0x08, 0x42, 0x8d, 0x62, 0x14, 0xa3, 0x10, 0xe5, 0x45, 0x21, 0x8a,
+  0x51, 0x88, 0xb2, 0xce, 0xea, 0x87, 0x22, 0x87, 0x55, 0xc5, 0xdf, 0xc5,
+  0xab, 0x9a, 0x62, 0x0f, 0x0d, 0xec, 0xa1, 0x9b, 0x73, 0xeb, 0xb0, 0x73,
+  0x60, 0x99, 0x7d, 0xf7, 0x5d, 0xaa, 0x0b, 0x15, 0x2e, 0x72, 0xea, 0x1e,
+  0x34, 0x78, 0xc8, 0xc9, 0x1a, 0x04, 0x86, 0x5c, 0x40, 0x2f, 0x5a, 0xbc,
+  0xe4, 0x3c, 0x47, 0x75, 0x33, 0x8d, 0x4e, 0xd3, 0xb8, 0xd9, 0x26, 0x7d,
+  0x84, 0x68, 0x31, 0x42, 0x7a, 0x66, 0x8b, 0x15, 0xd1, 0x11, 0xa6, 0xcd,
+  0x18, 0xf9, 0x45, 0xda, 0xac, 0x89, 0x8f, 0x08, 0x1d, 0x26, 0x28, 0xef,
+  0x91, 0xc3, 0x86, 0x84, 0x0f, 0xf7, 0xa0, 0x58, 0x01, 0xfb, 0x8c, 0x01,
+  0x46, 0x00, 0x00, 0x00, 0x00, 0x49, 0x45, 0x4e, 0x44, 0xae, 0x42, 0x60,
+  0x82
+};
+
+// 16x32 baseline grayscale JPEG with gray = 8 * y
+static const unsigned char progressive_jpeg[] = {
+  0xff, 0xd8, 0xff, 0xdb, 0x00, 0x43, 0x00, 0x10, 0x0b, 0x0c, 0x0e, 0x0c,
+  0x0a, 0x10, 0x0e, 0x0d, 0x0e, 0x12, 0x11, 0x10, 0x13, 0x18, 0x28, 0x1a,
+  0x18, 0x16, 0x16, 0x18, 0x31, 0x23, 0x25, 0x1d, 0x28, 0x3a, 0x33, 0x3d,
+  0x3c, 0x39, 0x33, 0x38, 0x37, 0x40, 0x48, 0x5c, 0x4e, 0x40, 0x44, 0x57,
+  0x45, 0x37, 0x38, 0x50, 0x6d, 0x51, 0x57, 0x5f, 0x62, 0x67, 0x68, 0x67,
+  0x3e, 0x4d, 0x71, 0x79, 0x70, 0x64, 0x78, 0x5c, 0x65, 0x67, 0x63, 0xff,
+  0xc0, 0x00, 0x0b, 0x08, 0x00, 0x20, 0x00, 0x10, 0x01, 0x01, 0x11, 0x00,
+  0xff, 0xc4, 0x00, 0x15, 0x00, 0x01, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x06, 0xff,
+  0xc4, 0x00, 0x16, 0x10, 0x00, 0x03, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x14, 0x61, 0xff,
+  0xda, 0x00, 0x08, 0x01, 0x01, 0x00, 0x00, 0x3f, 0x00, 0x8d, 0x4e, 0x04,
+  0xe1, 0x40, 0x9c, 0x09, 0xc2, 0x81, 0x38, 0x13, 0x85, 0x02, 0x70, 0x27,
+  0x0f, 0xff, 0xd9
+};
+
+class ProgressiveImageTest : public ResultsTest {
+  int rows_reported;	// Last row reported + 1
+  int rows_fed;		// Value of rows_reported before finish()
+  int reports;		// Number of calls of the callback
+
+  static void rows_cb(Fl_Progressive_Image *, int, int y1, void *data) {
+    ProgressiveImageTest *t = (ProgressiveImageTest *)data;
+    if (y1 > t->rows_reported) t->rows_reported = y1;
+    t->reports ++;
+  }
+
+  // Fills a BMP header for a W x H image of the given depth and colormap
+  // size, followed by size bytes; the rows are top-down if H < 0
+  static int bmp_header(unsigned char *b, int W, int H, int size, int depth = 24,
+                        int colors = 0) {
+    int offbits = 54 + 4 * colors;
+    memset(b, 0, offbits);
+    b[0] = 'B'; b[1] = 'M';
+    b[2] = (offbits + size) & 255; b[3] = ((offbits + size) >> 8) & 255;
+    b[10] = offbits & 255; b[11] = (offbits >> 8) & 255; b[14] = 40;
+    b[18] = W & 255; b[19] = (W >> 8) & 255;
+    for (int i = 0; i < 4; i ++) b[22 + i] = (H >> (8 * i)) & 255;
+    b[26] = 1; b[28] = depth; b[46] = colors;
+    return offbits;
+  }
+
+  // Feeds data in chunks of n bytes, returns the result of finish()
+  int stream(Fl_Progressive_Image &img, const unsigned char *data, int len, int n) {
+    rows_reported = 0;
+    reports = 0;
+    for (int i = 0; i < len; i += n)
+      if (img.feed(data + i, len - i < n ? len - i : n) < 0) return -1;
+    rows_fed = rows_reported;
+    return img.finish();
+  }
+
+  // Returns non-zero if both images have the same size and pixels
+  static int same_pixels(Fl_RGB_Image &a, Fl_RGB_Image &b) {
+    if (a.w() != b.w() || a.h() != b.h() || a.d() != b.d() || a.w() <= 0) return 0;
+    return memcmp(a.array, b.array, a.w() * a.h() * a.d()) == 0;
+  }
+
+  void run() {
+    unsigned char bmp[54 + 2 * 12];
+    int i;
+
+    // A complete 3x2 BMP image, fed one byte at a time
+    bmp_header(bmp, 3, 2, 24);
+    for (i = 0; i < 24; i ++) bmp[54 + i] = (unsigned char)(i * 10);
+    {
+      Fl_Progressive_Image img(rows_cb, this);
+      int r = stream(img, bmp, sizeof(bmp), 1);
+      check("complete BMP is decoded", r == 0 && img.w() == 3 && img.h() == 2 &&
+            rows_reported == 2 && img.array[0] == 140 && img.array[2] == 120);
+      check("BMP rows are reported as they arrive", rows_fed == 2 && reports == 2);
+    }
+
+    // A 5x3 top-down BMP image with 16 colors, fed in chunks of 5 bytes
+    {
+      unsigned char bmp4[54 + 16 * 4 + 3 * 4];
+      int off = bmp_header(bmp4, 5, -3, 3 * 4, 4, 16);
+      for (i = 0; i < 16 * 4; i ++) bmp4[54 + i] = (unsigned char)(i * 4);
+      for (i = 0; i < 3 * 4; i ++) bmp4[off + i] = (unsigned char)(i * 37);
+      Fl_Progressive_Image img(rows_cb, this);
+      int r = stream(img, bmp4, sizeof(bmp4), 5);
+      Fl_BMP_Image direct(0, bmp4, sizeof(bmp4));
+      check("16-color top-down BMP matches Fl_BMP_Image", r == 0 && same_pixels(img, direct));
+    }
+
+    // A BMP header claiming 4000x4000 pixels without pixel data
+    bmp_header(bmp, 4000, 4000, 4000 * 4000 * 3);
+    {
+      Fl_Progressive_Image img(rows_cb, this);
+      int r = stream(img, bmp, 54, 7);
+      check("truncated BMP fails", r == -1 && img.fail() == Fl_Image::ERR_FORMAT);
+      Fl_BMP_Image direct(0, bmp, 54);
+      check("truncated BMP fails in Fl_BMP_Image", direct.fail() == Fl_Image::ERR_FORMAT);
+    }
+
+    // A complete GIF image
+    {
+      Fl_Progressive_Image img(rows_cb, this);
+      int r = stream(img, progressive_gif, sizeof(progressive_gif), 5);
+      check("complete GIF is decoded", r == 0 && img.w() == 1 && img.h() == 1 &&
+            img.d() == 4 && img.array[3] == 0);
+    }
+
+    // The same GIF cut in the image data, and in the color table
+    for (i = (int)sizeof(progressive_gif) - 4; i > 12; i -= 25) {
+      Fl_Progressive_Image img(rows_cb, this);
+      int r = stream(img, progressive_gif, i, 3);
+      check(i > 20 ? "GIF cut in the image data fails" : "GIF cut in the color table fails",
+            r == -1 && img.fail() == Fl_Image::ERR_FORMAT);
+    }
+    Fl_GIF_Image direct(0, progressive_gif, sizeof(progressive_gif) - 4);
+    check("truncated GIF fails in Fl_GIF_Image", direct.fail() == Fl_Image::ERR_FORMAT);
+
+    // PNG images fed one byte at a time and in larger chunks
+    Fl_PNG_Image png(0, progressive_png, sizeof(progressive_png));
+    for (i = 1; i < 100; i *= 7) {
+      Fl_Progressive_Image img(rows_cb, this);
+      int r = stream(img, progressive_png, sizeof(progressive_png), i);
+      check(i == 1 ? "PNG fed one byte at a time matches Fl_PNG_Image" :
+            "PNG fed in chunks matches Fl_PNG_Image",
+            r == 0 && same_pixels(img, png) && rows_fed == 8);
+    }
+    for (i = 1; i < 100; i *= 7) {
+      Fl_Progressive_Image img(rows_cb, this);
+      int r = stream(img, progressive_png_interlaced, sizeof(progressive_png_interlaced), i);
+      check(i == 1 ? "interlaced PNG fed one byte at a time matches" :
+            "interlaced PNG fed in chunks matches", r == 0 && same_pixels(img, png));
+    }
+
+    // A baseline JPEG image, whose rows are reported as they are decoded
+    Fl_JPEG_Image jpeg(0, progressive_jpeg);
+    for (i = 1; i < 100; i *= 7) {
+      Fl_Progressive_Image img(rows_cb, this);
+      int r = stream(img, progressive_jpeg, sizeof(progressive_jpeg), i);
+      check(i == 1 ? "JPEG fed one byte at a time matches Fl_JPEG_Image" :
+            "JPEG fed in chunks matches Fl_JPEG_Image",
+            r == 0 && same_pixels(img, jpeg) && rows_fed == 32);
+      if (i == 1) check("JPEG rows are reported in several calls", reports > 1);
+    }
+
+    // The same JPEG cut in the scan, completed with the rows decoded so far
+    {
+      Fl_Progressive_Image img(rows_cb, this);
+      int r = stream(img, progressive_jpeg, sizeof(progressive_jpeg) - 8, 3);
+      check("truncated JPEG is completed", r == 0 && img.w() == 16 && img.h() == 32 &&
+            rows_reported == 32 && memcmp(img.array, jpeg.array, 16 * 3) == 0);
+    }
+
+    // Data that isn't an image
+    {
+      static const unsigned char junk[] = "this is not an image";
+      Fl_Progressive_Image img;
+      int r = stream(img, junk, sizeof(junk), 4);
+      check("unknown data fails", r == -1 && img.fail() == Fl_Image::ERR_FORMAT);
+    }
+  }
+
+public:
+  static Fl_Widget *create() {
+    return new ProgressiveImageTest(TESTAREA_X, TESTAREA_Y, TESTAREA_W, TESTAREA_H);
+  }
+  ProgressiveImageTest(int x, int y, int w, int h) : ResultsTest(x, y, w, h) {
+    static const int widths[] = { 70, 0 };
+    add_results(x + 5, y + 5, w - 10, h - 5,
+                "Fl_Progressive_Image and the image classes", widths);
+    end();
+    run();
+  }
+};
+
+UnitTest progressive_image("progressive images", ProgressiveImageTest::create);
+
+//
+// End of "$Id$"
+//
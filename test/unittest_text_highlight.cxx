@@ -0,0 +1,120 @@
+//
+// "$Id$"
+//
+// Unit tests for the Fast Light Tool Kit (FLTK).
+//
+// Copyright 1998-2018 by Bill Spitzak and others.
+//
+// This library is free software. Distribution and use rights are outlined in
+// the file "COPYING" which should have been included with this file.  If this
+// file is missing or damaged, see the license at:
+//
+//     http://www.fltk.org/COPYING.php
+//
+// Please report all bugs and problems on the following page:
+//
+//     http://www.fltk.org/str.php
+//
+
+#include <FL/Fl_Group.H>
+#include <FL/Fl_Text_Display.H>
+
+//
+//------- test the line based highlighting of Fl_Text_Display ----------
+//
+
+// Gives access to the styles and computes the remaining states at once
+class HighlightDisplay : public Fl_Text_Display {
+public:
+  HighlightDisplay(int x, int y, int w, int h) : Fl_Text_Display(x, y, w, h) { }
+  int style(int pos) const { return line_style(pos); }
+  void highlight_all() {
+    for (int i = 0; i <= buffer()->length() / 65536; i++)
+      highlight_idle_cb(this);
+  }
+};
+
+class TextHighlightTest : public ResultsTest {
+  int ran;
+
+  // Styles C comments with 'B', the state is 1 inside a comment
+  static int comment_cb(const char *text, int len, int state, char *style, void *) {
+    for (int i = 0; i < len; i++) {
+      if (!state && text[i] == '/' && i + 1 < len && text[i + 1] == '*')
+        state = 1;
+      if (state) {
+        style[i] = 'B';
+        if (i > 0 && text[i - 1] == '*' && text[i] == '/')
+          state = 0;
+      }
+    }
+    return state;
+  }
+
+  // Fills a buffer with n copies of a line after a first line
+  static void fill(Fl_Text_Buffer *buf, const char *first, const char *line, int n) {
+    buf->text(first);
+    for (int i = 0; i < n; i++)
+      buf->append(line);
+  }
+
+  void run() {
+    static const Fl_Text_Display::Style_Table_Entry styles[] = {
+      { FL_BLACK, FL_COURIER, 14, 0 },
+      { FL_DARK_GREEN, FL_COURIER_ITALIC, 14, 0 }
+    };
+    ran = 1;
+    Fl_Text_Buffer comments, code;
+    fill(&comments, "/*\n", "comment line\n", 100);
+    fill(&code, "", "code line\n", 100);
+    Fl_Group *save = Fl_Group::current();
+    Fl_Group::current(0);
+    HighlightDisplay *d = new HighlightDisplay(0, 0, 400, 600);
+    Fl_Group::current(save);
+    d->highlight_lines(styles, 2, comment_cb, 0);
+
+    d->buffer(&comments);
+    d->highlight_all();
+    check("lines in an open comment are styled", d->style(comments.skip_lines(0, 50)) == 'B');
+
+    // The states of the old buffer must not be used for the new one
+    d->buffer(&code);
+    check("first line after swapping buffers", d->style(0) == 'A');
+    d->highlight_all();
+    check("later lines after swapping buffers", d->style(code.skip_lines(0, 50)) == 'A');
+    d->buffer(&comments);
+    check("lines after swapping back", d->style(comments.skip_lines(0, 50)) == 'B');
+
+    // Edits are styled from the states of the new buffer
+    d->buffer(&code);
+    code.insert(0, "/*");
+    check("edit after swapping buffers", d->style(code.skip_lines(0, 50)) == 'B');
+    code.remove(0, 2);
+    check("undone edit after swapping buffers", d->style(code.skip_lines(0, 50)) == 'A');
+
+    d->buffer(0);
+    delete d;
+  }
+
+public:
+  static Fl_Widget *create() {
+    return new TextHighlightTest(TESTAREA_X, TESTAREA_Y, TESTAREA_W, TESTAREA_H);
+  }
+  TextHighlightTest(int x, int y, int w, int h) : ResultsTest(x, y, w, h) {
+    static const int widths[] = { 70, 0 };
+    ran = 0;
+    add_results(x + 5, y + 5, w - 10, h - 5, "Fl_Text_Display::highlight_lines()", widths);
+    end();
+  }
+  // The text is measured with the display fonts, so run the test when shown
+  void show() {
+    Fl_Group::show();
+    if (!ran) run();
+  }
+};
+
+UnitTest text_highlight("text highlighting", TextHighlightTest::create);
+
+//
+// End of "$Id$"
+//
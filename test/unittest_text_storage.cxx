@@ -0,0 +1,134 @@
+//
+// "$Id$"
+//
+// Unit tests for the Fast Light Tool Kit (FLTK).
+//
+// Copyright 1998-2018 by Bill Spitzak and others.
+//
+// This library is free software. Distribution and use rights are outlined in
+// the file "COPYING" which should have been included with this file.  If this
+// file is missing or damaged, see the license at:
+//
+//     http://www.fltk.org/COPYING.php
+//
+// Please report all bugs and problems on the following page:
+//
+//     http://www.fltk.org/str.php
+//
+
+#include <FL/Fl_Group.H>
+#include <FL/Fl_Text_Buffer.H>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//
+//------- compare the edit throughput of the text buffer storage engines ----------
+//
+
+class TextStorageTest : public ResultsTest {
+  unsigned seed;
+  Fl_Text_Buffer *bench_buf;
+
+  int random(int n) {
+    seed = seed * 1103515245 + 12345;
+    return int((seed >> 8) % unsigned(n));
+  }
+
+  // Returns a buffer with size bytes of lines of text
+  static Fl_Text_Buffer *make_buffer(int engine, int size) {
+    char *text = (char *)malloc(size + 1);
+    for (int i = 0; i < size; i++)
+      text[i] = (i % 64 == 63) ? '\n' : (char)('a' + i % 26);
+    text[size] = 0;
+    Fl_Text_Buffer *buf = new Fl_Text_Buffer();
+    buf->canUndo(0);
+    buf->storage(engine);
+    buf->text(text);
+    free(text);
+    return buf;
+  }
+
+  // Inserts or removes a few bytes at a random position
+  void edit(Fl_Text_Buffer *buf) {
+    static const char words[] = "the quick brown fox jumps over the lazy dog\n";
+    int len = buf->length();
+    int n = 1 + random(16);
+    if (random(2) || len < 1000) {
+      char text[17];
+      memcpy(text, words + random((int)sizeof(words) - 17), n);
+      text[n] = 0;
+      buf->insert(random(len + 1), text);
+    } else {
+      int pos = random(len - n);
+      buf->remove(pos, pos + n);
+    }
+  }
+
+  // Makes the same random edits in both engines and compares the text
+  void run() {
+    Fl_Text_Buffer *gap = make_buffer(Fl_Text_Buffer::GAP_BUFFER, 300000);
+    Fl_Text_Buffer *rope = make_buffer(Fl_Text_Buffer::ROPE, 300000);
+    seed = 1;
+    for (int i = 0; i < 20000; i++) edit(gap);
+    seed = 1;
+    for (int i = 0; i < 20000; i++) edit(rope);
+    char *t1 = gap->text(), *t2 = rope->text();
+    check("ROPE text after 20000 random edits", strcmp(t1, t2) == 0);
+    int same = 1;
+    for (int i = 0; i < gap->length() && same; i += 97)
+      same = gap->byte_at(i) == rope->byte_at(i);
+    check("ROPE byte_at() after 20000 random edits", same);
+    free(t1);
+    free(t2);
+    delete gap;
+    delete rope;
+  }
+
+  static void edits_cb(void *data) {
+    TextStorageTest *t = (TextStorageTest *)data;
+    for (int i = 0; i < 100; i++) t->edit(t->bench_buf);
+  }
+
+  // Times random edits in buffers of growing sizes with both engines
+  void bench() {
+    static const int sizes[] = { 100000, 1000000, 10000000 };
+    static const int engines[] = { Fl_Text_Buffer::GAP_BUFFER, Fl_Text_Buffer::ROPE };
+    static const char *names[] = { "GAP_BUFFER", "ROPE" };
+    char line[256];
+    bench_begin("@bStorage\t@b100 kB\t@b1 MB\t@b10 MB");
+    for (int e = 0; e < 2; e++) {
+      int n = snprintf(line, sizeof(line), "%s", names[e]);
+      for (unsigned s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        bench_buf = make_buffer(engines[e], sizes[s]);
+        seed = 1;
+        // 100 edits per call, so 100 edits per millisecond are 100 k/s
+        n += snprintf(line + n, sizeof(line) - n, "\t%.0f k/s", 100 / time_calls(edits_cb, this));
+        delete bench_buf;
+      }
+      results->add(line);
+    }
+    results->add("");
+    results->add("Edits per second at random positions");
+    bench_end();
+  }
+
+public:
+  static Fl_Widget *create() {
+    return new TextStorageTest(TESTAREA_X, TESTAREA_Y, TESTAREA_W, TESTAREA_H);
+  }
+  TextStorageTest(int x, int y, int w, int h) : ResultsTest(x, y, w, h) {
+    static const int widths[] = { 110, 100, 100, 100, 0 };
+    add_results(x + 5, y + 5, w - 10, h - 5, "Fl_Text_Buffer::storage() engines", widths,
+                "Run Edit Benchmark");
+    bench_buf = 0;
+    end();
+    run();
+  }
+};
+
+UnitTest text_storage("text buffer storage", TextStorageTest::create);
+
+//
+// End of "$Id$"
+//
@@ -0,0 +1,128 @@
+//
+// "$Id$"
+//
+// Unit tests for the Fast Light Tool Kit (FLTK).
+//
+// Copyright 1998-2018 by Bill Spitzak and others.
+//
+// This library is free software. Distribution and use rights are outlined in
+// the file "COPYING" which should have been included with this file.  If this
+// file is missing or damaged, see the license at:
+//
+//     http://www.fltk.org/COPYING.php
+//
+// Please report all bugs and problems on the following page:
+//
+//     http://www.fltk.org/str.php
+//
+
+#include <FL/Fl_Group.H>
+#include <FL/Fl_Text_Display.H>
+#include <stdio.h>
+
+//
+//------- test the incremental count of wrapped lines ----------
+//
+
+// Gives access to the line count and counts the remaining text at once
+class WrapCountDisplay : public Fl_Text_Display {
+public:
+  WrapCountDisplay(int x, int y, int w, int h) : Fl_Text_Display(x, y, w, h) { }
+  int buffer_lines() const { return mNBufferLines; }
+  void count_all() {
+    for (int i = 0; i <= buffer()->length() / 16384; i++)
+      wrap_idle_cb(this);
+    count_wrapped_lines();
+  }
+};
+
+class TextWrapTest : public ResultsTest {
+  Fl_Text_Buffer *buf;
+  WrapCountDisplay *incremental, *reference;
+  int ran;
+
+  // Compares the incremental count to the count of the whole buffer
+  void check_lines(const char *what) {
+    char line[256];
+    snprintf(line, sizeof(line), "%s (%d lines)", what, reference->buffer_lines());
+    check(line, incremental->buffer_lines() == reference->buffer_lines());
+  }
+
+  // Appends n lines of various lengths, the last one without a newline
+  void append_lines(int n) {
+    char line[200];
+    for (int i = 0; i < n; i++) {
+      int len = 10 + (i * 37) % 150;
+      for (int j = 0; j < len; j++)
+        line[j] = (j % 7 == 6) ? ' ' : (char)('a' + (i + j) % 26);
+      line[len] = '\n';
+      line[len + 1] = 0;
+      if (i == n - 1) line[len] = 0;
+      buf->append(line);
+    }
+  }
+
+  void run() {
+    ran = 1;
+    append_lines(3000);
+    Fl_Group *save = Fl_Group::current();
+    Fl_Group::current(0);
+    incremental = new WrapCountDisplay(0, 0, 400, 200);
+    reference = new WrapCountDisplay(0, 0, 400, 200);
+    Fl_Group::current(save);
+    incremental->incremental_wrap(1);
+    incremental->buffer(buf);
+    reference->buffer(buf);
+    incremental->wrap_mode(Fl_Text_Display::WRAP_AT_COLUMN, 40);
+    reference->wrap_mode(Fl_Text_Display::WRAP_AT_COLUMN, 40);
+    incremental->count_all();
+    check_lines("count of the whole buffer");
+
+    // Continue the last line, then append more lines to the counted text
+    buf->append(" continued up to well beyond the wrap margin of forty columns");
+    check_lines("append to the last line");
+    incremental->count_all();
+    check_lines("count after appending to the last line");
+    append_lines(500);
+    incremental->count_all();
+    check_lines("count after appending lines");
+
+    // Append to an empty buffer
+    buf->text("");
+    incremental->count_all();
+    buf->append("one\ntwo\n");
+    incremental->count_all();
+    check_lines("count after appending to an empty buffer");
+
+    incremental->buffer(0);
+    reference->buffer(0);
+    delete incremental;
+    delete reference;
+  }
+
+public:
+  static Fl_Widget *create() {
+    return new TextWrapTest(TESTAREA_X, TESTAREA_Y, TESTAREA_W, TESTAREA_H);
+  }
+  TextWrapTest(int x, int y, int w, int h) : ResultsTest(x, y, w, h) {
+    static const int widths[] = { 70, 0 };
+    ran = 0;
+    buf = new Fl_Text_Buffer();
+    add_results(x + 5, y + 5, w - 10, h - 5, "Fl_Text_Display::incremental_wrap()", widths);
+    end();
+  }
+  ~TextWrapTest() {
+    delete buf;
+  }
+  // The text is measured with the display fonts, so run the test when shown
+  void show() {
+    Fl_Group::show();
+    if (!ran) run();
+  }
+};
+
+UnitTest text_wrap("text wrapping", TextWrapTest::create);
+
+//
+// End of "$Id$"
+//
@@ -29,7 +29,11 @@
 #include <FL/Fl_Help_View.H>
 #include <FL/Fl_Group.H>
 #include <FL/Fl_Box.H>
+#include <FL/Fl_Button.H>
+#include <FL/Fl_Browser.H>
 #include <FL/fl_draw.H>		// fl_text_extents()
+#include <stdio.h>
+#include <time.h>
 
 // WINDOW/WIDGET SIZES
 #define MAINWIN_W	700				// main window w()
@@ -140,6 +144,66 @@ public:
   int fTestAlignment;
 };
 
+// The tests that check results rather than draw them list one line per
+// check in a browser with tab separated columns, marked "passed" or "FAILED".
+// An optional button above the browser runs bench(), that replaces the
+// list by a table of timings between bench_begin() and bench_end().
+class ResultsTest : public Fl_Group {
+public:
+  ResultsTest(int x, int y, int w, int h) :
+    Fl_Group(x, y, w, h),
+    results(0)
+  { }
+protected:
+  Fl_Browser *results;
+  // Adds the browser below the button, if any, and above its label
+  void add_results(int x, int y, int w, int h, const char *label, const int *widths,
+                   const char *button = 0) {
+    if (button) {
+      Fl_Button *b = new Fl_Button(x, y, 200, 25, button);
+      b->callback(bench_cb, this);
+      y += 30;
+      h -= 30;
+    }
+    results = new Fl_Browser(x, y, w, label ? h - 25 : h, label);
+    results->align(FL_ALIGN_BOTTOM);
+    results->column_widths(widths);
+    results->column_char('\t');
+  }
+  void check(const char *what, int ok) {
+    char line[256];
+    snprintf(line, sizeof(line), "%s\t%s", ok ? "@C4passed" : "@C1FAILED", what);
+    results->add(line);
+  }
+  virtual void bench() { }
+  // Clears the list and adds the header row, with the wait cursor on
+  void bench_begin(const char *header) {
+    fl_cursor(FL_CURSOR_WAIT);
+    Fl::flush();
+    results->clear();
+    results->add(header);
+  }
+  void bench_end() {
+    fl_cursor(FL_CURSOR_DEFAULT);
+  }
+  // Returns the time of one call of fn(data) in milliseconds, measured
+  // over as many calls as take at least 0.2 seconds
+  static double time_calls(void (*fn)(void *), void *data) {
+    int count = 0;
+    clock_t t0 = clock(), t;
+    do {
+      fn(data);
+      count++;
+      t = clock() - t0;
+    } while (t < CLOCKS_PER_SEC / 5);
+    return t * 1000.0 / CLOCKS_PER_SEC / count;
+  }
+private:
+  static void bench_cb(Fl_Widget *, void *data) {
+    ((ResultsTest *)data)->bench();
+  }
+};
+
 //------- include the various unit tests as inline code -------
 
 #include "unittest_about.cxx"
@@ -150,10 +214,16 @@ public:
 #include "unittest_text.cxx"
 #include "unittest_symbol.cxx"
 #include "unittest_images.cxx"
+#include "unittest_image_scaling.cxx"
+#include "unittest_progressive_image.cxx"
 #include "unittest_viewport.cxx"
 #include "unittest_scrollbarsize.cxx"
 #include "unittest_schemes.cxx"
 #include "unittest_simple_terminal.cxx"
+#include "unittest_text_wrap.cxx"
+#include "unittest_text_highlight.cxx"
+#include "unittest_text_storage.cxx"
+#include "unittest_pixel_converters.cxx"
 
 // callback whenever the browser value changes
 void Browser_CB(Fl_Widget*, void*) {